@@ -0,0 +1,43 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Startup asset loading on a worker pool.
+// Each job is split in two: the work (file reads, image decoding, mesh
+// import) runs on one of the workers, and the upload, which makes the GL
+// calls, is queued for the main thread, which runs uploads as their work
+// completes while it waits in finish(). The main thread can do its own
+// loading between queueing jobs and finish(), overlapping the workers.
+class AssetLoader {
+public:
+    // 0 threads: one per hardware thread
+    explicit AssetLoader(unsigned int threads = 0);
+    ~AssetLoader();
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    // Main thread. Whatever both halves share has to outlive finish().
+    void load(std::function<void()> work, std::function<void()> upload);
+
+    // Main thread: run uploads until every job queued so far is done
+    void finish();
+
+    size_t getThreadCount() const { return workers.size(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workReady;   // workers wait for jobs
+    std::condition_variable uploadReady; // the main thread waits for uploads
+    std::deque<std::function<void()>> jobs;
+    std::deque<std::function<void()>> uploads;
+    size_t pending = 0; // jobs queued whose upload has not run yet
+    bool stopping = false;
+
+    void workerLoop();
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// One file in the pack
+struct AssetPackEntry {
+    uint32_t pathOffset, pathLength; // into the string section, "assets/models/..." as the game asks for it
+    uint64_t offset, size;           // of its bytes, from the start of the pack
+    uint64_t hash;                   // FNV-1a of its bytes, see ContentHash
+};
+
+// On-disk asset pack (".pak"): header, the entry table sorted by path, the
+// path strings, then every file's bytes at a page aligned offset
+struct AssetPackHeader {
+    char magic[4];          // "APK1", written last: a partly written pack has none
+    uint32_t version;
+    uint64_t entryOffset, entryCount;
+    uint64_t stringOffset, stringCount; // bytes, not terminated
+};
+
+// Many asset files in one, mapped once and read in place: a file's bytes are
+// a range of the mapping, so opening one costs a binary search and no syscall.
+// Files keep the alignment they would have on their own (pages), so mapped
+// caches can cast into them as usual.
+class AssetPack {
+public:
+    static const uint32_t VERSION = 1;
+    static const uint64_t ALIGNMENT = 4096;
+
+    // paths: the files to pack, stored under these names
+    static bool write(const std::string& path, const std::vector<std::string>& paths);
+
+    bool open(const std::string& path);
+    void close() { file.close(); entries = nullptr; entryCount = 0; }
+    bool isOpen() const { return file.isOpen(); }
+
+    // nullptr if the pack has no such file; path as normalized by VirtualFileSystem
+    const AssetPackEntry* find(const std::string& path) const;
+
+    const MappedFile& getFile() const { return file; }
+    size_t getEntryCount() const { return entryCount; }
+
+private:
+    MappedFile file;
+    const AssetPackEntry* entries = nullptr;
+    size_t entryCount = 0;
+    const char* strings = nullptr;
+    size_t stringCount = 0;
+};
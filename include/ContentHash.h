@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, the content hash every cache, cooked file and asset pack
+// keys its sources by
+class ContentHash {
+public:
+    // Over a file's contents (read through VirtualFileSystem, packed files come with theirs).
+    // A loose file the loaded manifest lists with its current size and modification time
+    // comes with the hash recorded there, without reading it.
+    static bool hashFile(const std::string& path, uint64_t& hash);
+    static uint64_t hashBytes(const unsigned char* bytes, size_t size);
+
+    // Trust the source hashes assetcook recorded in its manifest (see assetcook). Load once,
+    // before any loading; false when there is none. assetcook itself never loads it, so a cook
+    // hashes every source in full.
+    static bool loadManifest(const std::string& path);
+};
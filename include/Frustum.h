@@ -0,0 +1,35 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// View frustum planes, extracted from a (projection * view) matrix
+struct Frustum {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far (xyz = normal, w = distance)
+
+    void update(const glm::mat4& viewProjection) {
+        // glm is column-major, so transpose to get the rows
+        glm::mat4 m = glm::transpose(viewProjection);
+
+        planes[0] = m[3] + m[0];
+        planes[1] = m[3] - m[0];
+        planes[2] = m[3] + m[1];
+        planes[3] = m[3] - m[1];
+        planes[4] = m[3] + m[2];
+        planes[5] = m[3] - m[2];
+
+        for (auto& p : planes)
+            p /= glm::length(glm::vec3(p));
+    }
+
+    // True if the box is at least partially inside
+    bool intersectsAABB(const glm::vec3& minP, const glm::vec3& maxP) const {
+        for (const auto& p : planes) {
+            // corner furthest along the plane normal
+            glm::vec3 v(p.x > 0.0f ? maxP.x : minP.x,
+                        p.y > 0.0f ? maxP.y : minP.y,
+                        p.z > 0.0f ? maxP.z : minP.z);
+            if (glm::dot(glm::vec3(p), v) + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
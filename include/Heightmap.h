@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// 16-bit heightmap samples, row-major
+struct Heightmap {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned short> samples;
+
+    // Images go through stb_image at full 16-bit precision (8-bit ones are widened).
+    // ".raw" / ".r16" files are square, headerless, little-endian 16-bit.
+    bool load(const std::string& path);
+};
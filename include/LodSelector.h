@@ -0,0 +1,40 @@
+#pragma once
+#include <glm/glm.hpp>
+
+class Model;
+
+// Level of detail an instance is drawn at, kept from frame to frame
+struct LodState {
+    int level = -1;       // -1 until first selected
+    int fadingFrom = -1;  // the level faded out, -1 when not fading
+    float fade = 1.0f;    // how far the fade has come, 0 to 1
+};
+
+// Picks each instance's level of detail by how many pixels its simplification
+// error would cover on screen: the coarsest level within maxPixelError. A level
+// is only given up for a coarser one once that one is well within the limit
+// (hysteresis), so an instance at the threshold distance does not flicker between
+// the two, and switches cross-fade with a dither rather than pop.
+class LodSelector {
+public:
+    float maxPixelError = 1.0f;
+    // Share of maxPixelError a coarser level must be under before switching to it
+    float hysteresis = 0.5f;
+    // Length of a cross-fade; 0 switches at once
+    float fadeSeconds = 0.3f;
+
+    // Once per frame, before selecting
+    void setView(const glm::vec3& eye, float fovYRadians, float viewportHeight, float deltaTime);
+
+    // Updates state for a model drawn at scale around center (world space)
+    void select(const Model& model, const glm::vec3& center, float scale, LodState& state) const;
+
+    // Draws the selected level, and while fading the old one too, setting the
+    // shaders' lodFade uniform (the shader must be in use)
+    static void draw(Model& model, unsigned int shaderID, const LodState& state);
+
+private:
+    glm::vec3 eye = glm::vec3(0.0f);
+    float pixelsPerUnit = 1.0f; // at distance 1
+    float deltaTime = 0.0f;
+};
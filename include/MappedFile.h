@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory-mapped file. Pages are read in by the OS on first touch,
+// so only the parts actually used ever become resident.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    const unsigned char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+    // Hint that [offset, offset + length) is no longer needed, so its pages
+    // can leave the working set. The mapping stays valid.
+    void release(size_t offset, size_t length) const;
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
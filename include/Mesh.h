@@ -1,9 +1,13 @@
 #pragma once
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+class SharedTexture;
+
 // Vertex structure
 struct Vertex {
     glm::vec3 Position;
@@ -11,11 +15,47 @@ struct Vertex {
     glm::vec2 TexCoords;
 };
 
+// How a Mesh keeps its vertices on the GPU
+enum class VertexFormat {
+    Float,      // Vertex as it is, 32 bytes
+    Quantized   // QuantizedVertex, 16 bytes
+};
+
+// Vertex in 16 bytes, decoded by model_loading.vs and depth_shader.vs
+struct QuantizedVertex {
+    uint16_t Position[4];  // unorm16 over the mesh bounds, w unused
+    int16_t Normal[2];     // snorm16 octahedral
+    uint16_t TexCoords[2]; // half float
+};
+
+// A mesh's quantized vertices and what maps their positions back to object space
+struct QuantizedVertices {
+    std::vector<QuantizedVertex> vertices;
+    glm::vec3 positionOffset = glm::vec3(0.0f); // bounds min
+    glm::vec3 positionScale = glm::vec3(1.0f);  // bounds size
+};
+
+// One level of detail: a range of the mesh's indices over the same vertices
+struct MeshLod {
+    uint32_t firstIndex, indexCount;
+    float error; // object space distance from the full mesh at most, 0 for it
+};
+
 // Texture structure (not fully used yet, but useful for textured models)
 struct Texture {
     unsigned int id;
     std::string type;
     std::string path;
+    std::shared_ptr<SharedTexture> handle; // keeps the cached GL texture alive, see TextureCache
+};
+
+// A mesh's arrays before its buffers exist: an import, not yet uploaded
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<Texture> textures; // type and path only
+    QuantizedVertices quantized;   // drawn from these when not empty, see VertexQuantization
+    std::vector<MeshLod> lods;     // full detail first; none means all indices are one level
 };
 
 class Mesh {
@@ -24,17 +64,24 @@ public:
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    std::vector<MeshLod> lods;   // at least the full mesh
 
     // Render data
     unsigned int VAO, VBO, EBO;
+    VertexFormat format = VertexFormat::Float;
+    QuantizedVertices quantized;          // the offset and scale; the vertices only until uploaded
+    GLenum indexType = GL_UNSIGNED_INT;   // GL_UNSIGNED_SHORT when every index fits
 
-    // Constructor
+    // Constructor. With quantized vertices the buffer holds those instead
+    // of the float ones (which stay on the CPU side all the same).
     Mesh(std::vector<Vertex> vertices,
          std::vector<unsigned int> indices,
-         std::vector<Texture> textures);
+         std::vector<Texture> textures,
+         QuantizedVertices quantized = QuantizedVertices(),
+         std::vector<MeshLod> lods = std::vector<MeshLod>());
 
-    // Render the mesh
-    void Draw(unsigned int shaderID);
+    // Render the mesh, at a level of detail (the coarsest it has when past it)
+    void Draw(unsigned int shaderID, int lod = 0);
 
 private:
     // Initializes all the buffer objects/arrays
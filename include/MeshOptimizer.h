@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "Mesh.h"
+
+// How well an index order uses the post-transform vertex cache, measured on
+// a FIFO cache of MeshOptimizer::CACHE_SIZE entries
+struct MeshOptimizerStats {
+    float acmr = 0.0f; // vertex shader runs per triangle: 0.5 is ideal, 3 is no reuse at all
+    float atvr = 0.0f; // vertex shader runs per vertex: 1 is ideal
+};
+
+// Reorders an imported mesh for the GPU: each vertex shaded as few times as
+// possible, outer surfaces drawn before the ones they hide, and vertices
+// laid out in the order they are fetched. The rendered result is the same.
+// Runs once per import (the model cache keeps the result), so the models
+// drawn hundreds of times per frame pay nothing for it at load.
+class MeshOptimizer {
+public:
+    static const unsigned int CACHE_SIZE = 16;
+
+    // Every step below, in order; triangle lists only, anything else is left alone
+    static void optimize(MeshData& mesh, MeshOptimizerStats* before = nullptr, MeshOptimizerStats* after = nullptr);
+
+    // Merges bit-identical vertices and drops the triangles that collapse to a line
+    static void weld(MeshData& mesh);
+
+    // Tipsify (Sander, Nehab and Barczak 2007): fans around recently used
+    // vertices that are still in the cache, in linear time
+    static void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+    // Splits a cache ordered list into clusters and draws the ones facing
+    // out from the mesh first (view independent). threshold: how much worse
+    // the ACMR may get for smaller clusters, 1.05 is 5%
+    static void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+    // Renumbers the vertices in the order the indices first use them, dropping unused ones
+    static void optimizeVertexFetch(MeshData& mesh);
+
+    static MeshOptimizerStats analyze(const std::vector<unsigned int>& indices, size_t vertexCount);
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "Mesh.h"
+
+// Quadric error metric simplification (Garland and Heckbert 1997) of an
+// indexed triangle mesh. Every collapse merges a vertex into a neighbour
+// rather than moving it, so a simplified mesh indexes the same vertex array
+// and its levels of detail can share one vertex buffer. Open borders (leaf
+// cards) and texture seams only collapse along themselves, so they keep
+// their outline, and collapses that would flip a triangle are skipped.
+// GL-free, like TerrainSimplifier.
+class MeshSimplifier {
+public:
+    // Indices of a coarser mesh with at most targetIndexCount indices, or as
+    // close as it gets before the error would pass targetError. Errors are
+    // fractions of the mesh's size (its bounds' largest side); returns the one reached.
+    static float simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                          size_t targetIndexCount, float targetError, std::vector<unsigned int>& result);
+};
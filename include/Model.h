@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 #include "Mesh.h"
@@ -6,27 +7,83 @@
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 
+class AssetLoader;
+struct TextureImage;
+
 class Model {
 public:
-    // Store all meshes
+    // One mesh per material, see mergeByMaterial
     std::vector<Mesh> meshes;
 
-    // Constructor
-    Model(const std::string &path);
+    // Object-space bounds of every vertex
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    // Constructor. Imports through Assimp once, then loads from a binary
+    // cache next to the model (ModelCache) while the source is unchanged.
+    // Quantized meshes take half the vertex memory; a mesh whose texture
+    // coordinates would lose too much stays Float (see VertexQuantization).
+    // Meshes are quantized at import and the cache keeps the result.
+    Model(const std::string &path, VertexFormat format = VertexFormat::Quantized);
+
+    // Imports and decodes the textures on a loader worker; the meshes exist
+    // once loader.finish() returns, and the Model must stay put until then
+    Model(const std::string &path, AssetLoader& loader, VertexFormat format = VertexFormat::Quantized);
+
+    // Draw all meshes, at a level of detail (0 is the full model, see LodSelector)
+    void Draw(unsigned int shaderID, int lod = 0);
 
-    // Draw all meshes
-    void Draw(unsigned int shaderID);
+    // Levels of detail every mesh got at import (a mesh with fewer draws its coarsest
+    // past them), and the most any mesh's level is off from the full one, in object space
+    int getLodCount() const;
+    float getLodError(int lod) const;
+
+    // Offline (assetcook): bring the model's cache up to date, importing it
+    // (rebuilt) if needed, and list the texture files it uses and the files
+    // it was built from. No GL calls.
+    static bool cook(const std::string &path, std::vector<std::string> &texturePaths,
+                     std::vector<std::string> &sourcePaths, bool &rebuilt);
 
 private:
+    Model() = default;
+
     // Directory for locating textures
     std::string directory;
 
-    // Loads a model with Assimp and stores the resulting meshes
+    VertexFormat format = VertexFormat::Float;
+
+    // Imported meshes and their decoded textures (in mesh, then texture order), until uploaded
+    std::vector<MeshData> imported;
+    std::vector<std::shared_ptr<const TextureImage>> images;
+
+    // Files the cache or import was built from
+    std::vector<std::string> sources;
+
+    // Mesh data from the cache or Assimp, and decoded textures; no GL calls, any thread
     void loadModel(const std::string &path);
 
+    // Loads a model with Assimp and stores the resulting mesh data
+    void importModel(const std::string &path);
+
+    // Mesh data straight from a valid cache, false if there is none
+    bool loadCache(const std::string &path);
+
+    // At import: quantized vertices for every mesh that keeps enough precision, and how much it lost
+    void quantizeMeshes(const std::string &path);
+
+    // Main thread: buffers and textures for the imported meshes
+    void upload();
+
+    // One mesh per material: submeshes that share their textures become one
+    // vertex / index range, drawn with a single call
+    static void mergeByMaterial(std::vector<MeshData>& meshes);
+
+    // Simplified copies of the mesh's triangles appended to its indices, see IMPORT_SETTINGS in Model.cpp
+    static void buildLods(MeshData& mesh);
+
     // Process Assimp nodes and meshes
     void processNode(aiNode* node, const aiScene* scene);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene);
+    MeshData processMesh(aiMesh* mesh, const aiScene* scene);
 
     // Load textures from material
     std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName);
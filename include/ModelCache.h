@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+#include "VirtualFileSystem.h"
+
+// A file the import read (the model itself, its .mtl, ...) and what it held then
+struct ModelCacheDependency {
+    uint32_t pathOffset, pathLength; // into the string section
+    uint64_t size;
+    uint64_t hash;                   // FNV-1a of the file's bytes
+};
+
+// One mesh: ranges into the vertex / index / texture / level of detail sections
+struct ModelCacheMesh {
+    uint32_t firstVertex, vertexCount;
+    uint32_t firstQuantized, quantizedCount; // vertexCount of them, or none when the mesh stays Float
+    glm::vec3 positionOffset, positionScale; // of the quantized vertices, see QuantizedVertices
+    uint32_t firstIndex, indexCount;    // every level's indices, back to back
+    uint32_t firstTexture, textureCount;
+    uint32_t firstLod, lodCount;        // MeshLod ranges are relative to firstIndex
+};
+
+// A material texture reference, loaded from the model's directory like an imported one
+struct ModelCacheTexture {
+    uint32_t typeOffset, typeLength; // "texture_diffuse", ...
+    uint32_t pathOffset, pathLength;
+};
+
+// What an import is built with; a cache built with other settings is stale
+struct ModelImportSettings {
+    uint32_t importFlags;   // aiPostProcessSteps
+    float lodErrors[3];     // largest error of each simplified level, a fraction of the mesh size; 0 ends the chain
+    float lodReduction;     // share of the previous level's triangles each level aims for
+};
+
+// On-disk model cache (".mdc", next to the source asset): header, then each
+// section below at a 16-byte aligned offset
+struct ModelCacheHeader {
+    char magic[4];          // "MDC1"
+    uint32_t version;
+    ModelImportSettings settings; // the arrays were imported with
+    uint32_t vertexStride;  // sizeof(Vertex)
+    uint32_t quantizedStride; // sizeof(QuantizedVertex)
+    glm::vec3 boundsMin, boundsMax;
+    uint64_t dependencyOffset, dependencyCount;
+    uint64_t meshOffset, meshCount;
+    uint64_t textureOffset, textureCount;
+    uint64_t stringOffset, stringCount;     // bytes, not terminated
+    uint64_t vertexOffset, vertexCount;
+    uint64_t quantizedOffset, quantizedCount;
+    uint64_t indexOffset, indexCount;       // uint32, relative to the mesh's first vertex
+    uint64_t lodOffset, lodCount;
+};
+
+// Pointers to every section, into the mapping when read
+struct ModelCacheContents {
+    const ModelCacheDependency* dependencies = nullptr; size_t dependencyCount = 0;
+    const ModelCacheMesh* meshes = nullptr;             size_t meshCount = 0;
+    const ModelCacheTexture* textures = nullptr;        size_t textureCount = 0;
+    const char* strings = nullptr;                      size_t stringCount = 0;
+    const Vertex* vertices = nullptr;                   size_t vertexCount = 0;
+    const QuantizedVertex* quantized = nullptr;         size_t quantizedCount = 0;
+    const unsigned int* indices = nullptr;              size_t indexCount = 0;
+    const MeshLod* lods = nullptr;                      size_t lodCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+};
+
+// The final vertex / index arrays (the float vertices and, where a mesh
+// quantizes, the quantized ones), texture references and bounds of an
+// imported model, saved after the first import so later launches map them
+// and upload them as they are instead of running the Assimp importer.
+// A cache is stale, and gets rebuilt, when the import settings differ or any
+// file the import read has changed size or contents.
+class ModelCache {
+public:
+    static const uint32_t VERSION = 5;
+
+    static std::string pathFor(const std::string& modelPath) { return modelPath + ".mdc"; }
+
+    // dependencies: paths of the files the import read
+    static bool write(const std::string& path, const ModelImportSettings& settings, const std::vector<std::string>& dependencies,
+                      const std::vector<MeshData>& meshes, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+    // False when the cache is missing, damaged, stale or built with other settings
+    bool open(const std::string& path, const ModelImportSettings& settings);
+    void close() { file.close(); }
+
+    const ModelCacheContents& getContents() const { return contents; }
+    std::string getString(uint32_t offset, uint32_t length) const {
+        return std::string(contents.strings + offset, length);
+    }
+
+private:
+    VirtualFile file;
+    ModelCacheHeader header = {};
+    ModelCacheContents contents;
+
+    bool dependenciesUnchanged() const;
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <cmath>
+#include <glm/glm.hpp>
+
+// Vertex attribute packing helpers
+
+// float in [-1, 1] -> GL_SHORT, read back with normalized = GL_TRUE
+inline short packSnorm16(float v) {
+    return (short)std::lround(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+// float in [0, 1] -> GL_UNSIGNED_SHORT, read back with normalized = GL_TRUE
+inline unsigned short packUnorm16(float v) {
+    return (unsigned short)std::lround(glm::clamp(v, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Unit vector -> octahedral [-1, 1]^2 (decoded by octDecode() in the shaders)
+inline glm::vec2 octEncode(glm::vec3 n) {
+    n /= (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        glm::vec2 signs(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * signs;
+    }
+    return e;
+}
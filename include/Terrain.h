@@ -0,0 +1,253 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Shader.h"
+#include "Frustum.h"
+
+struct TerrainGrid;
+class TerrainTileFile;
+class TerrainStreamer;
+class TerrainQuery;
+class TerrainCache;
+struct TerrainCacheKey;
+
+// How terrain geometry reaches the GPU
+enum class TerrainMode {
+    BakedGrid,       // full-resolution vertex grid built on the CPU
+    GpuDisplacement, // heightmap texture + one shared patch, displaced in the vertex shader
+    Streamed,        // like GpuDisplacement, but tiles of a .ttp pyramid are paged in around the camera
+    Simplified       // baked grid vertices, one RTIN mesh within a max vertical error, no LOD
+};
+
+// Quantized terrain vertex (one per grid point, shared by every LOD level).
+// Grid X/Z come from gl_VertexID and UVs from the grid position, see shaders/terrain.vs.
+// Normals are not per vertex, shaders/terrain.fs reads them from the normal map.
+struct TerrainVertex {
+    unsigned short Height;      // unorm16 over the terrain's height range
+    unsigned short MorphHeight; // height of the coarser-grid vertex it snaps onto when odd
+};
+
+// Where baked vertices live in the vertex buffer. The grid is cut into square
+// blocks of blockVerts x blockVerts vertices, every stride-th grid vertex,
+// with the shared edges duplicated, so any patch lies inside one block and
+// its indices fit in 16 bits. shaders/terrain.vs turns gl_VertexID back
+// into a grid position with the same numbers.
+struct TerrainVertexLayout {
+    unsigned int firstVertex; // of block 0 in the vertex buffer
+    int blockVerts;           // vertices per block edge
+    int blocksPerEdge;
+    int stride;               // grid steps between neighbouring vertices of a block
+
+    int blockSpan() const { return (blockVerts - 1) * stride; }
+    size_t vertexCount() const { return (size_t)blocksPerEdge * blocksPerEdge * blockVerts * blockVerts; }
+
+    // Grid vertex (x, z), in the block whose square contains it (the lower one on shared edges)
+    unsigned int vertexAt(int x, int z) const {
+        int span = blockSpan();
+        int bx = x / span < blocksPerEdge ? x / span : blocksPerEdge - 1;
+        int bz = z / span < blocksPerEdge ? z / span : blocksPerEdge - 1;
+        return firstVertex + (unsigned int)((bz * blocksPerEdge + bx) * blockVerts * blockVerts +
+                                            (z - bz * span) / stride * blockVerts + (x - bx * span) / stride);
+    }
+};
+
+// How a sculpting brush changes the heights under it
+enum class TerrainBrushMode {
+    Raise,
+    Lower,
+    Flatten // towards targetHeight
+};
+
+struct TerrainBrush {
+    TerrainBrushMode mode = TerrainBrushMode::Raise;
+    glm::vec2 center = glm::vec2(0.0f); // world XZ
+    float radius = 10.0f;               // world units, the effect fades out smoothly towards it
+    float strength = 5.0f;              // world units per second at the center
+    float targetHeight = 0.0f;          // Flatten: world Y
+};
+
+// A quadtree node (or a quarter of one) picked for drawing
+struct TerrainSelection {
+    int x, z;   // first grid vertex of the patch
+    int level;  // LOD level, grid stride is (1 << level)
+    bool half;  // only one quarter of the node, drawn with the half-size patch
+    int slot = -1; // Streamed: texture array layer of the tile it is displaced from
+};
+
+// Simplified mode: the triangles whose centroid falls in one square of the
+// grid, drawn or culled together
+struct TerrainChunk {
+    unsigned int firstIndex, indexCount;
+    glm::vec3 minP, maxP; // bounds of the chunk's triangles
+};
+
+// Per-instance data of the shared half-size patch
+struct TerrainInstance {
+    glm::vec4 patch; // first grid vertex (x, z), grid stride, LOD level
+    glm::vec4 tile;  // Streamed: texture array layer, tile origin (x, z) in grid units
+};
+
+// Chunked quadtree LOD terrain (CDLOD).
+// Every frame a quadtree picks patches of PATCH_SIZE x PATCH_SIZE quads whose
+// grid stride grows with camera distance, and the vertex shader morphs odd
+// vertices onto the next coarser grid so neighbouring levels meet without cracks.
+// In BakedGrid mode the heightmap is baked once into a full-resolution grid of
+// 4-byte quantized vertices (shaders/terrain.vs), laid out in blocks (TerrainVertexLayout)
+// so every patch is drawn from 16-bit triangle strips. In GpuDisplacement mode it is only uploaded as a
+// texture and a single half-size patch is instanced over the selection
+// (shaders/terrain_gpu.vs). Streamed mode instances the same patch, but reads
+// heights from a TerrainTileFile paged in by a TerrainStreamer
+// (shaders/terrain_stream.vs); nodes whose tiles are not resident yet are
+// drawn by their parent. Simplified mode keeps the baked vertices but draws
+// a single TerrainSimplifier mesh instead of quadtree patches.
+// Every mode shades with shaders/terrain.fs, which takes normals per pixel from
+// a normal map baked from the full-resolution heightmap (streamed: per tile),
+// so lighting does not change with mesh density or LOD level.
+// BakedGrid and GpuDisplacement terrain can be sculpted at runtime: an edit
+// only rewrites the heightmap texels under the brush and re-uploads the
+// vertices, normal map texels and height texels around them.
+// Except in Streamed mode, a cache path can be given: the first run saves the
+// generated buffers there (TerrainCache) and later runs with the same
+// heightmap and parameters upload them straight from the mapped file.
+class Terrain {
+public:
+    // Quads along one edge of a patch, at every LOD level
+    static const int PATCH_SIZE = 32;
+
+    // Texture unit the heightmap is bound to in GpuDisplacement mode
+    static const int HEIGHTMAP_TEXTURE_UNIT = 3;
+
+    // Texture unit of the normal map (a 2D array: one layer, or the streamed tiles)
+    static const int NORMAL_MAP_TEXTURE_UNIT = 4;
+
+    // Texture array layers (and so tiles) kept resident in Streamed mode
+    static const int STREAM_TILE_SLOTS = 96;
+
+    // Grid quads along a vertex block edge (BakedGrid levels whose patches fit,
+    // and Simplified mode's culling chunks), see TerrainVertexLayout
+    static const int VERTEX_BLOCK_SIZE = 128;
+
+    // Simplified mode: max vertical error (world units)
+    static constexpr float DEFAULT_MAX_ERROR = 1.0f;
+
+    // heightmapPath is an image or .raw/.r16 file, or a .ttp tile file in Streamed mode.
+    // An empty cachePath disables the mesh cache.
+    Terrain(const std::string& heightmapPath, float scaleXZ, float heightScale,
+            TerrainMode mode = TerrainMode::BakedGrid, float maxError = DEFAULT_MAX_ERROR,
+            const std::string& cachePath = "");
+    ~Terrain();
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    bool isLoaded() const { return loaded; }
+    TerrainMode getMode() const { return mode; }
+
+    // Vertex shader matching the mode
+    const char* vertexShaderPath() const;
+
+    // Select the patches to draw for this camera and view frustum
+    void update(const glm::vec3& cameraPos, const glm::mat4& viewProjection);
+
+    // Draw the patches from the last update()
+    void Draw(const Shader& shader);
+
+    // CPU height / normal lookups, valid once loaded
+    const TerrainQuery& query() const { return *heightQuery; }
+
+    // (min, max) world height of the ground over a world XZ rectangle, from the finest
+    // quadtree nodes it overlaps (so a little wider than the rectangle itself)
+    glm::vec2 heightRange(const glm::vec2& minXZ, const glm::vec2& maxXZ) const;
+
+    // Streamed tiles are read only, and a Simplified mesh would have to be rebuilt whole
+    bool isEditable() const { return loaded && (mode == TerrainMode::BakedGrid || mode == TerrainMode::GpuDisplacement); }
+
+    // Apply a brush for deltaTime seconds. On success, changed holds the grid
+    // vertices whose heights changed, (x0, z0, x1, z1) inclusive, for
+    // TerrainRaycast::update(); false if nothing under the brush changed.
+    bool sculpt(const TerrainBrush& brush, float deltaTime, glm::ivec4& changed);
+
+    unsigned int getTriangleCount() const { return triangleCount; }
+    size_t getPatchCount() const { return selection.size(); }
+
+private:
+    bool loaded = false;
+    TerrainMode mode;
+
+    // Heightmap
+    int imgWidth = 0, imgHeight = 0;
+    std::vector<float> heights; // world-space Y per heightmap texel, empty after a cache load
+    std::vector<unsigned short> samples; // raw heightmap, only kept once sculpting starts
+    std::vector<std::vector<unsigned short>> normalLevels; // normal map per mip level, likewise
+    std::unique_ptr<TerrainQuery> heightQuery;
+    float scaleXZ;
+    float heightScale;          // world height = sample / 65535 * heightScale + heightOffset
+    float heightOffset;
+
+    // Grid and quadtree
+    int gridSize = 0;    // quads per grid edge (power of two), vertices = gridSize + 1
+    int levelCount = 0;  // LOD levels, 0 = full resolution
+    glm::vec2 origin;    // world XZ of grid vertex (0, 0)
+    std::vector<float> lodRanges;                   // per level, furthest distance it is used at
+    std::vector<std::vector<glm::vec2>> nodeHeights; // per level, per node (min, max) height
+
+    // GPU data
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    std::vector<TerrainVertexLayout> vertexLayouts; // BakedGrid / Simplified: per level
+    std::vector<unsigned int> patchIndexOffset; // BakedGrid: per level, into EBO (full patch strips, then half patch)
+    unsigned int instanceVBO = 0;               // GpuDisplacement / Streamed: one TerrainInstance per half patch
+    unsigned int heightTexture = 0;
+    unsigned int normalTexture = 0;             // all but Streamed: RG16F slopes, see TerrainBuilder::buildNormalMap
+    std::vector<TerrainInstance> instances;
+
+    // Simplified
+    float maxError;
+    int chunksPerEdge = 0;
+    std::vector<TerrainChunk> chunks;
+
+    // Streamed
+    std::unique_ptr<TerrainTileFile> tileFile;
+    std::unique_ptr<TerrainStreamer> streamer;
+
+    // Per-frame selection
+    std::vector<TerrainSelection> selection;
+    glm::vec3 cameraPos = glm::vec3(0.0f);
+    Frustum frustum;
+    unsigned int triangleCount = 0;
+
+    float sampleHeight(int x, int z) const;
+    TerrainGrid grid() const;
+
+    void buildLevels();
+    void buildQuadtree();
+    void updateNode(int level, int nx, int nz);
+    bool openTiles(const std::string& path);
+    void buildMesh(std::vector<TerrainVertex>& vertices, std::vector<unsigned short>& indices);
+    void buildSimplifiedIndices(std::vector<unsigned short>& indices);
+    void uploadMesh(const TerrainVertex* vertices, size_t vertexCount, const unsigned short* indices, size_t indexCount);
+    void buildPatchMesh();
+    void uploadHeightTexture(const unsigned short* samples);
+    void uploadNormalMap(const unsigned short* slopes);
+
+    void loadCache(const TerrainCache& cache);
+    void writeCache(const std::string& path, const TerrainCacheKey& key, const unsigned short* samples,
+                    const std::vector<unsigned short>& slopes, const std::vector<TerrainVertex>& vertices,
+                    const std::vector<unsigned short>& indices) const;
+
+    glm::vec2 morphRange(int level) const;
+    void setVertexLayout(const Shader& shader, int level) const;
+    void drawBaked(const Shader& shader);
+    void drawSimplified(const Shader& shader);
+    void drawInstanced(const Shader& shader);
+
+    void beginEditing();
+    void updateNodes(int x0, int z0, int x1, int z1);
+    void updateVertices(int x0, int z0, int x1, int z1);
+
+    void nodeBounds(int level, int x, int z, glm::vec3& minP, glm::vec3& maxP) const;
+    bool selectNode(int level, int x, int z);
+    int chunkIndex(const TerrainSelection& sel) const;
+};
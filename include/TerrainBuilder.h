@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Terrain.h"
+
+// Heightmap plus the world-space grid laid over it
+struct TerrainGrid {
+    const float* heights; // world-space heights, row-major, width * height
+    int width, height;    // heightmap size in texels
+    int gridVerts;        // vertices per grid edge, samples past the heightmap are clamped
+    glm::vec2 origin;     // world XZ of grid vertex (0, 0)
+    float spacing;        // world units between grid vertices
+    float heightScale;    // quantized height = (height - heightOffset) / heightScale
+    float heightOffset;
+};
+
+// Simulated post-transform vertex cache over an index list
+struct TerrainVertexCacheStats {
+    size_t triangles = 0;  // non-degenerate triangles drawn
+    size_t references = 0; // vertex references, restart indices excluded
+    size_t misses = 0;     // vertex shader invocations
+
+    float acmr() const { return triangles ? (float)misses / triangles : 0.0f; } // average cache miss ratio
+    float hitRate() const { return references ? 1.0f - (float)misses / references : 0.0f; }
+};
+
+// CPU terrain generation. Every function writes into storage the caller has
+// already sized, work is split by rows across all cores and the inner loops
+// use SSE2 where the compiler targets it.
+class TerrainBuilder {
+public:
+    // Ends a triangle strip (glPrimitiveRestartIndex) in 16-bit index lists
+    static const unsigned short RESTART_INDEX = 0xFFFF;
+
+    // Patch strips run across bands of this many quads, so the previous row
+    // of a band is still in the post-transform cache when the next one reuses it
+    static const int STRIP_BAND = 8;
+
+    // Run job(rowBegin, rowEnd) over [0, rows) in one band per hardware thread
+    static void parallelRows(int rows, const std::function<void(int, int)>& job);
+
+    // dst[i] = src[i] * scale + offset
+    static void scaleHeights(const unsigned short* src, size_t count, float scale, float offset, float* dst);
+
+    // Terrain normal map, one texel per heightmap sample. Each texel is the central-difference
+    // slope (d sample / dx, d sample / dz) in raw sample units per grid step, as a pair of
+    // half floats (GL_RG16F), so it holds for any heightScale / spacing: width * height * 2 entries
+    static void buildNormalMap(const unsigned short* samples, int width, int height, unsigned short* out);
+
+    // The same for texels [x0, x1) x [z0, z1) only, (x1 - x0) * (z1 - z0) * 2 entries
+    static void buildNormalRect(const unsigned short* samples, int width, int height,
+                                int x0, int z0, int x1, int z1, unsigned short* out);
+
+    // Next mip level of a normal map: each texel the box-filtered average of its 2x2 source
+    // texels (clamped at odd edges). out is max(1, width / 2) x max(1, height / 2) texels
+    static void downsampleNormals(const unsigned short* src, int width, int height, unsigned short* out);
+
+    // The same for next-level texels [x0, x1) x [z0, z1) only, written in place into the full out
+    static void downsampleNormalRect(const unsigned short* src, int width, int height,
+                                     int x0, int z0, int x1, int z1, unsigned short* out);
+
+    // Vertex buffer layout per LOD level: levels whose patches fit in a blockSize block share
+    // one block layout of the full grid, coarser levels get one patch-sized block per node
+    static std::vector<TerrainVertexLayout> vertexLayouts(int gridSize, int levelCount, int patchSize, int blockSize);
+
+    // Quantized vertices with CDLOD morph heights for every distinct layout,
+    // each layout's vertexCount() entries at its firstVertex
+    static void buildVertices(const TerrainGrid& grid, int levelCount,
+                              const std::vector<TerrainVertexLayout>& layouts, TerrainVertex* out);
+
+    // Vertices [first, last) of one row of one block, for edits: last - first entries
+    static void buildBlockRow(const TerrainGrid& grid, int levelCount, const TerrainVertexLayout& layout,
+                              int block, int row, int first, int last, TerrainVertex* out);
+
+    // patch x patch quads as triangle strips split by RESTART_INDEX, relative to the
+    // patch's first vertex in a block of rowPitch vertices per row: patchStripLength(patch) entries
+    static size_t patchStripLength(int patch);
+    static void buildPatchStrip(int rowPitch, int stride, int patch, unsigned short* out);
+
+    // The same quads as an independent triangle list, row by row, to compare against
+    // the strips: patch * patch * 6 entries
+    static void buildPatchList(int rowPitch, int stride, int patch, unsigned short* out);
+
+    // Post-transform cache behaviour of 16-bit strips (split by RESTART_INDEX) or lists, and of 32-bit lists
+    static TerrainVertexCacheStats measureVertexCache(const unsigned short* indices, size_t count, bool strip,
+                                                      int cacheSize = 32);
+    static TerrainVertexCacheStats measureVertexCache(const unsigned int* indices, size_t count, int cacheSize = 32);
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <glm/glm.hpp>
+#include "VirtualFileSystem.h"
+#include "Terrain.h"
+
+// What a terrain cache was built from. A cache whose key differs in any
+// field is stale and gets rebuilt.
+struct TerrainCacheKey {
+    uint64_t sourceHash; // FNV-1a of the heightmap file's bytes
+    uint32_t mode;       // TerrainMode
+    uint32_t patchSize;
+    float scaleXZ, heightScale;
+    float maxError;      // Simplified only, 0 otherwise
+    uint32_t reserved;
+};
+
+// On-disk terrain mesh cache (".tmc"): header, then each section below at a
+// 16-byte aligned offset. Sections a mode does not use are empty.
+struct TerrainCacheHeader {
+    char magic[4];          // "TMC1"
+    uint32_t version;
+    TerrainCacheKey key;
+    uint32_t width, height; // source heightmap size in samples
+    uint32_t gridSize, levelCount;
+    uint64_t sampleOffset, sampleCount; // raw uint16 heightmap samples
+    uint64_t nodeOffset, nodeCount;     // (min, max) world height per quadtree node, level 0 first
+    uint64_t normalOffset, normalCount; // normal map texels, two half-float slopes each
+    uint64_t vertexOffset, vertexCount; // TerrainVertex blocks, see TerrainVertexLayout
+    uint64_t indexOffset, indexCount;   // uint16 indices
+    uint64_t patchOffset, patchCount;   // BakedGrid: per-level offset into the indices
+    uint64_t chunkOffset, chunkCount;   // Simplified: TerrainChunk
+};
+
+// Pointers to every section, into the mapping when read
+struct TerrainCacheContents {
+    const uint16_t* samples = nullptr;       size_t sampleCount = 0;
+    const glm::vec2* nodeHeights = nullptr;  size_t nodeCount = 0;
+    const uint16_t* normals = nullptr;       size_t normalCount = 0;
+    const TerrainVertex* vertices = nullptr; size_t vertexCount = 0;
+    const unsigned short* indices = nullptr; size_t indexCount = 0;
+    const unsigned int* patchOffsets = nullptr; size_t patchCount = 0;
+    const TerrainChunk* chunks = nullptr;    size_t chunkCount = 0;
+};
+
+// GPU-ready terrain buffers saved after a cold start, so the next launch
+// with the same heightmap and parameters maps them and uploads them as they
+// are instead of decoding the heightmap and generating the mesh again.
+class TerrainCache {
+public:
+    static const uint32_t VERSION = 3;
+
+    static bool write(const std::string& path, const TerrainCacheKey& key, int width, int height,
+                      int gridSize, int levelCount, const TerrainCacheContents& contents);
+
+    // False when the cache is missing, damaged or built for another key
+    bool open(const std::string& path, const TerrainCacheKey& key);
+    void close() { file.close(); }
+
+    const TerrainCacheHeader& getHeader() const { return header; }
+    const TerrainCacheContents& getContents() const { return contents; }
+
+private:
+    VirtualFile file;
+    TerrainCacheHeader header = {};
+    TerrainCacheContents contents;
+};
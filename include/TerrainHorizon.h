@@ -0,0 +1,44 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Shader.h"
+
+class TerrainQuery;
+
+// Terrain self-shadowing without a shadow map.
+// For AZIMUTHS compass directions, each texel stores the elevation of the
+// horizon seen from the terrain surface there (as its sine), found by
+// marching the heightfield outwards at load. shaders/terrain.fs interpolates
+// the horizon between the two azimuths around the sun and shades the pixel
+// when the sun is below it, so the terrain never has to be drawn into the
+// shadow map. Stored as a 2D array texture, four azimuths per RGBA8 layer.
+class TerrainHorizon {
+public:
+    static const int AZIMUTHS = 8;
+    static const int MAP_SIZE = 512;        // texels along one edge, over the whole terrain
+    static const int HORIZON_TEXTURE_UNIT = 7;
+
+    // maxDistance: how far (world units) a ridge can cast a shadow from
+    TerrainHorizon(const TerrainQuery& query, float maxDistance = 1000.0f);
+    ~TerrainHorizon();
+
+    TerrainHorizon(const TerrainHorizon&) = delete;
+    TerrainHorizon& operator=(const TerrainHorizon&) = delete;
+
+    // After the ground over a world XZ rectangle changed: marches again every texel and
+    // azimuth whose ray (up to maxDistance) crosses it, and uploads what changed
+    void update(const TerrainQuery& query, const glm::vec2& minXZ, const glm::vec2& maxXZ);
+
+    // Horizon texture and its placement, for a shader that is in use
+    void bind(const Shader& shader) const;
+
+private:
+    unsigned int texture = 0;
+    glm::vec2 origin;
+    float worldSize = 0.0f;
+    float maxDistance = 0.0f;
+    std::vector<unsigned char> texels; // CPU copy, layer-major, four azimuths per texel in each layer
+
+    glm::vec2 texelCenter(int x, int z) const;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class TerrainTileFile;
+
+// CPU height and normal lookups on the terrain surface, for placing objects
+// and grounding the camera. Samples are kept in square blocks (with a
+// one-sample apron) so a lookup touches one or two cache lines. The blocks
+// are either built from an in-memory heightmap or are the finest level of a
+// mapped TerrainTileFile, which already has that layout.
+// Heights are bilinear between grid vertices, normals match the terrain shaders.
+class TerrainQuery {
+public:
+    // Quads per block edge when re-blocking an in-memory heightmap
+    static const int BLOCK_SIZE = 64;
+
+    // samples: width * height raw 16-bit heights, gridSize: quads per grid edge
+    TerrainQuery(const uint16_t* samples, int width, int height, int gridSize);
+
+    // Level 0 of the tile file, read through its mapping
+    explicit TerrainQuery(const TerrainTileFile& tiles);
+
+    // World placement: world XZ of grid vertex (0, 0), world units between
+    // vertices, and world height = sample / 65535 * heightScale + heightOffset
+    void setTransform(const glm::vec2& origin, float spacing, float heightScale, float heightOffset);
+
+    // Re-read heightmap samples [x0, x1] x [z0, z1] after an edit, from the same
+    // width * height layout the query was built from. False for tile file queries,
+    // which are read only.
+    bool updateSamples(const uint16_t* samples, int width, int height, int x0, int z0, int x1, int z1);
+
+    float heightAt(float x, float z) const;
+    glm::vec3 normalAt(float x, float z) const;
+
+    // Batched versions, four points at a time with SSE2
+    void heightsAt(const glm::vec2* xz, float* heights, size_t count) const;
+    void normalsAt(const glm::vec2* xz, glm::vec3* normals, size_t count) const;
+
+    // Grid access for algorithms built on top of the query
+    int getGridSize() const { return blocksPerEdge * blockSize; }
+    const glm::vec2& getOrigin() const { return origin; }
+    float getSpacing() const { return spacing; }
+    uint16_t sampleAt(int gx, int gz) const; // raw sample at a grid vertex, clamped to the grid
+    float toHeight(float sample) const { return sample * sampleScale + heightOffset; }
+
+    // Coarse bounds for skipping empty space (TerrainRaycast): the max sample of
+    // every node of getNodeSize() << level quads, up to one node over the grid.
+    // Tile file queries read the file's node bounds, so nothing is scanned;
+    // in-memory ones keep their own per block, updated with the samples.
+    int getNodeSize() const { return nodeSize; }
+    int getNodeLevels() const { return nodeLevels; }
+    uint16_t nodeMax(int level, int nx, int nz) const;
+
+private:
+    const TerrainTileFile* tileFile = nullptr;
+    std::vector<uint16_t> ownBlocks;
+    const uint16_t* blocks = nullptr;
+    int blockSize = 0;     // quads per block edge, a power of two
+    int blockShift = 0;    // log2(blockSize)
+    int blockSamples = 0;  // samples per block edge, blockSize + 3
+    int blocksPerEdge = 0;
+    size_t blockStride = 0; // samples per block
+
+    glm::vec2 origin = glm::vec2(0.0f);
+    float spacing = 1.0f;
+    float sampleScale = 1.0f; // heightScale / 65535
+    float heightOffset = 0.0f;
+
+    int nodeSize = 0;
+    int nodeLevels = 0;
+    std::vector<std::vector<uint16_t>> ownNodeMax; // in-memory: per level, per node
+
+    void updateNodeMax(int bx0, int bz0, int bx1, int bz1);
+    void heights4(const float* x, const float* z, float* out) const;
+};
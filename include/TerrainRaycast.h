@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+class TerrainQuery;
+
+struct TerrainHit {
+    bool hit = false;
+    float t = 0.0f;         // along the ray, in units of its direction
+    glm::vec3 position = glm::vec3(0.0f);
+};
+
+// Ray vs terrain intersection for picking, line of sight and projectiles.
+// A max-height mip pyramid over the grid lets the march step over whole
+// cells the ray passes above, descending only where it might hit; at the
+// finest level each cell's two triangles are tested, split the same way the
+// terrain patches are. Levels of a quadtree node or more are the query's node
+// bounds (for streamed terrain, straight from the tile file); the levels
+// inside a node are built the first time a ray goes down into it and a
+// bounded number of nodes is kept, so memory does not grow with the world.
+// Level 0 is read from the TerrainQuery.
+class TerrainRaycast {
+public:
+    // Nodes whose fine levels are kept
+    static const int MAX_CACHED_NODES = 4096;
+
+    explicit TerrainRaycast(const TerrainQuery& query);
+
+    // Grid vertices [x0, x1] x [z0, z1] changed height (the query is already updated):
+    // drop the fine levels built over them
+    void update(int x0, int z0, int x1, int z1);
+
+    // First hit within [0, maxT]; dir does not need to be normalized
+    bool intersect(const glm::vec3& origin, const glm::vec3& dir, float maxT, TerrainHit& hit) const;
+
+    // Many rays, split across all cores
+    void intersectBatch(const glm::vec3* origins, const glm::vec3* dirs, float maxT,
+                        TerrainHit* hits, size_t count) const;
+
+    // Same result visiting every grid cell along the ray (3D DDA), for validation
+    bool intersectBruteForce(const glm::vec3& origin, const glm::vec3& dir, float maxT, TerrainHit& hit) const;
+
+#ifdef TERRAIN_RAY_BENCHMARK
+    // Time random rays against the pyramid and the DDA, and print both
+    void benchmark(size_t rayCount) const;
+#endif
+
+private:
+    // Levels 1 to nodeShift - 1 of one node, finest first, max sample per cell
+    using NodeCells = std::vector<uint16_t>;
+
+    // The node a march is in, so its cells are looked up once
+    struct NodeCursor {
+        std::shared_ptr<const NodeCells> cells;
+        int nx = -1, nz = -1;
+    };
+
+    const TerrainQuery& query;
+    int gridSize = 0;
+    int levelCount = 0;          // pyramid levels, cell size 1 << level
+    int nodeShift = 0;           // log2 of the query's node size: the first level read from its node bounds
+    std::vector<size_t> fineOffset; // per level below nodeShift, where its cells start in NodeCells
+    size_t fineCellCount = 0;
+
+    mutable std::shared_timed_mutex cacheMutex; // rays share it, building a node takes it alone (C++14, unlike shared_mutex)
+    mutable std::unordered_map<uint64_t, std::shared_ptr<const NodeCells>> cachedNodes;
+    mutable std::deque<uint64_t> cacheOrder; // oldest first
+
+    std::shared_ptr<const NodeCells> nodeCells(int nx, int nz) const;
+    float cellMax(int level, int cx, int cz, NodeCursor& cursor) const;
+    bool march(const glm::vec3& origin, const glm::vec3& dir, float maxT, int topLevel, TerrainHit& hit) const;
+    bool intersectCell(int cx, int cz, const glm::vec3& o, const glm::vec3& d,
+                       float tMin, float tMax, float yMin, float& t) const;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "TerrainBuilder.h"
+
+// How closely a simplified mesh follows the heightmap
+struct TerrainSimplifyStats {
+    size_t triangles = 0;     // in the simplified mesh
+    size_t fullTriangles = 0; // in the full-resolution grid
+    size_t vertices = 0;      // grid vertices the mesh uses
+    float maxError = 0.0f;    // vertical distance between grid samples and the mesh
+    float meanError = 0.0f;
+    float rmsError = 0.0f;
+};
+
+// Right-triangulated irregular network (RTIN) simplification of a terrain grid.
+// The grid is split into a binary tree of right triangles; every triangle
+// keeps the worst vertical error of the samples it covers (and of its
+// children), so a mesh within any error bound is one top-down walk that only
+// splits where the bound is exceeded.
+// GL-free, so it can run at load time or in an offline cook step.
+class TerrainSimplifier {
+public:
+    // grid.gridVerts must be a power of two plus one
+    explicit TerrainSimplifier(const TerrainGrid& grid);
+
+    // Triangles (grid vertex indices, z * gridVerts + x) within maxError world units.
+    // With maxSize, triangles are also split until each fits in an aligned square of
+    // maxSize quads (a power of two), so they can be bucketed into blocks of that size.
+    void simplify(float maxError, std::vector<unsigned int>& indices, int maxSize = 0) const;
+
+    // Error of every grid sample against the triangles in indices
+    TerrainSimplifyStats measure(const std::vector<unsigned int>& indices) const;
+
+private:
+    TerrainGrid grid;
+    std::vector<float> errors; // per grid vertex, error of the triangles split there
+
+    float sample(int x, int z) const;
+    void splitTriangle(int ax, int az, int bx, int bz, int cx, int cz,
+                       float maxError, int maxSize, std::vector<unsigned int>& indices) const;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "TerrainTileFile.h"
+
+// Pages terrain tiles from a mapped TerrainTileFile into a fixed number of
+// GL_TEXTURE_2D_ARRAY layers, heights and normals in two arrays with the same layer per tile. Loader threads copy tiles out of the mapping
+// into a fixed pool of staging buffers and the main thread uploads them,
+// evicting the least recently used layer, so RAM and VRAM use stay constant
+// whatever the size of the world. The coarsest level is loaded up front and
+// never evicted, so there is always something to draw.
+class TerrainStreamer {
+public:
+    static const int LOADER_THREADS = 2;
+    static const int MAX_PENDING = 32;        // tiles queued or loading, also the staging buffer count
+    static const int UPLOADS_PER_UPDATE = 8;  // texture uploads per update() call
+
+    TerrainStreamer(const TerrainTileFile& tiles, int slotCount);
+    ~TerrainStreamer();
+
+    TerrainStreamer(const TerrainStreamer&) = delete;
+    TerrainStreamer& operator=(const TerrainStreamer&) = delete;
+
+    bool isReady() const { return texture != 0; }
+
+    // Texture array layer holding the tile, or -1 after queueing it for loading
+    int acquire(int level, int tx, int tz);
+
+    // Main thread, before selecting patches: upload finished tiles
+    void update();
+
+    unsigned int getTexture() const { return texture; }
+    unsigned int getNormalTexture() const { return normalTexture; }
+    size_t getResidentCount() const { return resident.size(); }
+
+private:
+    struct Slot {
+        uint64_t key;
+        uint64_t lastUsed;
+        bool pinned;
+    };
+
+    struct Load {
+        uint64_t key;
+        std::vector<uint16_t> samples; // height tile, then normal tile
+    };
+
+    const TerrainTileFile& tiles;
+    unsigned int texture = 0;
+    unsigned int normalTexture = 0;
+    uint64_t tick = 0;
+
+    // main thread only
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, int> resident; // tile key -> slot
+    std::unordered_set<uint64_t> pending;       // queued, loading or waiting for upload
+
+    // shared with the loaders
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint64_t> requests;
+    std::vector<Load> finished;
+    std::vector<std::vector<uint16_t>> freeBuffers;
+    bool stopping = false;
+    std::vector<std::thread> loaders;
+
+    static uint64_t tileKey(int level, int tx, int tz);
+    void loaderLoop();
+    int claimSlot();
+    void upload(int slot, const uint16_t* samples, const uint16_t* normals);
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "VirtualFileSystem.h"
+
+// On-disk terrain pyramid (".ttp"), read through a memory mapping.
+//
+// Layout: header, then per-node (min, max) samples for every CDLOD level,
+// then every tile of every level. Level L holds every (1 << L)-th source
+// sample, cut into tiles of tileSize x tileSize quads. A tile stores
+// (tileSize + 3)^2 samples: its own (tileSize + 1)^2 plus a one-sample apron
+// so normals can be taken at its edges. All samples are raw uint16.
+// After all height tiles come the normal tiles, same order and size in
+// texels: per texel the height slope (dx, dz) over the level's sample
+// spacing, in raw sample units per level 0 grid step, as two half floats
+// (see TerrainBuilder::buildNormalMap).
+struct TerrainTileHeader {
+    char magic[4];          // "TTP1", written last: a partly converted file has none
+    uint32_t version;
+    uint32_t width, height; // source heightmap size in samples
+    uint32_t gridSize;      // quads per grid edge (power of two)
+    uint32_t patchSize;     // quads per CDLOD patch edge, node bounds are per patch
+    uint32_t tileSize;      // quads per tile edge at every level (power of two, >= patchSize)
+    uint32_t levelCount;
+    uint64_t nodeOffset;    // byte offset of level 0 node bounds
+    uint64_t tileOffset;    // byte offset of level 0, tile (0, 0)
+    uint64_t sourceHash;    // ContentHash::hashFile of the source heightmap
+    uint64_t normalOffset;  // byte offset of level 0, normal tile (0, 0)
+};
+
+class TerrainTileFile {
+public:
+    static const uint32_t VERSION = 3;
+
+    // Convert a heightmap (any image stb_image reads, or .raw/.r16) into a tile pyramid.
+    // Raw sources are mapped rather than loaded, so they can exceed RAM.
+    static bool convert(const std::string& sourcePath, const std::string& outPath,
+                        int patchSize, int tileSize = 256);
+
+    // True if path holds a current-version pyramid converted from a source with this hash
+    static bool isCurrent(const std::string& path, uint64_t sourceHash);
+
+    bool open(const std::string& path);
+
+    const TerrainTileHeader& getHeader() const { return header; }
+    int getTileSamples() const { return (int)header.tileSize + 3; }
+    size_t getTileBytes() const { return (size_t)getTileSamples() * getTileSamples() * sizeof(uint16_t); }
+    size_t getNormalTileBytes() const { return getTileBytes() * 2; }
+
+    // Tiles along one edge of the given level
+    int tilesPerEdge(int level) const;
+    const uint16_t* getTile(int level, int tx, int tz) const;
+    const uint16_t* getNormalTile(int level, int tx, int tz) const;
+
+    // (min, max) sample for CDLOD node (nx, nz) of a level
+    const uint16_t* getNodeBounds(int level, int nx, int nz) const;
+
+    // Let the OS drop a tile's height and normal pages once they have been copied out
+    void releaseTile(int level, int tx, int tz) const;
+
+private:
+    VirtualFile file;
+    TerrainTileHeader header = {};
+    uint64_t levelNodeOffset[32] = {};
+    uint64_t levelTileOffset[32] = {};
+
+    size_t tileByteOffset(int level, int tx, int tz) const;
+    size_t normalTileByteOffset(int level, int tx, int tz) const;
+};
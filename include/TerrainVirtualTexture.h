@@ -0,0 +1,117 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Shader.h"
+
+class TerrainQuery;
+
+// One terrain material: a tiling texture and how many world units one repeat covers
+struct TerrainMaterialLayer {
+    std::string path;
+    float tileSize;
+};
+
+// Runtime virtual texture over the whole terrain.
+// The terrain's surface colour is one huge virtual texture, split into
+// PAGE_SIZE pages with a mip chain. Only the pages some pixel actually needs
+// are composited, from the material layers and a splat map, into a fixed
+// atlas (ATLAS_PAGES^2 pages); a page table texture maps every virtual page
+// to an atlas slot, pointing non-resident pages at their closest resident
+// ancestor. Which pages are needed comes from a feedback pass: the terrain
+// is drawn at 1 / FEEDBACK_DIVISOR resolution with
+// shaders/terrain_feedback.fs, and the page ids are read back a frame later
+// through a pixel buffer. The terrain shader does one page table lookup and
+// one atlas fetch per pixel, however many layers the material has.
+class TerrainVirtualTexture {
+public:
+    static const int PAGE_SIZE = 128;       // texels along a page edge, without the border
+    static const int PAGE_BORDER = 1;       // texels on each side, so bilinear filtering stays in the page
+    static const int ATLAS_PAGES = 16;      // atlas slots along one edge
+    static const int FEEDBACK_DIVISOR = 8;  // feedback buffer size relative to the screen
+    static const int PAGES_PER_UPDATE = 8;  // pages composited per update() call
+    static const int MAX_LAYERS = 4;        // one per splat map channel
+    static const int MAX_LAYER_SIZE = 1024; // material textures are downsampled to this on load
+
+    // Texture units the terrain shader reads the page table and atlas from
+    static const int PAGE_TABLE_TEXTURE_UNIT = 5;
+    static const int ATLAS_TEXTURE_UNIT = 6;
+
+    TerrainVirtualTexture(const TerrainQuery& query, const std::vector<TerrainMaterialLayer>& layers,
+                          float texelsPerUnit, int screenWidth, int screenHeight);
+    ~TerrainVirtualTexture();
+
+    TerrainVirtualTexture(const TerrainVirtualTexture&) = delete;
+    TerrainVirtualTexture& operator=(const TerrainVirtualTexture&) = delete;
+
+    bool isReady() const { return ready; }
+
+    // Draw the terrain with the feedback shader between these two, the shader in use
+    void beginFeedback(const Shader& feedbackShader);
+    void endFeedback();
+
+    // Read last frame's feedback, then composite the most urgent missing pages
+    void update();
+
+    // After the ground over a world XZ rectangle changed: rebakes the splat map texels over it,
+    // and the resident pages that show them are composited again by the next update() calls
+    void invalidate(const TerrainQuery& query, const glm::vec2& minXZ, const glm::vec2& maxXZ);
+
+    // Page table / atlas textures and uniforms for the terrain or feedback shader, which must be in use
+    void bind(const Shader& shader) const;
+
+    size_t getResidentCount() const { return resident.size(); }
+
+private:
+    struct Slot {
+        uint32_t page;     // packed virtual page, see pageKey()
+        uint32_t lastUsed;
+        bool pinned;
+    };
+
+    bool ready = false;
+    glm::vec2 origin;      // world XZ of virtual texel (0, 0)
+    float worldSize = 0.0f;
+    int pagesPerEdge = 0;  // at mip 0
+    int mipCount = 0;
+    uint32_t frame = 0;
+
+    // GPU resources
+    unsigned int pageTable = 0, atlas = 0, splatMap = 0;
+    unsigned int atlasFBO = 0, feedbackFBO = 0, feedbackColor = 0, feedbackDepth = 0;
+    unsigned int pixelBuffers[2] = {};
+    unsigned int quadVAO = 0;
+    std::vector<unsigned int> layerTextures;
+    std::vector<float> layerTiles;
+    std::unique_ptr<Shader> compositeShader;
+    int feedbackWidth = 0, feedbackHeight = 0;
+    int feedbackReads = 0; // feedback frames written so far
+    GLint savedViewport[4] = {};
+
+    // Pages: atlas slots, virtual page -> slot, and the CPU copy of each page table mip
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, int> resident;
+    std::vector<std::vector<uint32_t>> tableMips;
+    std::vector<glm::ivec4> dirty; // per mip: changed rectangle (x0, y0, x1, y1), empty when x0 > x1
+    std::vector<uint32_t> requests;
+    std::vector<uint32_t> stale;   // resident pages over changed ground, composited again in place
+    std::vector<std::vector<unsigned char>> splatLevels; // CPU copy of each splat map mip, RGBA8
+
+    static uint32_t pageKey(int mip, int x, int y) { return ((uint32_t)mip << 24) | ((uint32_t)y << 12) | (uint32_t)x; }
+    static int keyMip(uint32_t key) { return (int)(key >> 24); }
+    static int keyY(uint32_t key) { return (int)((key >> 12) & 0xFFF); }
+    static int keyX(uint32_t key) { return (int)(key & 0xFFF); }
+
+    bool loadLayer(const TerrainMaterialLayer& layer);
+    void bakeSplatMap(const TerrainQuery& query);
+    void bakeSplatRect(const TerrainQuery& query, int x0, int z0, int x1, int z1);
+    void readFeedback(const unsigned char* pixels);
+    int claimSlot();
+    void composite(uint32_t page, int slot);
+    void markDirty(uint32_t page);
+    void updatePageTable();
+};
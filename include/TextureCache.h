@@ -0,0 +1,122 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TextureStreamer;
+
+// How a cached texture is sampled; part of its key, since GL keeps it per texture
+struct TextureSampler {
+    GLint wrap = GL_REPEAT;
+    GLint minFilter = GL_LINEAR_MIPMAP_LINEAR; // mipmaps are only built for a mipmapped filter
+    GLint magFilter = GL_LINEAR;
+};
+
+// A GL texture shared by everyone who loaded the same image with the same
+// sampler, deleted with its last reference
+class SharedTexture {
+public:
+    unsigned int id = 0;
+    int width = 0, height = 0;
+    size_t bytes = 0; // estimated video memory, mips included
+
+    SharedTexture() = default;
+    ~SharedTexture();
+
+    SharedTexture(const SharedTexture&) = delete;
+    SharedTexture& operator=(const SharedTexture&) = delete;
+};
+
+// An image read and decoded off the main thread, ready to upload
+struct TextureImage {
+    std::string path;
+    uint64_t hash = 0;       // of the file's contents
+    int width = 0, height = 0, channels = 0;
+    unsigned int compressedFormat = 0; // GL_COMPRESSED_*_S3TC_*, the levels hold 4x4 blocks then
+    std::vector<unsigned char> pixels; // empty if the file could not be decoded, or did not need to be
+    std::vector<std::vector<unsigned char>> mipmaps; // levels 1.., built with the pixels for a mipmapped sampler
+
+    const unsigned char* getLevel(int level) const { return level == 0 ? pixels.data() : mipmaps[level - 1].data(); }
+    size_t getLevelBytes(int level) const { return level == 0 ? pixels.size() : mipmaps[level - 1].size(); }
+    int getLevelWidth(int level) const { return width >> level > 1 ? width >> level : 1; }
+    int getLevelHeight(int level) const { return height >> level > 1 ? height >> level : 1; }
+
+    // A level's rows as they are laid out: of pixels, or of 4x4 blocks when compressed
+    int getRowCount(int level) const { return compressedFormat ? (getLevelHeight(level) + 3) / 4 : getLevelHeight(level); }
+    size_t getRowBytes(int level) const { return getLevelBytes(level) / getRowCount(level); }
+};
+
+// Process-wide cache of image textures, keyed by the file's content hash and
+// the sampler, so identical images under different paths or models (the same
+// bark texture copied next to three tree models) are decoded and uploaded once.
+// Entries are weak: a texture lives as long as some Mesh holds it.
+// decode() can run on any thread (see AssetLoader); the load() calls make
+// GL calls and are main thread only. With a TextureStreamer set, mipmapped
+// textures come back at low detail and sharpen over the next frames.
+class TextureCache {
+public:
+    static TextureCache& instance();
+
+    // The texture for an image file, nullptr if it cannot be read
+    std::shared_ptr<SharedTexture> load(const std::string& path, const TextureSampler& sampler = TextureSampler());
+
+    // Any thread: read and decode an image for a later load(image). Each distinct
+    // content is decoded once however many threads ask for it at the same time,
+    // and not at all while it is already uploaded with this sampler.
+    std::shared_ptr<const TextureImage> decode(const std::string& path, const TextureSampler& sampler = TextureSampler());
+
+    // The texture for a decoded image, nullptr if it could not be decoded
+    std::shared_ptr<SharedTexture> load(const std::shared_ptr<const TextureImage>& image, const TextureSampler& sampler = TextureSampler());
+
+    // Main thread: upload through this streamer from now on, nullptr to upload in one go
+    void setStreamer(TextureStreamer* textureStreamer) { streamer = textureStreamer; }
+
+    // Before any decode: keep images as BC1 / BC3 blocks (see TextureCompression),
+    // for a GL with EXT_texture_compression_s3tc. Off by default.
+    void setCompression(bool enabled) { compression = enabled; }
+
+    // Offline (assetcook): make the image's compressed copy current. rebuilt is
+    // false when it already was; nothing is kept either way. False when the
+    // image cannot be read, or compressed (single-channel).
+    static bool compressFile(const std::string& path, bool& rebuilt);
+
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+
+    // Hits / misses, and the textures alive right now and their memory
+    void printStats() const;
+
+private:
+    struct Key {
+        uint64_t hash;
+        GLint wrap, minFilter, magFilter;
+        bool operator==(const Key& o) const {
+            return hash == o.hash && wrap == o.wrap && minFilter == o.minFilter && magFilter == o.magFilter;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return (size_t)(k.hash ^ ((uint64_t)k.wrap << 40) ^ ((uint64_t)k.minFilter << 20) ^ (uint64_t)k.magFilter);
+        }
+    };
+
+    mutable std::mutex mutex; // guards everything below against decode() on other threads
+    std::unordered_map<Key, std::weak_ptr<SharedTexture>, KeyHash> textures;
+    std::unordered_map<std::string, uint64_t> pathHashes; // so a path is only hashed once
+    std::unordered_map<uint64_t, std::shared_future<std::shared_ptr<const TextureImage>>> decodes; // until uploaded
+    size_t hits = 0, misses = 0;
+    TextureStreamer* streamer = nullptr;
+    bool compression = false;
+
+    TextureCache() = default;
+    bool hashPath(const std::string& path, uint64_t& hash);
+    static void decodePixels(TextureImage& image, const TextureSampler& sampler, bool compressed);
+    static void buildMipmaps(TextureImage& image);
+    std::shared_ptr<SharedTexture> upload(const std::shared_ptr<const TextureImage>& image, const TextureSampler& sampler);
+};
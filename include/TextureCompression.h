@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+struct TextureImage;
+
+// BC1 / BC3 (DXT1 / DXT5) block compression of decoded images, and the DDS
+// files they are kept in between launches. A compressed texture takes a
+// sixth (BC1, RGB) or a quarter (BC3, RGBA) of the video memory and
+// bandwidth of the 8-bit pixels, and loading one skips both the image decode
+// and the mip chain.
+class TextureCompression {
+public:
+    static const uint32_t VERSION = 1;
+
+    // The compressed copy of an image file, next to it
+    static std::string pathFor(const std::string& imagePath) { return imagePath + ".dds"; }
+
+    // Only 3- and 4-channel images; single-channel ones would come back grey instead of red
+    static bool canCompress(const TextureImage& image);
+
+    // Replaces the pixels and each mipmap with BC1 blocks, or BC3 blocks
+    // when any texel is not fully opaque
+    static void compress(TextureImage& image);
+
+    // sourceHash: the content hash of the image file the blocks came from,
+    // kept in the header's reserved words
+    static bool writeDds(const std::string& path, const TextureImage& image, uint64_t sourceHash);
+
+    // False when the file is missing, damaged, not BC1 / BC3, or (with a
+    // sourceHash) encoded from other contents
+    static bool readDds(const std::string& path, TextureImage& image, const uint64_t* sourceHash = nullptr);
+
+    // Bytes of one level of 4x4 blocks
+    static size_t levelBytes(unsigned int format, int width, int height);
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class SharedTexture;
+struct TextureImage;
+
+// Uploads mipmapped textures over several frames instead of in one go.
+// stream() allocates every level, uploads the small ones (up to
+// RESIDENT_SIZE) straight away so the texture can be drawn at once, at low
+// detail, and queues the rest. update() then copies the queued levels, from
+// the smallest to the full size, through a ring of pixel buffer objects, at
+// most frameBudget bytes a frame and split into row bands (rows of 4x4 blocks
+// for a compressed image) where a level is bigger than that.
+// GL_TEXTURE_BASE_LEVEL follows the finest complete level, so sampling never
+// reaches a level still being filled.
+class TextureStreamer {
+public:
+    static const int RESIDENT_SIZE = 64;
+
+    explicit TextureStreamer(size_t frameBudget = 4 * 1024 * 1024, int bufferCount = 3);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Main thread, with the texture's sampler already set. False when the image
+    // has no mipmaps to stream, or rows wider than the budget; the caller
+    // uploads it in one go then. Holds on to the image until it is uploaded.
+    bool stream(const std::shared_ptr<SharedTexture>& texture, const std::shared_ptr<const TextureImage>& image);
+
+    // Main thread, once a frame: the next budget's worth of queued levels.
+    // Skips the frame rather than wait while the next buffer is still read by the GPU.
+    void update();
+
+    size_t getQueued() const { return requests.size(); }
+    size_t getQueuedBytes() const { return queuedBytes; }
+
+private:
+    // A texture whose finer levels are still to come
+    struct Request {
+        std::weak_ptr<SharedTexture> texture; // dropped once the texture is freed
+        std::shared_ptr<const TextureImage> image;
+        int level; // next level to upload, counting down to 0
+        int row;   // rows of it uploaded so far
+    };
+
+    // One pixel buffer of the ring and the fence of its last copies
+    struct Slot {
+        unsigned int buffer = 0;
+        GLsync fence = nullptr;
+    };
+
+    size_t frameBudget;
+    std::vector<Slot> slots;
+    size_t nextSlot = 0;
+    std::deque<Request> requests;
+    size_t queuedBytes = 0;
+};
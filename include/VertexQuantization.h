@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include "Mesh.h"
+
+// Largest difference between the float vertices and their quantized form
+struct QuantizationError {
+    float position = 0.0f;      // object space units
+    float normalDegrees = 0.0f;
+    float texCoord = 0.0f;
+};
+
+// Packs Vertex (32 bytes of floats) into QuantizedVertex (16 bytes), the
+// way model_loading.vs and depth_shader.vs unpack it: positions as unorm16
+// over the mesh bounds, normals octahedral in two snorm16, texture
+// coordinates as half floats. Halves vertex memory and fetch bandwidth.
+class VertexQuantization {
+public:
+    // Texture coordinates drift by up to this much as half floats before a
+    // mesh is better left as floats: a texel of a 2048 texture (UVs past 2 or so)
+    static constexpr float MAX_TEXCOORD_ERROR = 1.0f / 2048.0f;
+
+    // False (and nothing quantized) when the texture coordinates would lose too much
+    static bool quantize(const std::vector<Vertex>& vertices, QuantizedVertices& quantized, QuantizationError* error = nullptr);
+
+    // What the shaders read back
+    static Vertex decode(const QuantizedVertex& vertex, const QuantizedVertices& quantized);
+
+    static glm::vec2 encodeOctahedral(const glm::vec3& normal);
+    static glm::vec3 decodeOctahedral(const glm::vec2& encoded);
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "AssetPack.h"
+#include "MappedFile.h"
+
+// A file's bytes, read in place: a range of the mounted asset pack, or a
+// loose file mapped on its own when the pack does not have it. Same
+// interface as MappedFile, which it stands in for.
+class VirtualFile {
+public:
+    VirtualFile() = default;
+
+    VirtualFile(const VirtualFile&) = delete;
+    VirtualFile& operator=(const VirtualFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    const unsigned char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+    // See MappedFile::release
+    void release(size_t offset, size_t length) const;
+
+    // The FNV-1a hash of the bytes when it is known without reading them (packed files)
+    bool getStoredHash(uint64_t& hash) const;
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    const AssetPackEntry* entry = nullptr; // packed
+    MappedFile loose;                      // or not
+};
+
+// Where every asset read goes through: Shader, Model (via Assimp's IO),
+// TextureCache, the skybox, the heightmap and the terrain caches.
+// With a pack mounted its files win over loose files of the same path, so
+// a file that is not in the pack is the only one that touches the disk;
+// without one, every path is a loose file relative to the working directory.
+// Mount once at startup, before any loading; lookups are safe from any thread.
+class VirtualFileSystem {
+public:
+    static VirtualFileSystem& instance();
+
+    // False when there is no pack at path (not an error) or it is damaged
+    bool mount(const std::string& packPath);
+    bool isMounted() const { return pack.isOpen(); }
+    const AssetPack& getPack() const { return pack; }
+
+    bool exists(const std::string& path) const;
+    bool fileSize(const std::string& path, uint64_t& size) const;
+    // Of a loose file, in the file system's own clock; packed files have none
+    bool modifiedTime(const std::string& path, int64_t& time) const;
+
+    // "./a\\b/../c" -> "a/c", the form pack entries are stored in
+    static std::string normalize(const std::string& path);
+
+private:
+    AssetPack pack;
+
+    VirtualFileSystem() = default;
+};
@@ -1,5 +1,23 @@
 #version 330 core
+
+// Cross-fade between levels of detail (LodSelector::draw): the new level keeps
+// the pixels a 4x4 ordered dither puts below lodFade, the old one (-lodFade) the rest
+uniform float lodFade;
+
+bool LodFadeDiscard()
+{
+    if (lodFade == 0.0)
+        return false;
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[cell.y * 4 + cell.x] + 0.5) / 16.0;
+    return (lodFade > 0.0) ? threshold >= lodFade : threshold < -lodFade;
+}
+
 void main()
 {
-    // depth only, no color needed
+    // depth only, no color needed; shadows fade between levels too
+    if (LodFadeDiscard())
+        discard;
 }
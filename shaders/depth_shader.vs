@@ -4,7 +4,13 @@ layout (location = 0) in vec3 aPos;
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// Quantized meshes: unorm16 over the mesh bounds, see model_loading.vs
+uniform bool quantized;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    vec3 position = quantized ? positionOffset + aPos * positionScale : aPos;
+    gl_Position = lightSpaceMatrix * model * vec4(position, 1.0);
 }
@@ -72,14 +72,39 @@ uniform vec3 fogColor;
 uniform float fogDensity;
 uniform sampler2D shadowMap;
 
+// Terrain horizon map, see TerrainHorizon and terrain.fs: the ground under a
+// prop is in the ridges' shadow, so the prop is too
+uniform sampler2DArray horizonMap;
+uniform vec2 horizonOrigin;
+uniform float horizonWorldSize;
+
+// Cross-fade between levels of detail (LodSelector::draw): the new level keeps
+// the pixels a 4x4 ordered dither puts below lodFade, the old one (-lodFade) the rest
+uniform float lodFade;
+
+bool LodFadeDiscard()
+{
+    if (lodFade == 0.0)
+        return false;
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[cell.y * 4 + cell.x] + 0.5) / 16.0;
+    return (lodFade > 0.0) ? threshold >= lodFade : threshold < -lodFade;
+}
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir);
+float horizonShadow(vec3 lightDir);
 vec3 CalcFlashlight(Flashlight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
 void main()
 {
+    if (LodFadeDiscard())
+        discard;
+
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
 
@@ -118,7 +143,8 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 texDiffuse  = vec3(texture(material.texture_diffuse1, TexCoords));
     vec3 texSpecular = vec3(texture(material.texture_specular1, TexCoords));
 
-    float shadow = ShadowCalculation(FragPosLightSpace, normal, lightDir);
+    // other props from the shadow map, the terrain from its horizon map
+    float shadow = max(ShadowCalculation(FragPosLightSpace, normal, lightDir), horizonShadow(lightDir));
 
 
     vec3 ambient = light.ambient * texDiffuse;
@@ -201,6 +227,25 @@ float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
     return shadow;
 }
 
+// 1 where the ridges around hide the sun from the ground at this XZ, 0 where it is above the horizon
+float horizonShadow(vec3 lightDir)
+{
+    if (length(lightDir.xz) < 1e-4)
+        return 0.0;
+
+    vec2 uv = (FragPos.xz - horizonOrigin) / horizonWorldSize;
+    vec4 h0 = texture(horizonMap, vec3(uv, 0.0));
+    vec4 h1 = texture(horizonMap, vec3(uv, 1.0));
+    float horizon[8] = float[8](h0.r, h0.g, h0.b, h0.a, h1.r, h1.g, h1.b, h1.a);
+
+    float azimuth = mod(atan(lightDir.z, lightDir.x) / 6.2831853 * 8.0, 8.0);
+    int i0 = int(azimuth) % 8;
+    float h = mix(horizon[i0], horizon[(i0 + 1) % 8], fract(azimuth));
+
+    // soft edge for the sun's disc and the 8-bit horizon
+    return 1.0 - smoothstep(h - 0.02, h + 0.02, lightDir.y);
+}
+
 vec3 CalcFlashlight(Flashlight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
     if (!light.enabled)
@@ -0,0 +1,296 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 NormalCoords; // normal map texel (x, z) and array layer
+in vec2 TexCoords;
+in vec4 FragPosLightSpace;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+    float shininess;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct Flashlight {
+    bool enabled;
+    vec3 position;
+    vec3 direction;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float cutOff;
+    float outerCutOff;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+#define NR_POINT_LIGHTS 2  // adjust for number of point lights
+
+uniform DirLight dirLight;
+uniform PointLight pointLights[NR_POINT_LIGHTS];
+uniform Flashlight flashlight;
+uniform vec3 viewPos;
+uniform Material material;
+uniform vec3 fogColor;
+uniform float fogDensity;
+uniform sampler2D shadowMap;
+
+// Terrain normal map: per texel the height slope in raw samples per grid step,
+// so the normal is rebuilt here for the current height scale and spacing
+uniform sampler2DArray normalMap;
+uniform float heightScale;
+uniform float gridSpacing;
+
+// Runtime virtual texture, see TerrainVirtualTexture
+uniform sampler2D vtPageTable; // per virtual page: atlas slot (r, g) and the mip it holds (b)
+uniform sampler2D vtAtlas;
+uniform vec2 vtOrigin;
+uniform float vtWorldSize;
+uniform float vtVirtualSize;   // mip 0 texels along one edge
+uniform float vtPageSize;
+uniform float vtPageBorder;
+uniform int vtMipCount;
+
+// Horizon map, see TerrainHorizon: sine of the horizon elevation towards
+// 8 azimuths (angle k * 45 degrees from +X towards +Z), four per layer
+uniform sampler2DArray horizonMap;
+uniform vec2 horizonOrigin;
+uniform float horizonWorldSize;
+
+vec3 surfaceColor;
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir);
+vec3 CalcFlashlight(Flashlight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+
+vec3 terrainNormal()
+{
+    vec2 uv = (NormalCoords.xy + 0.5) / vec2(textureSize(normalMap, 0).xy);
+    vec2 slope = texture(normalMap, vec3(uv, NormalCoords.z)).rg * (heightScale / 65535.0);
+    return normalize(vec3(-slope.x, gridSpacing, -slope.y));
+}
+
+// One page table lookup, then one fetch from the atlas. Pages that are not
+// resident yet point at their closest resident ancestor.
+vec3 virtualTextureColor()
+{
+    vec2 uv = clamp((FragPos.xz - vtOrigin) / vtWorldSize, 0.0, 0.99999);
+    vec2 texel = uv * vtVirtualSize;
+    float lod = clamp(floor(log2(max(length(dFdx(texel)), length(dFdy(texel))))), 0.0, float(vtMipCount - 1));
+
+    vec3 entry = floor(textureLod(vtPageTable, uv, lod).rgb * 255.0 + 0.5);
+    vec2 pageTexel = texel / exp2(entry.b);
+    vec2 inPage = pageTexel - floor(pageTexel / vtPageSize) * vtPageSize;
+    vec2 atlasTexel = entry.rg * (vtPageSize + 2.0 * vtPageBorder) + vtPageBorder + inPage;
+    return textureLod(vtAtlas, atlasTexel / vec2(textureSize(vtAtlas, 0)), 0.0).rgb;
+}
+
+// 1 where the ridges around hide the sun, 0 where it is above the horizon
+float horizonShadow(vec3 lightDir)
+{
+    if (length(lightDir.xz) < 1e-4)
+        return 0.0;
+
+    vec2 uv = (FragPos.xz - horizonOrigin) / horizonWorldSize;
+    vec4 h0 = texture(horizonMap, vec3(uv, 0.0));
+    vec4 h1 = texture(horizonMap, vec3(uv, 1.0));
+    float horizon[8] = float[8](h0.r, h0.g, h0.b, h0.a, h1.r, h1.g, h1.b, h1.a);
+
+    float azimuth = mod(atan(lightDir.z, lightDir.x) / 6.2831853 * 8.0, 8.0);
+    int i0 = int(azimuth) % 8;
+    float h = mix(horizon[i0], horizon[(i0 + 1) % 8], fract(azimuth));
+
+    // soft edge for the sun's disc and the 8-bit horizon
+    return 1.0 - smoothstep(h - 0.02, h + 0.02, lightDir.y);
+}
+
+void main()
+{
+    surfaceColor = virtualTextureColor();
+    vec3 norm = terrainNormal();
+    vec3 viewDir = normalize(viewPos - FragPos);
+
+    // Phase 1: Directional light
+    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+
+    // Phase 2: Point lights
+    for(int i = 0; i < NR_POINT_LIGHTS; i++)
+       result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+
+    // Phase 3: Spot light (camera flashlight)
+    result += CalcFlashlight(flashlight, norm, FragPos, viewDir);
+
+    // distance from camera to fragment
+    float distance = length(viewPos - FragPos);
+
+    // exponential fog
+    float fogFactor = exp(-pow(distance * fogDensity, 2.0));
+    fogFactor = clamp(fogFactor, 0.0, 1.0);
+
+    // final color blended with fog
+    vec3 finalColor = mix(fogColor, result, fogFactor);
+    FragColor = vec4(finalColor, 1.0);
+
+}
+
+// ----- FUNCTIONS -----
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    vec3 texDiffuse  = surfaceColor;
+    vec3 texSpecular = vec3(texture(material.texture_specular1, TexCoords));
+
+    // objects from the shadow map, the terrain itself from the horizon map
+    float shadow = max(ShadowCalculation(FragPosLightSpace, normal, lightDir), horizonShadow(lightDir));
+
+
+    vec3 ambient = light.ambient * texDiffuse;
+    vec3 diffuse = (1.0 - shadow) * light.diffuse * diff * texDiffuse;
+    vec3 specular = (1.0 - shadow) * light.specular * spec * texSpecular;
+
+    return (ambient + diffuse + specular);
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance +
+                               light.quadratic * (distance * distance));
+
+    vec3 ambient = light.ambient * surfaceColor;
+    vec3 diffuse = light.diffuse * diff * surfaceColor;
+    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance +
+                               light.quadratic * (distance * distance));
+
+    vec3 ambient = light.ambient * surfaceColor;
+    vec3 diffuse = light.diffuse * diff * surfaceColor;
+    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    return (ambient + diffuse + specular);
+}
+
+float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+{
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+
+    if (projCoords.z > 1.0)
+        return 0.0;
+
+    float bias = max(0.01 * (1.0 - dot(normal, lightDir)), 0.002);
+
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    for(int x = -1; x <= 1; ++x)
+    {
+        for(int y = -1; y <= 1; ++y)
+        {
+            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            shadow += (projCoords.z - bias > pcfDepth ? 1.0 : 0.0);
+        }
+    }
+    shadow /= 9.0;
+
+    return shadow;
+}
+
+vec3 CalcFlashlight(Flashlight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    if (!light.enabled)
+        return vec3(0.0);
+    
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff    = max(dot(normal, lightDir), 0.0);
+
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+
+    float theta = dot(lightDir, normalize(-light.direction));
+
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    float distance    = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance +
+                               light.quadratic * (distance * distance));
+
+    vec3 ambient = light.ambient * surfaceColor;
+    vec3 diffuse = light.diffuse * diff * surfaceColor;
+    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+
+    return (ambient + (diffuse + specular) * intensity) * attenuation;
+}
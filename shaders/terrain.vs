@@ -0,0 +1,62 @@
+#version 330 core
+layout (location = 0) in vec2 aHeights; // x = height, y = morph target height, unorm16
+
+out vec3 FragPos;
+out vec3 NormalCoords; // normal map texel (x, z) and layer, see terrain.fs
+out vec2 TexCoords;
+out vec4 FragPosLightSpace;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 lightSpaceMatrix;
+
+// CDLOD
+uniform vec3 morphCameraPos;
+uniform vec2 terrainOrigin;
+uniform float gridSpacing;
+uniform vec2 terrainUVScale;
+uniform int lodLevel;
+uniform vec2 morphRange; // distance where morphing starts / ends for this level
+
+// Quantized vertex decoding
+uniform float heightScale; // world height = sample * heightScale + heightOffset
+uniform float heightOffset;
+
+// Vertex buffer layout of this level, see TerrainVertexLayout
+uniform int layoutFirstVertex;
+uniform int blockVerts;    // vertices per block edge
+uniform int blocksPerEdge;
+uniform float blockStride; // grid steps between block vertices
+
+void main()
+{
+    // the base vertex is included in gl_VertexID, so it indexes the whole layout
+    int local = gl_VertexID - layoutFirstVertex;
+    int blockSize = blockVerts * blockVerts;
+    int block = local / blockSize;
+    int inBlock = local - block * blockSize;
+    vec2 blockPos = vec2(block % blocksPerEdge, block / blocksPerEdge) * float(blockVerts - 1);
+    vec2 gridPos = (blockPos + vec2(inBlock % blockVerts, inBlock / blockVerts)) * blockStride;
+    float height = aHeights.x * heightScale + heightOffset;
+
+    // odd vertices of this level slide onto the next coarser grid as they get further away
+    vec2 odd = mod(gridPos, exp2(float(lodLevel + 1)));
+    float morphK = 0.0;
+    if (odd.x + odd.y > 0.5) {
+        vec3 unmorphed = vec3(terrainOrigin.x + gridPos.x * gridSpacing, height, terrainOrigin.y + gridPos.y * gridSpacing);
+        morphK = clamp((distance(morphCameraPos, unmorphed) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+    }
+
+    vec2 morphedGrid = gridPos - odd * morphK;
+
+    vec3 pos = vec3(terrainOrigin.x + morphedGrid.x * gridSpacing,
+                    mix(height, aHeights.y * heightScale + heightOffset, morphK),
+                    terrainOrigin.y + morphedGrid.y * gridSpacing);
+
+    FragPos = pos;
+    NormalCoords = vec3(morphedGrid, 0.0);
+    TexCoords = morphedGrid * terrainUVScale;
+    FragPosLightSpace = lightSpaceMatrix * vec4(pos, 1.0);
+
+    gl_Position = projection * view * vec4(pos, 1.0);
+}
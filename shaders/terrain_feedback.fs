@@ -0,0 +1,26 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 FragPos;
+
+// Virtual texture placement, see TerrainVirtualTexture::bind()
+uniform vec2 vtOrigin;
+uniform float vtWorldSize;
+uniform float vtVirtualSize; // mip 0 texels along one edge
+uniform float vtPageSize;
+uniform int vtMipCount;
+uniform float vtLodBias;     // this pass runs at a lower resolution than the one it feeds
+
+// Writes the virtual page (x, y, mip) this pixel samples:
+// r / g = low 8 bits of x / y, b = x >> 8 | (y >> 8) << 2 | mip << 4, a = 1
+void main()
+{
+    vec2 uv = clamp((FragPos.xz - vtOrigin) / vtWorldSize, 0.0, 0.99999);
+    vec2 texel = uv * vtVirtualSize;
+    float lod = log2(max(length(dFdx(texel)), length(dFdy(texel)))) + vtLodBias;
+    int mip = int(clamp(floor(lod), 0.0, float(vtMipCount - 1)));
+
+    ivec2 page = ivec2(texel / (vtPageSize * exp2(float(mip))));
+    FragColor = vec4(float(page.x & 255), float(page.y & 255),
+                     float((page.x >> 8) | ((page.y >> 8) << 2) | (mip << 4)), 255.0) / 255.0;
+}
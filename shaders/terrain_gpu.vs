@@ -0,0 +1,55 @@
+#version 330 core
+layout (location = 0) in vec2 aGridPos; // patch-local grid position
+layout (location = 4) in vec4 aPatch;   // per instance: first grid vertex (x, z), grid stride, LOD level
+
+out vec3 FragPos;
+out vec3 NormalCoords; // normal map texel (x, z) and layer, see terrain.fs
+out vec2 TexCoords;
+out vec4 FragPosLightSpace;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 lightSpaceMatrix;
+
+uniform sampler2D heightMap; // R16, normalized sample per texel
+
+// CDLOD
+uniform vec3 morphCameraPos;
+uniform vec2 terrainOrigin;
+uniform float gridSpacing;
+uniform vec2 terrainUVScale;
+uniform vec2 morphRanges[16]; // per level: distance where morphing starts / ends
+uniform float heightScale;    // world height = sample * heightScale + heightOffset
+uniform float heightOffset;
+
+float heightAt(vec2 gridPos)
+{
+    ivec2 texel = clamp(ivec2(gridPos), ivec2(0), textureSize(heightMap, 0) - 1);
+    return texelFetch(heightMap, texel, 0).r * heightScale + heightOffset;
+}
+
+void main()
+{
+    float stride = aPatch.z;
+    vec2 gridPos = aPatch.xy + aGridPos * stride;
+    float height = heightAt(gridPos);
+
+    // odd vertices of this level slide onto the next coarser grid as they get further away
+    vec2 range = morphRanges[int(aPatch.w + 0.5)];
+    vec3 unmorphed = vec3(terrainOrigin.x + gridPos.x * gridSpacing, height, terrainOrigin.y + gridPos.y * gridSpacing);
+    float morphK = clamp((distance(morphCameraPos, unmorphed) - range.x) / (range.y - range.x), 0.0, 1.0);
+
+    vec2 coarseGrid = gridPos - mod(gridPos, 2.0 * stride);
+    vec2 morphedGrid = mix(gridPos, coarseGrid, morphK);
+
+    vec3 pos = vec3(terrainOrigin.x + morphedGrid.x * gridSpacing,
+                    mix(height, heightAt(coarseGrid), morphK),
+                    terrainOrigin.y + morphedGrid.y * gridSpacing);
+
+    FragPos = pos;
+    NormalCoords = vec3(morphedGrid, 0.0);
+    TexCoords = morphedGrid * terrainUVScale;
+    FragPosLightSpace = lightSpaceMatrix * vec4(pos, 1.0);
+
+    gl_Position = projection * view * vec4(pos, 1.0);
+}
@@ -0,0 +1,59 @@
+#version 330 core
+layout (location = 0) in vec2 aGridPos; // patch-local grid position
+layout (location = 4) in vec4 aPatch;   // per instance: first grid vertex (x, z), grid stride, LOD level
+layout (location = 5) in vec4 aTile;    // per instance: texture array layer, tile origin (x, z) in grid units
+
+out vec3 FragPos;
+out vec3 NormalCoords; // normal tile texel (x, z) and layer, see terrain.fs
+out vec2 TexCoords;
+out vec4 FragPosLightSpace;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 lightSpaceMatrix;
+
+// R16 tiles of (tileSize + 3)^2 samples at the patch's level, with a one-sample apron
+uniform sampler2DArray heightTiles;
+
+// CDLOD
+uniform vec3 morphCameraPos;
+uniform vec2 terrainOrigin;
+uniform float gridSpacing;
+uniform vec2 terrainUVScale;
+uniform vec2 morphRanges[16]; // per level: distance where morphing starts / ends
+uniform float heightScale;    // world height = sample * heightScale + heightOffset
+uniform float heightOffset;
+
+float heightAt(vec2 gridPos, float stride)
+{
+    ivec2 texel = ivec2((gridPos - aTile.yz) / stride + 1.0);
+    texel = clamp(texel, ivec2(0), textureSize(heightTiles, 0).xy - 1);
+    return texelFetch(heightTiles, ivec3(texel, int(aTile.x + 0.5)), 0).r * heightScale + heightOffset;
+}
+
+void main()
+{
+    float stride = aPatch.z;
+    vec2 gridPos = aPatch.xy + aGridPos * stride;
+    float height = heightAt(gridPos, stride);
+
+    // odd vertices of this level slide onto the next coarser grid as they get further away
+    vec2 range = morphRanges[int(aPatch.w + 0.5)];
+    vec3 unmorphed = vec3(terrainOrigin.x + gridPos.x * gridSpacing, height, terrainOrigin.y + gridPos.y * gridSpacing);
+    float morphK = clamp((distance(morphCameraPos, unmorphed) - range.x) / (range.y - range.x), 0.0, 1.0);
+
+    vec2 coarseGrid = gridPos - mod(gridPos, 2.0 * stride);
+    vec2 morphedGrid = mix(gridPos, coarseGrid, morphK);
+
+    vec3 pos = vec3(terrainOrigin.x + morphedGrid.x * gridSpacing,
+                    mix(height, heightAt(coarseGrid, stride), morphK),
+                    terrainOrigin.y + morphedGrid.y * gridSpacing);
+
+    FragPos = pos;
+    // normal tiles share the height tile's layer and apron
+    NormalCoords = vec3((morphedGrid - aTile.yz) / stride + 1.0, aTile.x);
+    TexCoords = morphedGrid * terrainUVScale;
+    FragPosLightSpace = lightSpaceMatrix * vec4(pos, 1.0);
+
+    gl_Position = projection * view * vec4(pos, 1.0);
+}
@@ -0,0 +1,51 @@
+#version 330 core
+out vec4 FragColor;
+
+// The page being composited
+uniform vec2 slotOrigin;   // atlas pixel of the slot's corner, border included
+uniform vec2 pageOrigin;   // mip 0 virtual texel of the page's first texel
+uniform float texelScale;  // mip 0 virtual texels per texel of this page's mip
+uniform float pageBorder;
+
+// Virtual texture placement
+uniform vec2 terrainOrigin;
+uniform float worldSize;
+uniform float texelsPerUnit; // mip 0 virtual texels per world unit
+
+// Material: splat weights per layer (RGBA), and the layers with their world tile size
+uniform sampler2D splatMap;
+uniform sampler2D layers[4];
+uniform float layerTiles[4];
+uniform int layerCount;
+
+// Level matching a footprint of the given size in world units
+float lodFor(sampler2D tex, float footprint, float tile)
+{
+    float texels = footprint * float(textureSize(tex, 0).x) / tile;
+    return log2(max(texels, 1e-4));
+}
+
+vec3 layerColor(sampler2D tex, vec2 world, float footprint, float tile)
+{
+    return textureLod(tex, world / tile, lodFor(tex, footprint, tile)).rgb;
+}
+
+void main()
+{
+    vec2 local = gl_FragCoord.xy - slotOrigin - pageBorder;
+    vec2 world = terrainOrigin + (pageOrigin + local * texelScale) / texelsPerUnit;
+    float footprint = texelScale / texelsPerUnit;
+
+    vec4 w = textureLod(splatMap, (world - terrainOrigin) / worldSize, lodFor(splatMap, footprint, worldSize));
+
+    // sampler arrays can only take constant indices
+    vec3 color = w.r * layerColor(layers[0], world, footprint, layerTiles[0]);
+    if (layerCount > 1)
+        color += w.g * layerColor(layers[1], world, footprint, layerTiles[1]);
+    if (layerCount > 2)
+        color += w.b * layerColor(layers[2], world, footprint, layerTiles[2]);
+    if (layerCount > 3)
+        color += w.a * layerColor(layers[3], world, footprint, layerTiles[3]);
+
+    FragColor = vec4(color / max(w.r + w.g + w.b + w.a, 1e-3), 1.0);
+}
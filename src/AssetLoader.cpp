@@ -0,0 +1,66 @@
+#include "AssetLoader.h"
+#include <algorithm>
+
+// ------------------ Constructor ------------------
+AssetLoader::AssetLoader(unsigned int threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&AssetLoader::workerLoop, this);
+}
+
+AssetLoader::~AssetLoader() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// ------------------ Jobs ------------------
+void AssetLoader::load(std::function<void()> work, std::function<void()> upload) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+        jobs.push_back([this, work = std::move(work), upload = std::move(upload)]() mutable {
+            work();
+            std::lock_guard<std::mutex> lock(mutex);
+            uploads.push_back(upload ? std::move(upload) : [] {});
+            uploadReady.notify_one();
+        });
+    }
+    workReady.notify_one();
+}
+
+void AssetLoader::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (pending > 0) {
+        uploadReady.wait(lock, [this] { return !uploads.empty(); });
+        std::function<void()> upload = std::move(uploads.front());
+        uploads.pop_front();
+
+        // workers keep going while the GL calls run
+        lock.unlock();
+        upload();
+        lock.lock();
+        pending--;
+    }
+}
+
+void AssetLoader::workerLoop() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
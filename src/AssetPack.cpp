@@ -0,0 +1,139 @@
+#include "AssetPack.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "ContentHash.h"
+
+static uint64_t alignBlob(uint64_t offset) {
+    return (offset + AssetPack::ALIGNMENT - 1) / AssetPack::ALIGNMENT * AssetPack::ALIGNMENT;
+}
+
+// ------------------ Writing ------------------
+bool AssetPack::write(const std::string& path, const std::vector<std::string>& paths) {
+    // sorted, so find() can binary search
+    std::vector<std::string> sorted = paths;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string strings;
+    std::vector<AssetPackEntry> entries(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        entries[i].pathOffset = (uint32_t)strings.size();
+        entries[i].pathLength = (uint32_t)sorted[i].size();
+        strings += sorted[i];
+    }
+
+    // a placeholder header without the magic, so a pack cut short by a
+    // source that fails to open is rejected by open() instead of serving empty files
+    AssetPackHeader header = {};
+    header.version = VERSION;
+    header.entryOffset = sizeof(AssetPackHeader);
+    header.entryCount = entries.size();
+    header.stringOffset = header.entryOffset + entries.size() * sizeof(AssetPackEntry);
+    header.stringCount = strings.size();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to create asset pack: " << path << std::endl;
+        return false;
+    }
+
+    // the table and the real header are rewritten once the blob offsets, sizes and hashes are known
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), (std::streamsize)(entries.size() * sizeof(AssetPackEntry)));
+    out.write(strings.data(), (std::streamsize)strings.size());
+
+    static const char padding[ALIGNMENT] = {};
+    uint64_t written = header.stringOffset + strings.size();
+    for (size_t i = 0; i < sorted.size(); i++) {
+        // empty files cannot be mapped, they just get an empty range
+        std::error_code error;
+        MappedFile source;
+        if (std::filesystem::file_size(sorted[i], error) == 0 && !error) {
+            entries[i].offset = written;
+            entries[i].hash = ContentHash::hashBytes(nullptr, 0);
+            continue;
+        }
+        if (!source.open(sorted[i])) {
+            std::cout << "Failed to write asset pack: " << path << std::endl;
+            return false;
+        }
+
+        uint64_t offset = alignBlob(written);
+        out.write(padding, (std::streamsize)(offset - written));
+        out.write((const char*)source.getData(), (std::streamsize)source.getSize());
+        entries[i].offset = offset;
+        entries[i].size = source.getSize();
+        entries[i].hash = ContentHash::hashBytes(source.getData(), source.getSize());
+        written = offset + source.getSize();
+    }
+
+    out.seekp((std::streamoff)header.entryOffset);
+    out.write((const char*)entries.data(), (std::streamsize)(entries.size() * sizeof(AssetPackEntry)));
+    out.flush();
+    std::memcpy(header.magic, "APK1", 4);
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    if (!out) {
+        std::cout << "Failed to write asset pack: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ------------------ Reading ------------------
+bool AssetPack::open(const std::string& path) {
+    close();
+    // no pack is the normal development setup, not an error
+    if (!std::ifstream(path))
+        return false;
+    if (!file.open(path))
+        return false;
+
+    AssetPackHeader header = {};
+    if (file.getSize() < sizeof(header)) {
+        std::cout << "Asset pack is truncated: " << path << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, "APK1", 4) != 0 || header.version != VERSION) {
+        std::cout << "Not an asset pack (or an old version): " << path << std::endl;
+        close();
+        return false;
+    }
+
+    // the table, the strings and every blob have to lie inside the file
+    uint64_t size = file.getSize();
+    bool valid = header.entryOffset <= size && header.entryCount <= (size - header.entryOffset) / sizeof(AssetPackEntry) &&
+                 header.stringOffset <= size && header.stringCount <= size - header.stringOffset;
+    const AssetPackEntry* table = (const AssetPackEntry*)(file.getData() + header.entryOffset);
+    for (uint64_t i = 0; valid && i < header.entryCount; i++) {
+        const AssetPackEntry& entry = table[i];
+        valid = entry.pathOffset <= header.stringCount && entry.pathLength <= header.stringCount - entry.pathOffset &&
+                entry.offset <= size && entry.size <= size - entry.offset;
+    }
+    if (!valid) {
+        std::cout << "Asset pack is damaged: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    entries = table;
+    entryCount = (size_t)header.entryCount;
+    strings = (const char*)(file.getData() + header.stringOffset);
+    stringCount = (size_t)header.stringCount;
+    return true;
+}
+
+const AssetPackEntry* AssetPack::find(const std::string& path) const {
+    const AssetPackEntry* end = entries + entryCount;
+    const AssetPackEntry* found = std::lower_bound(entries, end, path, [this](const AssetPackEntry& entry, const std::string& key) {
+        return key.compare(0, std::string::npos, strings + entry.pathOffset, entry.pathLength) > 0;
+    });
+    if (found == end || path.compare(0, std::string::npos, strings + found->pathOffset, found->pathLength) != 0)
+        return nullptr;
+    return found;
+}
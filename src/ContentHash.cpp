@@ -0,0 +1,67 @@
+#include "ContentHash.h"
+#include <sstream>
+#include <unordered_map>
+#include "VirtualFileSystem.h"
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+// A source as assetcook last hashed it
+struct RecordedHash {
+    uint64_t size;
+    int64_t modified;
+    uint64_t hash;
+};
+
+// By normalized path; filled by loadManifest before loading starts, only read after
+static std::unordered_map<std::string, RecordedHash> recorded;
+
+bool ContentHash::hashFile(const std::string& path, uint64_t& hash) {
+    VirtualFile source;
+    if (!source.open(path))
+        return false;
+    if (source.getStoredHash(hash))
+        return true;
+
+    auto known = recorded.find(VirtualFileSystem::normalize(path));
+    int64_t modified = 0;
+    if (known != recorded.end() && known->second.size == source.getSize() &&
+        VirtualFileSystem::instance().modifiedTime(path, modified) && known->second.modified == modified) {
+        hash = known->second.hash;
+        return true;
+    }
+    hash = hashBytes(source.getData(), source.getSize());
+    return true;
+}
+
+uint64_t ContentHash::hashBytes(const unsigned char* bytes, size_t size) {
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+bool ContentHash::loadManifest(const std::string& path) {
+    if (!VirtualFileSystem::instance().exists(path))
+        return false;
+    VirtualFile manifest;
+    if (!manifest.open(path))
+        return false;
+
+    // kind, cooked file, source file, source size, source modification time, source hash (hex)
+    std::istringstream lines(std::string((const char*)manifest.getData(), manifest.getSize()));
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string kind, cooked, source;
+        RecordedHash entry;
+        if (std::getline(fields, kind, '\t') && std::getline(fields, cooked, '\t') && std::getline(fields, source, '\t') &&
+            fields >> entry.size >> entry.modified >> std::hex >> entry.hash)
+            recorded[VirtualFileSystem::normalize(source)] = entry;
+    }
+    return true;
+}
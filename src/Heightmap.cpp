@@ -0,0 +1,56 @@
+#include "Heightmap.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "stb_image.h"
+#include "VirtualFileSystem.h"
+
+static bool hasExtension(const std::string& path, const char* ext) {
+    size_t n = std::strlen(ext);
+    return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+}
+
+bool Heightmap::load(const std::string& path) {
+    if (hasExtension(path, ".raw") || hasExtension(path, ".r16")) {
+        VirtualFile file;
+        if (!file.open(path)) {
+            std::cout << "Failed to open raw heightmap: " << path << std::endl;
+            return false;
+        }
+
+        size_t count = file.getSize() / sizeof(unsigned short);
+        int side = (int)std::lround(std::sqrt((double)count));
+        if (side < 2 || (size_t)side * side != count) {
+            std::cout << "Raw heightmap is not a square 16-bit grid: " << path << std::endl;
+            return false;
+        }
+
+        width = height = side;
+        samples.resize(count);
+        std::memcpy(samples.data(), file.getData(), count * sizeof(unsigned short));
+
+        // stored little-endian, swap on big-endian hosts
+        const unsigned short probe = 1;
+        if (*(const unsigned char*)&probe == 0)
+            for (auto& s : samples)
+                s = (unsigned short)((s >> 8) | (s << 8));
+        return true;
+    }
+
+    VirtualFile file;
+    if (!file.open(path)) {
+        std::cout << "Failed to open heightmap: " << path << std::endl;
+        return false;
+    }
+
+    int channels;
+    unsigned short* data = stbi_load_16_from_memory(file.getData(), (int)file.getSize(), &width, &height, &channels, 1); // grayscale
+    if (!data) {
+        std::cout << "Failed to load heightmap: " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    samples.assign(data, data + (size_t)width * height);
+    stbi_image_free(data);
+    return true;
+}
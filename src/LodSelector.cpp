@@ -0,0 +1,71 @@
+#include "LodSelector.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include "Model.h"
+
+void LodSelector::setView(const glm::vec3& viewEye, float fovYRadians, float viewportHeight, float frameTime) {
+    eye = viewEye;
+    pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovYRadians * 0.5f));
+    deltaTime = frameTime;
+}
+
+// ------------------ Select ------------------
+void LodSelector::select(const Model& model, const glm::vec3& center, float scale, LodState& state) const {
+    int levels = model.getLodCount();
+
+    // distance to the nearest the model can get: its bounding sphere
+    float radius = glm::length(model.boundsMax - model.boundsMin) * 0.5f * scale;
+    float distance = std::max(glm::length(center - eye) - radius, 0.001f);
+    float pixelsPerError = scale * pixelsPerUnit / distance;
+
+    int current = std::min(state.level, levels - 1);
+    int level = 0;
+    for (int i = levels - 1; i > 0; i--) {
+        float pixels = model.getLodError(i) * pixelsPerError;
+        // staying at (or finer than) the current level only needs the limit itself
+        float limit = (i > current && current >= 0) ? maxPixelError * (1.0f - hysteresis) : maxPixelError;
+        if (pixels <= limit) {
+            level = i;
+            break;
+        }
+    }
+
+    if (state.level < 0 || fadeSeconds <= 0.0f) {
+        state = LodState();
+        state.level = level;
+        return;
+    }
+    if (level != state.level) {
+        // a switch mid-fade fades out whichever level was showing more
+        int from = (state.fadingFrom >= 0 && state.fade < 0.5f) ? state.fadingFrom : state.level;
+        state.level = level;
+        state.fadingFrom = (from != level) ? from : -1;
+        state.fade = (from != level) ? 0.0f : 1.0f;
+    }
+    if (state.fadingFrom >= 0) {
+        state.fade += deltaTime / fadeSeconds;
+        if (state.fade >= 1.0f) {
+            state.fade = 1.0f;
+            state.fadingFrom = -1;
+        }
+    }
+}
+
+// ------------------ Draw ------------------
+void LodSelector::draw(Model& model, unsigned int shaderID, const LodState& state) {
+    int level = std::max(state.level, 0);
+    if (state.fadingFrom < 0) {
+        model.Draw(shaderID, level);
+        return;
+    }
+
+    // lodFade 0 means not fading, so the first frame starts just past it
+    float fade = std::max(state.fade, 1.0f / 32.0f);
+    GLint fadeLocation = glGetUniformLocation(shaderID, "lodFade");
+    glUniform1f(fadeLocation, fade);
+    model.Draw(shaderID, level);
+    glUniform1f(fadeLocation, -fade);
+    model.Draw(shaderID, state.fadingFrom);
+    glUniform1f(fadeLocation, 0.0f);
+}
@@ -0,0 +1,125 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cout << "Failed to open file for mapping: " << path << std::endl;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        std::cout << "Cannot map empty file: " << path << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cout << "Failed to map file: " << path << std::endl;
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = (const unsigned char*)view;
+    size = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    data = nullptr;
+    size = 0;
+    fileHandle = mappingHandle = nullptr;
+}
+
+void MappedFile::release(size_t offset, size_t length) const {
+    // unlocking pages that were never locked drops them from the working set
+    if (data && offset < size)
+        VirtualUnlock((void*)(data + offset), std::min(length, size - offset));
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        std::cout << "Failed to open file for mapping: " << path << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        std::cout << "Cannot map empty file: " << path << std::endl;
+        ::close(file);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED) {
+        std::cout << "Failed to map file: " << path << std::endl;
+        ::close(file);
+        return false;
+    }
+    madvise(view, (size_t)info.st_size, MADV_RANDOM);
+
+    fd = file;
+    data = (const unsigned char*)view;
+    size = (size_t)info.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data)
+        munmap((void*)data, size);
+    if (fd >= 0)
+        ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+}
+
+void MappedFile::release(size_t offset, size_t length) const {
+    if (!data || offset >= size)
+        return;
+
+    // madvise needs page-aligned ranges, only drop pages fully inside the range
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = offset + std::min(length, size - offset);
+    size_t first = (offset + page - 1) / page * page;
+    size_t last = end / page * page;
+    if (last > first)
+        madvise((void*)(data + first), last - first, MADV_DONTNEED);
+}
+#endif
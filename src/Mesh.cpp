@@ -1,13 +1,24 @@
 #include "Mesh.h"
 #include <GL/glew.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 Mesh::Mesh(std::vector<Vertex> vertices,
            std::vector<unsigned int> indices,
-           std::vector<Texture> textures) 
+           std::vector<Texture> textures,
+           QuantizedVertices quantized,
+           std::vector<MeshLod> lods) 
 {
-    this->vertices = vertices;
-    this->indices = indices;
-    this->textures = textures;
+    this->vertices = std::move(vertices);
+    this->indices = std::move(indices);
+    this->textures = std::move(textures);
+    this->quantized = std::move(quantized);
+    if (!this->quantized.vertices.empty())
+        format = VertexFormat::Quantized;
+    this->lods = std::move(lods);
+    if (this->lods.empty())
+        this->lods.push_back({ 0, (uint32_t)this->indices.size(), 0.0f });
 
     setupMesh();
 }
@@ -20,16 +31,46 @@ void Mesh::setupMesh() {
 
     glBindVertexArray(VAO);
 
-    // Load vertex data
+    // Load index data, 16-bit when every vertex can be reached with it
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    if (vertices.size() <= 65536) {
+        std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        indexType = GL_UNSIGNED_SHORT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short),
+                     shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else {
+        indexType = GL_UNSIGNED_INT;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                     indices.data(), GL_STATIC_DRAW);
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (format == VertexFormat::Quantized) {
+        glBufferData(GL_ARRAY_BUFFER, quantized.vertices.size() * sizeof(QuantizedVertex),
+                     quantized.vertices.data(), GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, TexCoords));
+
+        glBindVertexArray(0);
+        // the GPU copy is all that is drawn from
+        quantized.vertices.clear();
+        quantized.vertices.shrink_to_fit();
+        return;
+    }
+
+    // Load vertex data
     glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
                  &vertices[0], GL_STATIC_DRAW);
 
-    // Load index data
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
-
     // Set vertex attribute pointers
     // Position
     glEnableVertexAttribArray(0);
@@ -48,7 +89,7 @@ void Mesh::setupMesh() {
     glBindVertexArray(0);
 }
 
-void Mesh::Draw(unsigned int shaderID) {
+void Mesh::Draw(unsigned int shaderID, int lod) {
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
 
@@ -67,9 +108,19 @@ void Mesh::Draw(unsigned int shaderID) {
         glBindTexture(GL_TEXTURE_2D, textures[i].id);
     }
 
+    // how the vertex shader reads this mesh's vertices, set every draw as meshes differ
+    bool isQuantized = (format == VertexFormat::Quantized);
+    glUniform1i(glGetUniformLocation(shaderID, "quantized"), isQuantized);
+    if (isQuantized) {
+        glUniform3fv(glGetUniformLocation(shaderID, "positionOffset"), 1, &quantized.positionOffset[0]);
+        glUniform3fv(glGetUniformLocation(shaderID, "positionScale"), 1, &quantized.positionScale[0]);
+    }
+
     // draw mesh
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
+    const MeshLod& level = lods[std::min((size_t)std::max(lod, 0), lods.size() - 1)];
+    size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+    glDrawElements(GL_TRIANGLES, (GLsizei)level.indexCount, indexType, (void*)(level.firstIndex * indexSize));
     glBindVertexArray(0);
 
     glActiveTexture(GL_TEXTURE0); // reset
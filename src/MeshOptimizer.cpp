@@ -0,0 +1,287 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "ContentHash.h"
+
+// FIFO cache simulation: a vertex is cached while fewer than CACHE_SIZE
+// misses came after its own. Stamps start past CACHE_SIZE so nothing is cached at first.
+struct VertexCache {
+    std::vector<unsigned int> stamps;
+    unsigned int time = MeshOptimizer::CACHE_SIZE + 1;
+
+    explicit VertexCache(size_t vertexCount) : stamps(vertexCount, 0) {}
+
+    // true on a miss
+    bool use(unsigned int vertex) {
+        if (time - stamps[vertex] <= MeshOptimizer::CACHE_SIZE)
+            return false;
+        stamps[vertex] = time++;
+        return true;
+    }
+
+    void flush() { time += MeshOptimizer::CACHE_SIZE + 1; }
+};
+
+// ------------------ Optimize ------------------
+void MeshOptimizer::optimize(MeshData& mesh, MeshOptimizerStats* before, MeshOptimizerStats* after) {
+    if (mesh.indices.empty() || mesh.indices.size() % 3 != 0)
+        return;
+
+    if (before)
+        *before = analyze(mesh.indices, mesh.vertices.size());
+
+    weld(mesh);
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeOverdraw(mesh.indices, mesh.vertices);
+    optimizeVertexFetch(mesh);
+
+    if (after)
+        *after = analyze(mesh.indices, mesh.vertices.size());
+}
+
+// ------------------ Weld ------------------
+struct VertexBitsHash {
+    size_t operator()(const Vertex& vertex) const {
+        // over the raw floats, like the file hashes
+        return (size_t)ContentHash::hashBytes((const unsigned char*)&vertex, sizeof(Vertex));
+    }
+};
+
+struct VertexBitsEqual {
+    bool operator()(const Vertex& a, const Vertex& b) const { return std::memcmp(&a, &b, sizeof(Vertex)) == 0; }
+};
+
+void MeshOptimizer::weld(MeshData& mesh) {
+    std::unordered_map<Vertex, unsigned int, VertexBitsHash, VertexBitsEqual> unique;
+    unique.reserve(mesh.vertices.size());
+
+    std::vector<unsigned int> remap(mesh.vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(mesh.vertices.size());
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        auto inserted = unique.emplace(mesh.vertices[i], (unsigned int)welded.size());
+        if (inserted.second)
+            welded.push_back(mesh.vertices[i]);
+        remap[i] = inserted.first->second;
+    }
+
+    size_t kept = 0;
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        unsigned int a = remap[mesh.indices[t]], b = remap[mesh.indices[t + 1]], c = remap[mesh.indices[t + 2]];
+        if (a == b || b == c || c == a)
+            continue;
+        mesh.indices[kept++] = a;
+        mesh.indices[kept++] = b;
+        mesh.indices[kept++] = c;
+    }
+    mesh.indices.resize(kept);
+    mesh.vertices = std::move(welded);
+}
+
+// ------------------ Vertex Cache ------------------
+void MeshOptimizer::optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // the triangles around each vertex, and how many of them are still to be emitted
+    std::vector<unsigned int> live(vertexCount, 0);
+    for (unsigned int index : indices)
+        live[index]++;
+    std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        firstTriangle[v + 1] = firstTriangle[v] + live[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[filled[indices[i]]++] = (unsigned int)(i / 3);
+
+    std::vector<unsigned int> stamps(vertexCount, 0);
+    unsigned int time = CACHE_SIZE + 1;
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> deadEnd;      // recently used vertices, to restart from
+    std::vector<unsigned int> candidates;
+    size_t scan = 0;                        // restart cursor for when deadEnd runs dry
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    long fanning = 0;
+    while (fanning >= 0) {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (unsigned int a = firstTriangle[fanning]; a < firstTriangle[fanning + 1]; a++) {
+            unsigned int triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+            emitted[triangle] = true;
+            for (int corner = 0; corner < 3; corner++) {
+                unsigned int vertex = indices[triangle * 3 + corner];
+                output.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                if (time - stamps[vertex] > CACHE_SIZE)
+                    stamps[vertex] = time++;
+            }
+        }
+
+        // next: the candidate that has been in the cache longest and will
+        // still be there after its own remaining triangles are emitted
+        fanning = -1;
+        int best = -1;
+        for (unsigned int vertex : candidates) {
+            if (live[vertex] == 0)
+                continue;
+            int priority = 0;
+            if (time - stamps[vertex] + 2 * live[vertex] <= CACHE_SIZE)
+                priority = (int)(time - stamps[vertex]);
+            if (priority > best) {
+                best = priority;
+                fanning = vertex;
+            }
+        }
+
+        // or a dead end: the most recent vertex with triangles left, else the next one in order
+        while (fanning < 0 && !deadEnd.empty()) {
+            unsigned int vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex] > 0)
+                fanning = vertex;
+        }
+        while (fanning < 0 && scan < vertexCount) {
+            if (live[scan] > 0)
+                fanning = (long)scan;
+            scan++;
+        }
+    }
+
+    indices = std::move(output);
+}
+
+// ------------------ Overdraw ------------------
+void MeshOptimizer::optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // hard boundaries: where the cache order jumped (a triangle with no cached vertex)
+    std::vector<size_t> hard;
+    VertexCache cache(vertices.size());
+    for (size_t t = 0; t < triangleCount; t++) {
+        int misses = 0;
+        for (int corner = 0; corner < 3; corner++)
+            misses += cache.use(indices[t * 3 + corner]);
+        if (t == 0 || misses == 3)
+            hard.push_back(t);
+    }
+    hard.push_back(triangleCount);
+
+    // soft boundaries inside each: wherever a cluster started there would
+    // cost at most threshold times the ACMR of the whole hard cluster
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++) {
+        size_t start = hard[h], end = hard[h + 1];
+
+        cache.flush();
+        size_t misses = 0;
+        for (size_t t = start; t < end; t++)
+            for (int corner = 0; corner < 3; corner++)
+                misses += cache.use(indices[t * 3 + corner]);
+        float limit = threshold * (float)misses / (float)(end - start);
+
+        clusters.push_back(start);
+        cache.flush();
+        size_t clusterStart = start, clusterMisses = 0;
+        for (size_t t = start; t < end; t++) {
+            for (int corner = 0; corner < 3; corner++)
+                clusterMisses += cache.use(indices[t * 3 + corner]);
+            if (t + 1 < end && (float)clusterMisses / (float)(t - clusterStart + 1) <= limit) {
+                clusters.push_back(t + 1);
+                clusterStart = t + 1;
+                clusterMisses = 0;
+                cache.flush();
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+    size_t clusterCount = clusters.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    // how far each cluster faces out from the middle of the mesh: clusters
+    // on the outside, facing away from it, are likely to hide the rest
+    glm::vec3 meshCenter(0.0f);
+    for (unsigned int index : indices)
+        meshCenter += vertices[index].Position;
+    meshCenter /= (float)indices.size();
+
+    std::vector<float> facing(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(cross);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        float normalLength = glm::length(normal);
+        facing[c] = (area > 0.0f && normalLength > 0.0f) ? glm::dot(center / area - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<size_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&facing](size_t a, size_t b) { return facing[a] > facing[b]; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    indices = std::move(sorted);
+}
+
+// ------------------ Vertex Fetch ------------------
+void MeshOptimizer::optimizeVertexFetch(MeshData& mesh) {
+    const unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(mesh.vertices.size(), unused);
+    std::vector<Vertex> ordered;
+    ordered.reserve(mesh.vertices.size());
+    for (unsigned int& index : mesh.indices) {
+        if (remap[index] == unused) {
+            remap[index] = (unsigned int)ordered.size();
+            ordered.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices = std::move(ordered);
+}
+
+// ------------------ Analyze ------------------
+MeshOptimizerStats MeshOptimizer::analyze(const std::vector<unsigned int>& indices, size_t vertexCount) {
+    MeshOptimizerStats stats;
+    if (indices.empty())
+        return stats;
+
+    VertexCache cache(vertexCount);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t misses = 0, used = 0;
+    for (unsigned int index : indices) {
+        misses += cache.use(index);
+        if (!referenced[index]) {
+            referenced[index] = true;
+            used++;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)(indices.size() / 3);
+    stats.atvr = (float)misses / (float)used;
+    return stats;
+}
@@ -0,0 +1,351 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include "ContentHash.h"
+
+namespace {
+
+const unsigned int NONE = ~0u;
+
+// What a vertex may do: manifold vertices collapse into anything, border and
+// seam vertices only into their own kind along their open edge, the rest stay
+enum VertexKind : unsigned char { Manifold, Border, Seam, Locked };
+
+const bool canCollapse[4][4] = {
+    { true, true, true, true },     // Manifold
+    { false, true, false, false },  // Border
+    { false, false, true, false },  // Seam
+    { false, false, false, false }, // Locked
+};
+
+// Weight of the planes that hold borders and seams in place, against the triangles'
+const double EDGE_WEIGHT = 10.0;
+
+// Least cosine between a triangle's normal before and after a collapse (75 degrees)
+const float MIN_FACING = 0.25f;
+
+// Sum of squared distances to planes, weighted by their triangles' area
+struct Quadric {
+    double a00 = 0.0, a11 = 0.0, a22 = 0.0, a10 = 0.0, a20 = 0.0, a21 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0, c = 0.0;
+    double weight = 0.0;
+
+    // n.p + d = 0, n unit length
+    void addPlane(const glm::dvec3& n, double d, double w) {
+        a00 += w * n.x * n.x; a11 += w * n.y * n.y; a22 += w * n.z * n.z;
+        a10 += w * n.y * n.x; a20 += w * n.z * n.x; a21 += w * n.z * n.y;
+        b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a11 += q.a11; a22 += q.a22; a10 += q.a10; a20 += q.a20; a21 += q.a21;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+        weight += q.weight;
+    }
+
+    // mean squared distance of p to the planes
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double r = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a10 * x * y + a20 * x * z + a21 * y * z) +
+                   2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return (weight > 0.0) ? std::fabs(r) / weight : 0.0;
+    }
+};
+
+// Outgoing edges of every vertex, a -> b for each corner a of a triangle
+struct EdgeAdjacency {
+    std::vector<unsigned int> first, targets;
+
+    void build(const std::vector<unsigned int>& indices, size_t vertexCount) {
+        first.assign(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+            first[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            first[v + 1] += first[v];
+        targets.resize(indices.size());
+        std::vector<unsigned int> filled(first.begin(), first.end() - 1);
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+            for (int e = 0; e < 3; e++)
+                targets[filled[indices[t + e]]++] = indices[t + (e + 1) % 3];
+    }
+
+    bool hasEdge(unsigned int a, unsigned int b) const {
+        for (unsigned int i = first[a]; i < first[a + 1]; i++)
+            if (targets[i] == b)
+                return true;
+        return false;
+    }
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const {
+        return (size_t)ContentHash::hashBytes((const unsigned char*)&p, sizeof(glm::vec3));
+    }
+};
+
+struct PositionEqual {
+    bool operator()(const glm::vec3& a, const glm::vec3& b) const { return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0; }
+};
+
+struct Collapse {
+    unsigned int from, to;
+    double error;
+};
+
+} // namespace
+
+// ------------------ Simplify ------------------
+float MeshSimplifier::simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                               size_t targetIndexCount, float targetError, std::vector<unsigned int>& result) {
+    result = indices;
+    const size_t vertexCount = vertices.size();
+    if (result.size() <= targetIndexCount || result.size() % 3 != 0)
+        return 0.0f;
+
+    // vertices at the same position (wedges: the sides of a UV or normal seam) move together;
+    // remap is the first of them, wedge a ring through all of them
+    std::vector<unsigned int> remap(vertexCount), wedge(vertexCount);
+    {
+        std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> firstAt;
+        firstAt.reserve(vertexCount);
+        for (unsigned int i = 0; i < vertexCount; i++) {
+            remap[i] = firstAt.emplace(vertices[i].Position, i).first->second;
+            wedge[i] = i;
+            if (remap[i] != i) {
+                wedge[i] = wedge[remap[i]];
+                wedge[remap[i]] = i;
+            }
+        }
+    }
+
+    // open edges have no twin running the other way; openOut / openInc are a
+    // vertex's one open edge out and in, NONE without one, the vertex itself with several
+    EdgeAdjacency adjacency;
+    adjacency.build(result, vertexCount);
+    std::vector<unsigned int> openOut(vertexCount, NONE), openInc(vertexCount, NONE);
+    for (unsigned int v = 0; v < vertexCount; v++) {
+        for (unsigned int e = adjacency.first[v]; e < adjacency.first[v + 1]; e++) {
+            unsigned int target = adjacency.targets[e];
+            if (adjacency.hasEdge(target, v))
+                continue;
+            openOut[v] = (openOut[v] == NONE) ? target : v;
+            openInc[target] = (openInc[target] == NONE) ? v : target;
+        }
+    }
+
+    std::vector<VertexKind> kind(vertexCount, Locked);
+    for (unsigned int v = 0; v < vertexCount; v++) {
+        unsigned int w = wedge[v];
+        if (w == v) {
+            if (openOut[v] == NONE && openInc[v] == NONE)
+                kind[v] = Manifold;
+            else if (openOut[v] != NONE && openOut[v] != v && openInc[v] != NONE && openInc[v] != v)
+                kind[v] = Border;
+        }
+        else if (wedge[w] == v) {
+            // a seam: each side has one open edge in and one out, mirroring the other side's
+            bool single = openOut[v] != NONE && openOut[v] != v && openInc[v] != NONE && openInc[v] != v &&
+                          openOut[w] != NONE && openOut[w] != w && openInc[w] != NONE && openInc[w] != w;
+            if (single && remap[openInc[v]] == remap[openOut[w]] && remap[openOut[v]] == remap[openInc[w]])
+                kind[v] = Seam;
+        }
+    }
+
+    // planes of the triangles around each position, and of the borders and
+    // seams (perpendicular to their triangle) so those resist moving sideways
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<glm::vec3> faceNormals(result.size() / 3); // as given, follows each triangle through the passes
+    glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+    for (size_t t = 0; t < result.size(); t += 3) {
+        glm::dvec3 p[3];
+        for (int j = 0; j < 3; j++) {
+            p[j] = glm::dvec3(vertices[result[t + j]].Position);
+            boundsMin = glm::min(boundsMin, vertices[result[t + j]].Position);
+            boundsMax = glm::max(boundsMax, vertices[result[t + j]].Position);
+        }
+        glm::dvec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        double length = glm::length(normal);
+        faceNormals[t / 3] = glm::vec3(normal);
+        if (length == 0.0)
+            continue;
+
+        glm::dvec3 n = normal / length;
+        for (int j = 0; j < 3; j++)
+            quadrics[remap[result[t + j]]].addPlane(n, -glm::dot(n, p[0]), length * 0.5);
+
+        for (int e = 0; e < 3; e++) {
+            unsigned int a = result[t + e], b = result[t + (e + 1) % 3];
+            if (adjacency.hasEdge(b, a))
+                continue;
+            glm::dvec3 edge = p[(e + 1) % 3] - p[e];
+            glm::dvec3 side = glm::cross(edge, normal);
+            double sideLength = glm::length(side);
+            if (sideLength == 0.0)
+                continue;
+            side /= sideLength;
+            double weight = glm::dot(edge, edge) * EDGE_WEIGHT;
+            quadrics[remap[a]].addPlane(side, -glm::dot(side, p[e]), weight);
+            quadrics[remap[b]].addPlane(side, -glm::dot(side, p[e]), weight);
+        }
+    }
+
+    double scale = std::max(boundsMax.x - boundsMin.x, std::max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+    if (scale <= 0.0)
+        return 0.0f;
+    const double errorLimit = (targetError * scale) * (targetError * scale);
+    const size_t targetTriangles = targetIndexCount / 3;
+
+    // the open edge from -> to goes away: its neighbours along the border now link to to
+    auto relink = [&](unsigned int from, unsigned int to) {
+        if (openOut[from] == to) {
+            unsigned int previous = openInc[from];
+            if (previous != NONE) {
+                openOut[previous] = to;
+                openInc[to] = previous;
+            }
+        }
+        else if (openInc[from] == to) {
+            unsigned int next = openOut[from];
+            if (next != NONE) {
+                openInc[next] = to;
+                openOut[to] = next;
+            }
+        }
+    };
+
+    std::vector<unsigned int> collapseRemap(vertexCount);
+    std::vector<char> touched(vertexCount);
+    std::vector<unsigned int> triangleFirst, triangleList;
+    std::vector<Collapse> collapses;
+    double worst = 0.0;
+
+    // passes of independent collapses, cheapest first, until the target count or error
+    while (result.size() > targetIndexCount) {
+        size_t triangleCount = result.size() / 3;
+
+        // triangles around each position, for the flip test
+        triangleFirst.assign(vertexCount + 1, 0);
+        for (unsigned int index : result)
+            triangleFirst[remap[index] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            triangleFirst[v + 1] += triangleFirst[v];
+        triangleList.resize(result.size());
+        {
+            std::vector<unsigned int> filled(triangleFirst.begin(), triangleFirst.end() - 1);
+            for (size_t i = 0; i < result.size(); i++)
+                triangleList[filled[remap[result[i]]]++] = (unsigned int)(i / 3);
+        }
+
+        // every edge, in whichever allowed direction costs less
+        collapses.clear();
+        for (size_t t = 0; t < result.size(); t += 3) {
+            for (int e = 0; e < 3; e++) {
+                unsigned int i0 = result[t + e], i1 = result[t + (e + 1) % 3];
+                unsigned int r0 = remap[i0], r1 = remap[i1];
+                if (r0 == r1)
+                    continue;
+                // interior edges show up once from each side
+                if (kind[i0] == Manifold && kind[i1] == Manifold && r0 > r1)
+                    continue;
+
+                bool forward = canCollapse[kind[i0]][kind[i1]] &&
+                               (kind[i0] == Manifold || openOut[i0] == i1 || openInc[i0] == i1);
+                bool backward = canCollapse[kind[i1]][kind[i0]] &&
+                                (kind[i1] == Manifold || openOut[i1] == i0 || openInc[i1] == i0);
+                if (!forward && !backward)
+                    continue;
+
+                Quadric merged = quadrics[r0];
+                merged.add(quadrics[r1]);
+                double forwardError = forward ? merged.error(vertices[i1].Position) : std::numeric_limits<double>::max();
+                double backwardError = backward ? merged.error(vertices[i0].Position) : std::numeric_limits<double>::max();
+                if (forwardError <= backwardError)
+                    collapses.push_back({ i0, i1, forwardError });
+                else
+                    collapses.push_back({ i1, i0, backwardError });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (unsigned int v = 0; v < vertexCount; v++)
+            collapseRemap[v] = v;
+        std::fill(touched.begin(), touched.end(), 0);
+
+        // a collapse that turns any remaining triangle around from over; against
+        // the triangle as it was given, as earlier collapses may have tilted it already
+        auto flips = [&](unsigned int from, unsigned int to) {
+            unsigned int r0 = remap[from], r1 = remap[to];
+            for (unsigned int k = triangleFirst[r0]; k < triangleFirst[r0 + 1]; k++) {
+                size_t t = (size_t)triangleList[k] * 3;
+                unsigned int c[3];
+                for (int j = 0; j < 3; j++)
+                    c[j] = remap[collapseRemap[result[t + j]]];
+                if (c[0] == r1 || c[1] == r1 || c[2] == r1)
+                    continue; // goes away
+
+                const glm::vec3& before = faceNormals[t / 3];
+                glm::vec3 p[3];
+                for (int j = 0; j < 3; j++)
+                    p[j] = (c[j] == r0) ? vertices[to].Position : vertices[c[j]].Position;
+                glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                // turned over, or standing on edge (a fin along a seam or border)
+                float beforeLength = glm::length(before), afterLength = glm::length(after);
+                if (beforeLength > 0.0f && glm::dot(before, after) <= MIN_FACING * beforeLength * afterLength)
+                    return true;
+            }
+            return false;
+        };
+
+        size_t applied = 0;
+        for (const Collapse& collapse : collapses) {
+            if (collapse.error > errorLimit || triangleCount <= targetTriangles)
+                break;
+            unsigned int r0 = remap[collapse.from], r1 = remap[collapse.to];
+            if (touched[r0] || touched[r1] || flips(collapse.from, collapse.to))
+                continue;
+
+            if (kind[collapse.from] == Seam) {
+                // the other side of the seam follows, onto the other side of to
+                unsigned int side = wedge[collapse.from];
+                unsigned int sideTo = (openOut[collapse.from] == collapse.to) ? openInc[side] : openOut[side];
+                if (sideTo == NONE || sideTo == collapse.to || remap[sideTo] != r1)
+                    continue;
+                collapseRemap[side] = sideTo;
+                relink(side, sideTo);
+            }
+            if (kind[collapse.from] != Manifold)
+                relink(collapse.from, collapse.to);
+            collapseRemap[collapse.from] = collapse.to;
+
+            quadrics[r1].add(quadrics[r0]);
+            touched[r0] = touched[r1] = 1;
+            triangleCount -= (kind[collapse.from] == Border) ? 1 : 2;
+            worst = std::max(worst, collapse.error);
+            applied++;
+        }
+        if (applied == 0)
+            break;
+
+        // apply, dropping the triangles that collapsed
+        size_t kept = 0;
+        for (size_t t = 0; t < result.size(); t += 3) {
+            unsigned int a = collapseRemap[result[t]], b = collapseRemap[result[t + 1]], c = collapseRemap[result[t + 2]];
+            if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+                continue;
+            faceNormals[kept / 3] = faceNormals[t / 3];
+            result[kept++] = a;
+            result[kept++] = b;
+            result[kept++] = c;
+        }
+        result.resize(kept);
+        faceNormals.resize(kept / 3);
+    }
+
+    return (float)(std::sqrt(worst) / scale);
+}
@@ -1,46 +1,332 @@
 #include "Model.h"
+#include <algorithm>
 #include <iostream>
-#include "stb_image.h"
+#include <memory>
+#include <assimp/MemoryIOWrapper.h>
+#include "AssetLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ModelCache.h"
+#include "TextureCache.h"
+#include "VertexQuantization.h"
+#include "VirtualFileSystem.h"
 
-unsigned int TextureFromFile(const char* path, const std::string &directory);
+std::string TexturePath(const std::string &path, const std::string &directory);
+
+// How every model is imported and simplified; part of the cache key
+static const ModelImportSettings IMPORT_SETTINGS = {
+    aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace,
+    { 0.01f, 0.03f, 0.08f }, // three levels below the full mesh, each within this share of its size
+    0.5f                     // of the triangles of the level before
+};
+
+// A file the importer reads, straight out of its mapping
+class VirtualIOStream : public Assimp::MemoryIOStream {
+public:
+    explicit VirtualIOStream(std::unique_ptr<VirtualFile> file)
+        : MemoryIOStream(file->getData(), file->getSize()), file(std::move(file)) {}
+
+private:
+    std::unique_ptr<VirtualFile> file;
+};
+
+// Reads the importer's files through the VirtualFileSystem, and remembers
+// every one it opens (the model, its .mtl, ...), so the cache can tell when
+// any of them changes
+class RecordingIOSystem : public Assimp::IOSystem {
+public:
+    std::vector<std::string> opened;
+
+    bool Exists(const char* file) const override {
+        return VirtualFileSystem::instance().exists(file);
+    }
+
+    char getOsSeparator() const override {
+        return '/';
+    }
+
+    Assimp::IOStream* Open(const char* file, const char* mode = "rb") override {
+        // read only, the importer never writes
+        if (mode[0] != 'r' || !Exists(file))
+            return nullptr;
+        auto mapped = std::make_unique<VirtualFile>();
+        if (!mapped->open(file))
+            return nullptr;
+
+        if (std::find(opened.begin(), opened.end(), file) == opened.end())
+            opened.push_back(file);
+        return new VirtualIOStream(std::move(mapped));
+    }
+
+    void Close(Assimp::IOStream* stream) override {
+        delete stream;
+    }
+};
 
 // ------------------ Constructor ------------------
-Model::Model(const std::string &path) {
+Model::Model(const std::string &path, VertexFormat format) : format(format) {
     loadModel(path);
+    upload();
+}
+
+Model::Model(const std::string &path, AssetLoader& loader, VertexFormat format) : format(format) {
+    loader.load([this, path] { loadModel(path); }, [this] { upload(); });
 }
 
 // ------------------ Public Draw ------------------
-void Model::Draw(unsigned int shaderID) {
+void Model::Draw(unsigned int shaderID, int lod) {
     for (auto &mesh : meshes) {
-        mesh.Draw(shaderID);
+        mesh.Draw(shaderID, lod);
     }
 }
 
+bool Model::cook(const std::string &path, std::vector<std::string> &texturePaths,
+                 std::vector<std::string> &sourcePaths, bool &rebuilt) {
+    Model model;
+    model.directory = path.substr(0, path.find_last_of('/'));
+    rebuilt = !model.loadCache(path);
+    if (rebuilt)
+        model.importModel(path);
+    for (const MeshData& mesh : model.imported)
+        for (const Texture& texture : mesh.textures)
+            texturePaths.push_back(TexturePath(texture.path, model.directory));
+    sourcePaths = model.sources;
+    return !model.imported.empty();
+}
+
 // ------------------ Load Model ------------------
 void Model::loadModel(const std::string &path) {
+    // Extract directory path for textures
+    this->directory = path.substr(0, path.find_last_of('/'));
+
+    // the cache (and an import) holds quantized vertices too, Float models draw without them
+    if (!loadCache(path))
+        importModel(path);
+    if (format == VertexFormat::Float)
+        for (MeshData& mesh : imported)
+            mesh.quantized = QuantizedVertices();
+
+    // decode every texture now too, still off the main thread
+    for (const MeshData& mesh : imported)
+        for (const Texture& texture : mesh.textures)
+            images.push_back(TextureCache::instance().decode(TexturePath(texture.path, this->directory)));
+}
+
+void Model::importModel(const std::string &path) {
     Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(path,
-        aiProcess_Triangulate | 
-        aiProcess_FlipUVs   | 
-        aiProcess_CalcTangentSpace);
+    RecordingIOSystem* io = new RecordingIOSystem(); // owned by the importer
+    importer.SetIOHandler(io);
+    const aiScene* scene = importer.ReadFile(path, IMPORT_SETTINGS.importFlags);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
         return;
     }
 
-    // Extract directory path for textures
-    this->directory = path.substr(0, path.find_last_of('/'));
-
     // Process root node recursively
     processNode(scene->mRootNode, scene);
+    mergeByMaterial(imported);
+
+    // welded and reordered for the vertex cache, overdraw and fetches; the cache keeps the result
+    for (size_t i = 0; i < imported.size(); i++) {
+        MeshOptimizerStats before, after;
+        size_t vertexCount = imported[i].vertices.size();
+        MeshOptimizer::optimize(imported[i], &before, &after);
+        std::cout << "Model: " << path << " mesh " << i << ": " << vertexCount << " -> " << imported[i].vertices.size()
+                  << " vertices, ACMR " << before.acmr << " -> " << after.acmr
+                  << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+
+        buildLods(imported[i]);
+        std::cout << "Model: " << path << " mesh " << i << " levels:";
+        for (const MeshLod& lod : imported[i].lods)
+            std::cout << " " << lod.indexCount / 3 << " triangles (error " << lod.error << ")";
+        std::cout << std::endl;
+    }
+
+    boundsMin = glm::vec3(1e30f);
+    boundsMax = glm::vec3(-1e30f);
+    for (const MeshData& mesh : imported) {
+        for (const Vertex& vertex : mesh.vertices) {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
+    }
+    if (imported.empty())
+        boundsMin = boundsMax = glm::vec3(0.0f);
+    quantizeMeshes(path);
+
+    sources = io->opened;
+    std::string cachePath = ModelCache::pathFor(path);
+    if (ModelCache::write(cachePath, IMPORT_SETTINGS, io->opened, imported, boundsMin, boundsMax))
+        std::cout << "Model: saved cache " << cachePath << std::endl;
+}
+
+// ------------------ Load Cache ------------------
+bool Model::loadCache(const std::string &path) {
+    ModelCache cache;
+    if (!cache.open(ModelCache::pathFor(path), IMPORT_SETTINGS))
+        return false;
+
+    const ModelCacheContents& contents = cache.getContents();
+    imported.resize(contents.meshCount);
+    for (size_t i = 0; i < contents.meshCount; i++) {
+        const ModelCacheMesh& record = contents.meshes[i];
+        const Vertex* vertices = contents.vertices + record.firstVertex;
+        const unsigned int* indices = contents.indices + record.firstIndex;
+        MeshData& mesh = imported[i];
+        mesh.vertices.assign(vertices, vertices + record.vertexCount);
+        if (record.quantizedCount > 0) {
+            const QuantizedVertex* quantized = contents.quantized + record.firstQuantized;
+            mesh.quantized.vertices.assign(quantized, quantized + record.quantizedCount);
+            mesh.quantized.positionOffset = record.positionOffset;
+            mesh.quantized.positionScale = record.positionScale;
+        }
+        mesh.indices.assign(indices, indices + record.indexCount);
+        mesh.lods.assign(contents.lods + record.firstLod, contents.lods + record.firstLod + record.lodCount);
+
+        for (uint32_t t = 0; t < record.textureCount; t++) {
+            const ModelCacheTexture& ref = contents.textures[record.firstTexture + t];
+            Texture texture;
+            texture.id = 0;
+            texture.path = cache.getString(ref.pathOffset, ref.pathLength);
+            texture.type = cache.getString(ref.typeOffset, ref.typeLength);
+            mesh.textures.push_back(texture);
+        }
+    }
+
+    for (size_t i = 0; i < contents.dependencyCount; i++)
+        sources.push_back(cache.getString(contents.dependencies[i].pathOffset, contents.dependencies[i].pathLength));
+
+    boundsMin = contents.boundsMin;
+    boundsMax = contents.boundsMax;
+    return true;
+}
+
+// ------------------ Quantize ------------------
+void Model::quantizeMeshes(const std::string &path) {
+    QuantizationError worst;
+    size_t floatBytes = 0, quantizedBytes = 0, unquantized = 0;
+    float extent = glm::length(boundsMax - boundsMin);
+    for (MeshData& mesh : imported) {
+        QuantizationError error;
+        floatBytes += mesh.vertices.size() * sizeof(Vertex);
+        if (!VertexQuantization::quantize(mesh.vertices, mesh.quantized, &error)) {
+            quantizedBytes += mesh.vertices.size() * sizeof(Vertex);
+            unquantized++;
+            continue;
+        }
+        quantizedBytes += mesh.quantized.vertices.size() * sizeof(QuantizedVertex);
+        worst.position = std::max(worst.position, error.position);
+        worst.normalDegrees = std::max(worst.normalDegrees, error.normalDegrees);
+        worst.texCoord = std::max(worst.texCoord, error.texCoord);
+    }
+
+    std::cout << "Model: " << path << " quantized " << imported.size() - unquantized << " of " << imported.size()
+              << " meshes, vertices " << floatBytes / 1024 << " -> " << quantizedBytes / 1024 << " KB, error max "
+              << worst.position << " (" << (extent > 0.0f ? 100.0f * worst.position / extent : 0.0f) << "% of the bounds), "
+              << worst.normalDegrees << " deg normals, " << worst.texCoord << " UV" << std::endl;
+}
+
+// ------------------ Upload ------------------
+void Model::upload() {
+    size_t image = 0;
+    meshes.reserve(meshes.size() + imported.size());
+    for (MeshData& mesh : imported) {
+        for (Texture& texture : mesh.textures) {
+            const std::shared_ptr<const TextureImage>& decoded = images[image++];
+            texture.handle = decoded ? TextureCache::instance().load(decoded) : nullptr;
+            texture.id = texture.handle ? texture.handle->id : 0;
+        }
+        meshes.push_back(Mesh(std::move(mesh.vertices), std::move(mesh.indices), std::move(mesh.textures),
+                              std::move(mesh.quantized), std::move(mesh.lods)));
+    }
+    imported.clear();
+    images.clear();
+}
+
+// ------------------ Levels Of Detail ------------------
+void Model::buildLods(MeshData& mesh) {
+    const size_t fullCount = mesh.indices.size();
+    mesh.lods.assign(1, { 0, (uint32_t)fullCount, 0.0f });
+    if (fullCount == 0 || fullCount % 3 != 0 || mesh.vertices.empty())
+        return;
+
+    glm::vec3 meshMin(1e30f), meshMax(-1e30f);
+    for (const Vertex& vertex : mesh.vertices) {
+        meshMin = glm::min(meshMin, vertex.Position);
+        meshMax = glm::max(meshMax, vertex.Position);
+    }
+    glm::vec3 extent = meshMax - meshMin;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+
+    // every level from the full mesh, so errors do not add up; all share its vertices
+    std::vector<unsigned int> full(mesh.indices.begin(), mesh.indices.end()), simplified;
+    for (float maxError : IMPORT_SETTINGS.lodErrors) {
+        if (maxError <= 0.0f)
+            break;
+        size_t previous = mesh.lods.back().indexCount;
+        size_t target = (size_t)(previous / 3 * IMPORT_SETTINGS.lodReduction) * 3;
+        float error = MeshSimplifier::simplify(mesh.vertices, full, target, maxError, simplified);
+
+        // a level barely coarser than the last is not worth its indices
+        if (simplified.size() > previous * 9 / 10)
+            break;
+        MeshOptimizer::optimizeVertexCache(simplified, mesh.vertices.size());
+        mesh.lods.push_back({ (uint32_t)mesh.indices.size(), (uint32_t)simplified.size(), error * size });
+        mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+    }
+}
+
+int Model::getLodCount() const {
+    size_t count = 1;
+    for (const Mesh& mesh : meshes)
+        count = std::max(count, mesh.lods.size());
+    return (int)count;
+}
+
+float Model::getLodError(int lod) const {
+    float error = 0.0f;
+    for (const Mesh& mesh : meshes)
+        error = std::max(error, mesh.lods[std::min((size_t)std::max(lod, 0), mesh.lods.size() - 1)].error);
+    return error;
+}
+
+// ------------------ Merge By Material ------------------
+void Model::mergeByMaterial(std::vector<MeshData>& meshes) {
+    // textures are all a mesh binds, so meshes with the same ones draw alike
+    auto sameMaterial = [](const MeshData& a, const MeshData& b) {
+        if (a.textures.size() != b.textures.size())
+            return false;
+        for (size_t t = 0; t < a.textures.size(); t++)
+            if (a.textures[t].type != b.textures[t].type || a.textures[t].path != b.textures[t].path)
+                return false;
+        return true;
+    };
+
+    std::vector<MeshData> merged;
+    for (MeshData& mesh : meshes) {
+        // point and line meshes stay on their own
+        auto into = std::find_if(merged.begin(), merged.end(), [&](const MeshData& m) {
+            return m.indices.size() % 3 == 0 && mesh.indices.size() % 3 == 0 && sameMaterial(m, mesh);
+        });
+        if (into == merged.end()) {
+            merged.push_back(std::move(mesh));
+            continue;
+        }
+
+        unsigned int base = (unsigned int)into->vertices.size();
+        into->vertices.insert(into->vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        for (unsigned int index : mesh.indices)
+            into->indices.push_back(base + index);
+    }
+    meshes = std::move(merged);
 }
 
 // ------------------ Process Node ------------------
 void Model::processNode(aiNode* node, const aiScene* scene) {
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene));
+        imported.push_back(processMesh(mesh, scene));
     }
 
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
@@ -49,7 +335,7 @@ void Model::processNode(aiNode* node, const aiScene* scene) {
 }
 
 // ------------------ Process Mesh ------------------
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
+MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene) {
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
@@ -86,7 +372,12 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
         textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
     }
 
-    return Mesh(vertices, indices, textures);
+    // by name, the members filled in later (quantized vertices, levels of detail) stay empty
+    MeshData data;
+    data.vertices = std::move(vertices);
+    data.indices = std::move(indices);
+    data.textures = std::move(textures);
+    return data;
 }
 
 // ------------------ Load Textures ------------------
@@ -108,7 +399,7 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType
         }
 
         Texture texture;
-        texture.id = TextureFromFile(texPath.c_str(), this->directory);
+        texture.id = 0;
         texture.type = typeName;
         texture.path = texPath; // use cleaned-up path
         textures.push_back(texture);
@@ -117,40 +408,13 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType
 }
 
 
-// ------------------ stb_image Loader ------------------
-unsigned int TextureFromFile(const char* path, const std::string &directory) {
-    std::string filename = std::string(path);
+// ------------------ Texture Path ------------------
+std::string TexturePath(const std::string &path, const std::string &directory) {
+    std::string filename = path;
 
     // If it's not an absolute path, prepend the model's directory
     if (!(filename.find(':') != std::string::npos || filename[0] == '/' || filename[0] == '\\')) {
         filename = directory + '/' + filename;
     }
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data) {
-        GLenum format = (nrComponents == 1) ? GL_RED :
-                        (nrComponents == 3) ? GL_RGB :
-                        GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    } else {
-        std::cout << "Texture failed to load at path: " << filename << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return filename;
 }
-
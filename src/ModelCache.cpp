@@ -0,0 +1,235 @@
+#include "ModelCache.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "ContentHash.h"
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+// ------------------ Writing ------------------
+bool ModelCache::write(const std::string& path, const ModelImportSettings& settings, const std::vector<std::string>& dependencies,
+                       const std::vector<MeshData>& meshes, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+    std::string strings;
+    auto addString = [&](const std::string& s, uint32_t& offset, uint32_t& length) {
+        offset = (uint32_t)strings.size();
+        length = (uint32_t)s.size();
+        strings += s;
+    };
+
+    std::vector<ModelCacheDependency> depends(dependencies.size());
+    for (size_t i = 0; i < dependencies.size(); i++) {
+        if (!VirtualFileSystem::instance().fileSize(dependencies[i], depends[i].size) ||
+            !ContentHash::hashFile(dependencies[i], depends[i].hash))
+            return false;
+        addString(dependencies[i], depends[i].pathOffset, depends[i].pathLength);
+    }
+
+    // every mesh's arrays back to back
+    std::vector<ModelCacheMesh> meshRecords(meshes.size());
+    std::vector<ModelCacheTexture> textures;
+    std::vector<MeshLod> lods;
+    std::vector<Vertex> vertices;
+    std::vector<QuantizedVertex> quantized;
+    std::vector<unsigned int> indices;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const MeshData& mesh = meshes[i];
+        ModelCacheMesh& record = meshRecords[i];
+        record.firstVertex = (uint32_t)vertices.size();
+        record.vertexCount = (uint32_t)mesh.vertices.size();
+        record.firstQuantized = (uint32_t)quantized.size();
+        record.quantizedCount = (uint32_t)mesh.quantized.vertices.size();
+        record.positionOffset = mesh.quantized.positionOffset;
+        record.positionScale = mesh.quantized.positionScale;
+        record.firstIndex = (uint32_t)indices.size();
+        record.indexCount = (uint32_t)mesh.indices.size();
+        record.firstTexture = (uint32_t)textures.size();
+        record.textureCount = (uint32_t)mesh.textures.size();
+        record.firstLod = (uint32_t)lods.size();
+        if (mesh.lods.empty())
+            lods.push_back({ 0, (uint32_t)mesh.indices.size(), 0.0f });
+        else
+            lods.insert(lods.end(), mesh.lods.begin(), mesh.lods.end());
+        record.lodCount = (uint32_t)lods.size() - record.firstLod;
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        quantized.insert(quantized.end(), mesh.quantized.vertices.begin(), mesh.quantized.vertices.end());
+        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+        for (const Texture& texture : mesh.textures) {
+            ModelCacheTexture ref;
+            addString(texture.type, ref.typeOffset, ref.typeLength);
+            addString(texture.path, ref.pathOffset, ref.pathLength);
+            textures.push_back(ref);
+        }
+    }
+
+    ModelCacheHeader header = {};
+    std::memcpy(header.magic, "MDC1", 4);
+    header.version = VERSION;
+    header.settings = settings;
+    header.vertexStride = sizeof(Vertex);
+    header.quantizedStride = sizeof(QuantizedVertex);
+    header.boundsMin = boundsMin;
+    header.boundsMax = boundsMax;
+
+    // lay the sections out back to back
+    struct Section {
+        uint64_t* offset;
+        const void* data;
+        size_t bytes;
+    };
+    header.dependencyCount = depends.size();
+    header.meshCount = meshRecords.size();
+    header.textureCount = textures.size();
+    header.stringCount = strings.size();
+    header.vertexCount = vertices.size();
+    header.quantizedCount = quantized.size();
+    header.indexCount = indices.size();
+    header.lodCount = lods.size();
+    const Section sections[] = {
+        { &header.dependencyOffset, depends.data(), depends.size() * sizeof(ModelCacheDependency) },
+        { &header.meshOffset, meshRecords.data(), meshRecords.size() * sizeof(ModelCacheMesh) },
+        { &header.textureOffset, textures.data(), textures.size() * sizeof(ModelCacheTexture) },
+        { &header.stringOffset, strings.data(), strings.size() },
+        { &header.vertexOffset, vertices.data(), vertices.size() * sizeof(Vertex) },
+        { &header.quantizedOffset, quantized.data(), quantized.size() * sizeof(QuantizedVertex) },
+        { &header.indexOffset, indices.data(), indices.size() * sizeof(unsigned int) },
+        { &header.lodOffset, lods.data(), lods.size() * sizeof(MeshLod) },
+    };
+
+    uint64_t offset = alignSection(sizeof(ModelCacheHeader));
+    for (const Section& section : sections) {
+        *section.offset = offset;
+        offset = alignSection(offset + section.bytes);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to create model cache: " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+
+    const char padding[16] = {};
+    uint64_t written = sizeof(header);
+    for (const Section& section : sections) {
+        out.write(padding, (std::streamsize)(*section.offset - written));
+        out.write((const char*)section.data, (std::streamsize)section.bytes);
+        written = *section.offset + section.bytes;
+    }
+
+    if (!out) {
+        std::cout << "Failed to write model cache: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ------------------ Reading ------------------
+bool ModelCache::open(const std::string& path, const ModelImportSettings& settings) {
+    // no cache yet is the normal cold start, not an error
+    if (!VirtualFileSystem::instance().exists(path))
+        return false;
+    if (!file.open(path))
+        return false;
+
+    if (file.getSize() < sizeof(ModelCacheHeader)) {
+        std::cout << "Model cache is truncated: " << path << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, "MDC1", 4) != 0 || header.version != VERSION ||
+        std::memcmp(&header.settings, &settings, sizeof(settings)) != 0 || header.vertexStride != sizeof(Vertex) ||
+        header.quantizedStride != sizeof(QuantizedVertex)) {
+        close();
+        return false;
+    }
+
+    // every section has to lie inside the file
+    const unsigned char* base = file.getData();
+    auto section = [&](uint64_t offset, uint64_t count, size_t stride) -> const void* {
+        if (offset > file.getSize() || count > (file.getSize() - offset) / stride)
+            return nullptr;
+        return base + offset;
+    };
+
+    contents.dependencies = (const ModelCacheDependency*)section(header.dependencyOffset, header.dependencyCount, sizeof(ModelCacheDependency));
+    contents.meshes = (const ModelCacheMesh*)section(header.meshOffset, header.meshCount, sizeof(ModelCacheMesh));
+    contents.textures = (const ModelCacheTexture*)section(header.textureOffset, header.textureCount, sizeof(ModelCacheTexture));
+    contents.strings = (const char*)section(header.stringOffset, header.stringCount, 1);
+    contents.vertices = (const Vertex*)section(header.vertexOffset, header.vertexCount, sizeof(Vertex));
+    contents.quantized = (const QuantizedVertex*)section(header.quantizedOffset, header.quantizedCount, sizeof(QuantizedVertex));
+    contents.indices = (const unsigned int*)section(header.indexOffset, header.indexCount, sizeof(unsigned int));
+    contents.lods = (const MeshLod*)section(header.lodOffset, header.lodCount, sizeof(MeshLod));
+    if (!contents.dependencies || !contents.meshes || !contents.textures || !contents.strings ||
+        !contents.vertices || !contents.quantized || !contents.indices || !contents.lods) {
+        std::cout << "Model cache is truncated: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    contents.dependencyCount = (size_t)header.dependencyCount;
+    contents.meshCount = (size_t)header.meshCount;
+    contents.textureCount = (size_t)header.textureCount;
+    contents.stringCount = (size_t)header.stringCount;
+    contents.vertexCount = (size_t)header.vertexCount;
+    contents.quantizedCount = (size_t)header.quantizedCount;
+    contents.indexCount = (size_t)header.indexCount;
+    contents.lodCount = (size_t)header.lodCount;
+    contents.boundsMin = header.boundsMin;
+    contents.boundsMax = header.boundsMax;
+
+    // ranges that point outside their sections mean a damaged file
+    auto inside = [](uint64_t first, uint64_t count, size_t total) { return first <= total && count <= total - first; };
+    bool valid = true;
+    for (size_t i = 0; i < contents.dependencyCount; i++) {
+        const ModelCacheDependency& d = contents.dependencies[i];
+        valid = valid && inside(d.pathOffset, d.pathLength, contents.stringCount);
+    }
+    for (size_t i = 0; i < contents.meshCount; i++) {
+        const ModelCacheMesh& m = contents.meshes[i];
+        valid = valid && inside(m.firstVertex, m.vertexCount, contents.vertexCount) &&
+                inside(m.firstQuantized, m.quantizedCount, contents.quantizedCount) &&
+                (m.quantizedCount == 0 || m.quantizedCount == m.vertexCount) &&
+                inside(m.firstIndex, m.indexCount, contents.indexCount) &&
+                inside(m.firstTexture, m.textureCount, contents.textureCount) &&
+                inside(m.firstLod, m.lodCount, contents.lodCount) && m.lodCount > 0;
+        for (uint32_t l = 0; valid && l < m.lodCount; l++) {
+            const MeshLod& lod = contents.lods[m.firstLod + l];
+            valid = inside(lod.firstIndex, lod.indexCount, m.indexCount);
+        }
+    }
+    for (size_t i = 0; i < contents.textureCount; i++) {
+        const ModelCacheTexture& t = contents.textures[i];
+        valid = valid && inside(t.typeOffset, t.typeLength, contents.stringCount) &&
+                inside(t.pathOffset, t.pathLength, contents.stringCount);
+    }
+    if (!valid) {
+        std::cout << "Model cache is damaged: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    if (!dependenciesUnchanged()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ModelCache::dependenciesUnchanged() const {
+    for (size_t i = 0; i < contents.dependencyCount; i++) {
+        const ModelCacheDependency& d = contents.dependencies[i];
+        std::string path = getString(d.pathOffset, d.pathLength);
+
+        // a size check first, most edits change it and it needs no read; a source assetcook
+        // hashed and that is unchanged since is not read either (see ContentHash::loadManifest)
+        uint64_t size = 0, hash = 0;
+        if (!VirtualFileSystem::instance().fileSize(path, size) || size != d.size ||
+            !ContentHash::hashFile(path, hash) || hash != d.hash)
+            return false;
+    }
+    return true;
+}
@@ -1,37 +1,19 @@
 #include "Shader.h"
 #include <GL/glew.h> 
 #include <glm/gtc/type_ptr.hpp>
+#include "VirtualFileSystem.h"
 
 Shader::Shader(const char* vertexPath, const char* fragmentPath) {
-    // 1. Retrieve the vertex/fragment source code from file paths
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-
-    // Ensure ifstream objects can throw exceptions
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-    try {
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-
-        std::stringstream vShaderStream, fShaderStream;
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-
-        vShaderFile.close();
-        fShaderFile.close();
-
-        vertexCode = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
-    } catch (std::ifstream::failure& e) {
+    // 1. Map the vertex/fragment source code (from the asset pack when one is mounted);
+    // GL takes it with its length straight from the mapping
+    VirtualFile vShaderFile, fShaderFile;
+    if (!vShaderFile.open(vertexPath) || !fShaderFile.open(fragmentPath))
         std::cerr << "ERROR::SHADER::FILE_NOT_READ" << std::endl;
-    }
 
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
+    const char* vShaderCode = vShaderFile.isOpen() ? (const char*)vShaderFile.getData() : "";
+    const char* fShaderCode = fShaderFile.isOpen() ? (const char*)fShaderFile.getData() : "";
+    GLint vShaderLength = (GLint)vShaderFile.getSize();
+    GLint fShaderLength = (GLint)fShaderFile.getSize();
 
     // 2. Compile shaders
     unsigned int vertex, fragment;
@@ -40,7 +22,7 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 
     // Vertex shader
     vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
+    glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
     glCompileShader(vertex);
     glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -50,7 +32,7 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
 
     // Fragment shader
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
+    glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
     glCompileShader(fragment);
     glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -94,6 +76,10 @@ void Shader::setFloat(const std::string &name, float value) const {
     glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
 }
 
+void Shader::setVec2(const std::string &name, const glm::vec2 &value) const {
+    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+}
+
 void Shader::setVec3(const std::string &name, const glm::vec3 &value) const {
     glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 }
@@ -0,0 +1,972 @@
+#include "Terrain.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include "ContentHash.h"
+#include "Heightmap.h"
+#include "TerrainBuilder.h"
+#include "TerrainCache.h"
+#include "TerrainQuery.h"
+#include "TerrainSimplifier.h"
+#include "TerrainStreamer.h"
+#include "TerrainTileFile.h"
+
+// Level 0 patches are used up to this many patch widths from the camera,
+// every coarser level doubles the distance
+static const float LOD0_RANGE_IN_PATCHES = 2.0f;
+
+// Fraction of a level's distance band after which its odd vertices start morphing
+static const float MORPH_START_RATIO = 0.66f;
+
+// Size of the morphRanges[] uniform array in terrain_gpu.vs
+static const int MAX_SHADER_LEVELS = 16;
+
+static bool intersectsSphere(const glm::vec3& minP, const glm::vec3& maxP,
+                             const glm::vec3& center, float radius) {
+    glm::vec3 closest = glm::clamp(center, minP, maxP);
+    glm::vec3 d = closest - center;
+    return glm::dot(d, d) <= radius * radius;
+}
+
+// ------------------ Constructor ------------------
+Terrain::Terrain(const std::string& heightmapPath, float scaleXZ, float heightScale, TerrainMode mode, float maxError,
+                 const std::string& cachePath)
+    : mode(mode), scaleXZ(scaleXZ), heightScale(heightScale), heightOffset(-heightScale * 0.5f), maxError(maxError) {
+    // streamed terrain never holds the whole heightmap, only its tile file
+    Heightmap source;
+    const unsigned short* samples = nullptr;
+
+    // a cache built from the same heightmap bytes and parameters replaces all decoding and generation
+    TerrainCache cache;
+    TerrainCacheKey cacheKey = {};
+    bool useCache = !cachePath.empty() && mode != TerrainMode::Streamed;
+    bool cached = false;
+    if (useCache) {
+        cacheKey.mode = (uint32_t)mode;
+        cacheKey.patchSize = PATCH_SIZE;
+        cacheKey.scaleXZ = scaleXZ;
+        cacheKey.heightScale = heightScale;
+        cacheKey.maxError = (mode == TerrainMode::Simplified) ? maxError : 0.0f;
+        if (!ContentHash::hashFile(heightmapPath, cacheKey.sourceHash))
+            return;
+        cached = cache.open(cachePath, cacheKey);
+    }
+
+    if (mode == TerrainMode::Streamed) {
+        if (!openTiles(heightmapPath))
+            return;
+    }
+    else if (cached) {
+        imgWidth = (int)cache.getHeader().width;
+        imgHeight = (int)cache.getHeader().height;
+        samples = cache.getContents().samples;
+    }
+    else {
+        if (!source.load(heightmapPath))
+            return;
+
+        imgWidth = source.width;
+        imgHeight = source.height;
+        samples = source.samples.data();
+        heights.resize((size_t)imgWidth * imgHeight);
+        TerrainBuilder::scaleHeights(samples, heights.size(), heightScale / 65535.0f, heightOffset, heights.data());
+    }
+
+    origin = glm::vec2(-imgWidth / 2.0f, -imgHeight / 2.0f) * scaleXZ;
+
+    buildLevels();
+    if (levelCount > MAX_SHADER_LEVELS) {
+        std::cout << "Terrain: heightmap needs " << levelCount << " LOD levels, shaders support "
+                  << MAX_SHADER_LEVELS << std::endl;
+        return;
+    }
+
+    if (tileFile)
+        heightQuery = std::make_unique<TerrainQuery>(*tileFile);
+    else
+        heightQuery = std::make_unique<TerrainQuery>(samples, imgWidth, imgHeight, gridSize);
+    heightQuery->setTransform(origin, scaleXZ, heightScale, heightOffset);
+
+    const char* modeName = "baked grid";
+    if (mode == TerrainMode::Streamed) {
+        // by value: make_unique forwards references, which would need STREAM_TILE_SLOTS defined out of class
+        streamer = std::make_unique<TerrainStreamer>(*tileFile, (int)STREAM_TILE_SLOTS);
+        if (!streamer->isReady())
+            return;
+        buildPatchMesh();
+        modeName = "streamed tiles";
+    }
+    else if (cached) {
+        loadCache(cache);
+        if (mode == TerrainMode::GpuDisplacement) {
+            uploadHeightTexture(samples);
+            buildPatchMesh();
+        }
+    }
+    else {
+        buildQuadtree();
+
+        std::vector<unsigned short> slopes((size_t)imgWidth * imgHeight * 2);
+        TerrainBuilder::buildNormalMap(samples, imgWidth, imgHeight, slopes.data());
+        uploadNormalMap(slopes.data());
+
+        std::vector<TerrainVertex> vertices;
+        std::vector<unsigned short> indices;
+        if (mode == TerrainMode::GpuDisplacement) {
+            uploadHeightTexture(samples);
+            buildPatchMesh();
+        }
+        else {
+            buildMesh(vertices, indices);
+            uploadMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+        }
+        if (useCache)
+            writeCache(cachePath, cacheKey, samples, slopes, vertices, indices);
+    }
+
+    if (mode == TerrainMode::GpuDisplacement)
+        modeName = "GPU displacement";
+    else if (mode == TerrainMode::Simplified)
+        modeName = "simplified";
+    loaded = true;
+
+    std::cout << "Terrain: " << imgWidth << "x" << imgHeight << " heightmap, "
+              << levelCount << " LOD levels, patch " << PATCH_SIZE << "x" << PATCH_SIZE
+              << ", " << modeName << (cached ? ", loaded from " + cachePath : std::string()) << std::endl;
+}
+
+Terrain::~Terrain() {
+    // zero names (buffers a mode never made) are ignored; the streamer frees its own arrays
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteTextures(1, &heightTexture);
+    glDeleteTextures(1, &normalTexture);
+}
+
+const char* Terrain::vertexShaderPath() const {
+    if (mode == TerrainMode::Streamed)
+        return "shaders/terrain_stream.vs";
+    return mode == TerrainMode::GpuDisplacement ? "shaders/terrain_gpu.vs" : "shaders/terrain.vs";
+}
+
+bool Terrain::openTiles(const std::string& path) {
+    tileFile = std::make_unique<TerrainTileFile>();
+    if (!tileFile->open(path))
+        return false;
+
+    const TerrainTileHeader& header = tileFile->getHeader();
+    if ((int)header.patchSize != PATCH_SIZE) {
+        std::cout << "Terrain: " << path << " was built for " << header.patchSize
+                  << " quad patches, expected " << PATCH_SIZE << std::endl;
+        return false;
+    }
+
+    imgWidth = (int)header.width;
+    imgHeight = (int)header.height;
+    return true;
+}
+
+// ------------------ Height Helpers ------------------
+float Terrain::sampleHeight(int x, int z) const {
+    x = std::max(0, std::min(x, imgWidth - 1));
+    z = std::max(0, std::min(z, imgHeight - 1));
+    return heights[(size_t)z * imgWidth + x];
+}
+
+TerrainGrid Terrain::grid() const {
+    return { heights.data(), imgWidth, imgHeight, gridSize + 1, origin, scaleXZ, heightScale, heightOffset };
+}
+
+// ------------------ Quadtree ------------------
+void Terrain::buildLevels() {
+    // grid is the next power of two that covers the heightmap, edges are clamped
+    gridSize = PATCH_SIZE;
+    while (gridSize < std::max(imgWidth, imgHeight) - 1)
+        gridSize *= 2;
+
+    levelCount = 1;
+    while ((PATCH_SIZE << levelCount) <= gridSize)
+        levelCount++;
+
+    vertexLayouts = TerrainBuilder::vertexLayouts(gridSize, levelCount, PATCH_SIZE, VERTEX_BLOCK_SIZE);
+
+    // distance bands, the top level covers everything
+    lodRanges.resize(levelCount);
+    float range = LOD0_RANGE_IN_PATCHES * PATCH_SIZE * scaleXZ;
+    for (int level = 0; level < levelCount; level++) {
+        lodRanges[level] = range;
+        range *= 2.0f;
+    }
+}
+
+void Terrain::buildQuadtree() {
+    // min/max height per node, leaves first
+    nodeHeights.assign(levelCount, std::vector<glm::vec2>());
+    for (int level = 0; level < levelCount; level++) {
+        int count = gridSize / (PATCH_SIZE << level);
+        nodeHeights[level].resize((size_t)count * count);
+
+        // leaves scan every vertex, so split node rows across cores
+        TerrainBuilder::parallelRows(count, [&, level, count](int rowBegin, int rowEnd) {
+            for (int nz = rowBegin; nz < rowEnd; nz++)
+                for (int nx = 0; nx < count; nx++)
+                    updateNode(level, nx, nz);
+        });
+    }
+}
+
+void Terrain::updateNode(int level, int nx, int nz) {
+    int nodeSize = PATCH_SIZE << level;
+    int count = gridSize / nodeSize;
+    glm::vec2 minMax(1e30f, -1e30f);
+
+    if (level == 0) {
+        for (int z = nz * nodeSize; z <= (nz + 1) * nodeSize; z++) {
+            for (int x = nx * nodeSize; x <= (nx + 1) * nodeSize; x++) {
+                float h = sampleHeight(x, z);
+                minMax.x = std::min(minMax.x, h);
+                minMax.y = std::max(minMax.y, h);
+            }
+        }
+    }
+    else {
+        const std::vector<glm::vec2>& children = nodeHeights[level - 1];
+        int childCount = count * 2;
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < 2; i++) {
+                const glm::vec2& c = children[(size_t)(nz * 2 + j) * childCount + (nx * 2 + i)];
+                minMax.x = std::min(minMax.x, c.x);
+                minMax.y = std::max(minMax.y, c.y);
+            }
+        }
+    }
+
+    nodeHeights[level][(size_t)nz * count + nx] = minMax;
+}
+
+// ------------------ Mesh ------------------
+void Terrain::buildMesh(std::vector<TerrainVertex>& vertices, std::vector<unsigned short>& indices) {
+    size_t vertexCount = 0;
+    for (const auto& layout : vertexLayouts)
+        vertexCount = std::max(vertexCount, layout.firstVertex + layout.vertexCount());
+    vertices.resize(vertexCount);
+    TerrainBuilder::buildVertices(grid(), levelCount, vertexLayouts, vertices.data());
+
+    if (mode == TerrainMode::Simplified) {
+        buildSimplifiedIndices(indices);
+        return;
+    }
+
+    // One full and one half-size patch strip per block row pitch and vertex stride in
+    // the block; levels with the same pair share them. Indices are relative to the
+    // patch's first vertex, which is passed as the base vertex when drawing.
+    const size_t fullCount = TerrainBuilder::patchStripLength(PATCH_SIZE);
+    const size_t halfCount = TerrainBuilder::patchStripLength(PATCH_SIZE / 2);
+    patchIndexOffset.resize(levelCount);
+    for (int level = 0; level < levelCount; level++) {
+        const TerrainVertexLayout& layout = vertexLayouts[level];
+        int stride = (1 << level) / layout.stride;
+        if (level > 0 && layout.blockVerts == vertexLayouts[level - 1].blockVerts &&
+            stride == (1 << (level - 1)) / vertexLayouts[level - 1].stride) {
+            patchIndexOffset[level] = patchIndexOffset[level - 1];
+            continue;
+        }
+
+        patchIndexOffset[level] = (unsigned int)indices.size();
+        indices.resize(indices.size() + fullCount + halfCount);
+        unsigned short* dst = indices.data() + patchIndexOffset[level];
+        TerrainBuilder::buildPatchStrip(layout.blockVerts, stride, PATCH_SIZE, dst);
+        TerrainBuilder::buildPatchStrip(layout.blockVerts, stride, PATCH_SIZE / 2, dst + fullCount);
+    }
+
+    // against what patches used to be: per level, a full and a half patch as 32-bit triangle lists
+    const TerrainVertexLayout& blocks = vertexLayouts[0];
+    std::vector<unsigned short> list((size_t)PATCH_SIZE * PATCH_SIZE * 6);
+    TerrainBuilder::buildPatchList(blocks.blockVerts, 1, PATCH_SIZE, list.data()); // level 0, every block vertex
+    TerrainVertexCacheStats before = TerrainBuilder::measureVertexCache(list.data(), list.size(), false);
+    TerrainVertexCacheStats after = TerrainBuilder::measureVertexCache(indices.data(), fullCount, true);
+    size_t listBytes = (size_t)levelCount * (list.size() + list.size() / 4) * sizeof(unsigned int);
+    std::cout << "Terrain: patch indices " << listBytes / 1024 << " KB of triangle lists -> "
+              << indices.size() * sizeof(unsigned short) / 1024 << " KB of strips, ACMR "
+              << before.acmr() << " -> " << after.acmr() << ", vertex cache hit rate "
+              << before.hitRate() * 100.0f << "% -> " << after.hitRate() * 100.0f << "%" << std::endl;
+}
+
+void Terrain::uploadMesh(const TerrainVertex* vertices, size_t vertexCount, const unsigned short* indices, size_t indexCount) {
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(TerrainVertex), vertices, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned short), indices, GL_STATIC_DRAW);
+
+    // height + morph target height, unorm16
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(TerrainVertex), (void*)0);
+
+    glBindVertexArray(0);
+}
+
+void Terrain::buildSimplifiedIndices(std::vector<unsigned short>& indices) {
+    const int gridVerts = gridSize + 1;
+
+    // chunks are the vertex blocks, so no triangle may be larger than one
+    const TerrainVertexLayout& blocks = vertexLayouts[0];
+    const int chunkSize = blocks.blockSpan();
+
+    TerrainSimplifier simplifier(grid());
+    std::vector<unsigned int> triangles;
+    simplifier.simplify(maxError, triangles, chunkSize);
+
+    TerrainSimplifyStats stats = simplifier.measure(triangles);
+    std::cout << "Terrain: simplified to " << stats.triangles << " of " << stats.fullTriangles
+              << " triangles, " << stats.vertices << " vertices, error max " << stats.maxError
+              << " / mean " << stats.meanError << " / rms " << stats.rmsError
+              << " (bound " << maxError << ")" << std::endl;
+
+    // bucket triangles by the chunk holding their centroid, so chunks can be culled
+    chunksPerEdge = blocks.blocksPerEdge;
+    chunks.assign((size_t)chunksPerEdge * chunksPerEdge, { 0, 0, glm::vec3(1e30f), glm::vec3(-1e30f) });
+
+    auto chunkOf = [&](size_t t) {
+        int sx = 0, sz = 0;
+        for (int k = 0; k < 3; k++) {
+            sx += (int)(triangles[t + k] % gridVerts);
+            sz += (int)(triangles[t + k] / gridVerts);
+        }
+        int cx = std::min(sx / 3 / chunkSize, chunksPerEdge - 1);
+        int cz = std::min(sz / 3 / chunkSize, chunksPerEdge - 1);
+        return cz * chunksPerEdge + cx;
+    };
+
+    for (size_t t = 0; t < triangles.size(); t += 3)
+        chunks[chunkOf(t)].indexCount += 3;
+
+    unsigned int offset = 0;
+    for (auto& chunk : chunks) {
+        chunk.firstIndex = offset;
+        offset += chunk.indexCount;
+        chunk.indexCount = 0;
+    }
+
+    // 16-bit indices into the chunk's own vertex block (and, to compare, the same list as 32-bit grid indices)
+    indices.resize(triangles.size());
+    std::vector<unsigned int> gridIndices(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        int c = chunkOf(t);
+        int chunkX = (c % chunksPerEdge) * chunkSize, chunkZ = (c / chunksPerEdge) * chunkSize;
+        TerrainChunk& chunk = chunks[c];
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = triangles[t + k];
+            int x = (int)(v % gridVerts);
+            int z = (int)(v / gridVerts);
+            glm::vec3 p(origin.x + x * scaleXZ, sampleHeight(x, z), origin.y + z * scaleXZ);
+            chunk.minP = glm::min(chunk.minP, p);
+            chunk.maxP = glm::max(chunk.maxP, p);
+            gridIndices[chunk.firstIndex + chunk.indexCount] = v;
+            indices[chunk.firstIndex + chunk.indexCount++] = (unsigned short)((z - chunkZ) * blocks.blockVerts + (x - chunkX));
+        }
+    }
+
+    TerrainVertexCacheStats before = TerrainBuilder::measureVertexCache(gridIndices.data(), gridIndices.size());
+    TerrainVertexCacheStats after = TerrainBuilder::measureVertexCache(indices.data(), indices.size(), false);
+    std::cout << "Terrain: " << gridIndices.size() * sizeof(unsigned int) / 1024 << " KB of grid indices -> "
+              << indices.size() * sizeof(unsigned short) / 1024 << " KB of chunk indices, ACMR "
+              << before.acmr() << " -> " << after.acmr() << ", vertex cache hit rate "
+              << before.hitRate() * 100.0f << "% -> " << after.hitRate() * 100.0f << "%" << std::endl;
+}
+
+// ------------------ Cache ------------------
+void Terrain::loadCache(const TerrainCache& cache) {
+    const TerrainCacheContents& contents = cache.getContents();
+
+    // node bounds are small, copy them out level by level
+    nodeHeights.assign(levelCount, std::vector<glm::vec2>());
+    const glm::vec2* node = contents.nodeHeights;
+    for (int level = 0; level < levelCount; level++) {
+        int count = gridSize / (PATCH_SIZE << level);
+        nodeHeights[level].assign(node, node + (size_t)count * count);
+        node += (size_t)count * count;
+    }
+
+    patchIndexOffset.assign(contents.patchOffsets, contents.patchOffsets + contents.patchCount);
+    chunks.assign(contents.chunks, contents.chunks + contents.chunkCount);
+    if (mode == TerrainMode::Simplified)
+        chunksPerEdge = vertexLayouts[0].blocksPerEdge;
+
+    // the GPU buffers go up straight from the mapping
+    uploadNormalMap(contents.normals);
+    if (mode != TerrainMode::GpuDisplacement)
+        uploadMesh(contents.vertices, contents.vertexCount, contents.indices, contents.indexCount);
+}
+
+void Terrain::writeCache(const std::string& path, const TerrainCacheKey& key, const unsigned short* samples,
+                         const std::vector<unsigned short>& slopes, const std::vector<TerrainVertex>& vertices,
+                         const std::vector<unsigned short>& indices) const {
+    std::vector<glm::vec2> nodes;
+    for (const auto& level : nodeHeights)
+        nodes.insert(nodes.end(), level.begin(), level.end());
+
+    TerrainCacheContents contents;
+    contents.samples = samples;
+    contents.sampleCount = (size_t)imgWidth * imgHeight;
+    contents.nodeHeights = nodes.data();
+    contents.nodeCount = nodes.size();
+    contents.normals = slopes.data();
+    contents.normalCount = slopes.size() / 2;
+    contents.vertices = vertices.data();
+    contents.vertexCount = vertices.size();
+    contents.indices = indices.data();
+    contents.indexCount = indices.size();
+    contents.patchOffsets = patchIndexOffset.data();
+    contents.patchCount = patchIndexOffset.size();
+    contents.chunks = chunks.data();
+    contents.chunkCount = chunks.size();
+
+    if (TerrainCache::write(path, key, imgWidth, imgHeight, gridSize, levelCount, contents))
+        std::cout << "Terrain: saved mesh cache " << path << std::endl;
+}
+
+// ------------------ GPU Displacement ------------------
+void Terrain::uploadHeightTexture(const unsigned short* samples) {
+    glGenTextures(1, &heightTexture);
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+
+    // raw 16-bit samples, the shader applies heightScale / heightOffset.
+    // Rows of odd-width maps are only 2-byte aligned.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, imgWidth, imgHeight, 0, GL_RED, GL_UNSIGNED_SHORT, samples);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    // only read with texelFetch, so no filtering or mips
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void Terrain::uploadNormalMap(const unsigned short* slopes) {
+    // a single-layer array, so terrain.fs samples streamed tiles and the whole map the same way
+    glGenTextures(1, &normalTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG16F, imgWidth, imgHeight, 1, 0, GL_RG, GL_HALF_FLOAT, slopes);
+
+    // slopes average correctly, so they can be mipmapped like colour
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void Terrain::buildPatchMesh() {
+    // One half-size patch in local grid units. Every selected node is drawn
+    // as four instances of it, quarter nodes as one.
+    const int patch = PATCH_SIZE / 2;
+    const int patchVerts = patch + 1;
+
+    std::vector<glm::vec2> vertices;
+    vertices.reserve(patchVerts * patchVerts);
+    for (int z = 0; z < patchVerts; z++)
+        for (int x = 0; x < patchVerts; x++)
+            vertices.push_back(glm::vec2((float)x, (float)z));
+
+    std::vector<unsigned short> indices(TerrainBuilder::patchStripLength(patch));
+    TerrainBuilder::buildPatchStrip(patchVerts, 1, patch, indices.data());
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glGenBuffers(1, &instanceVBO);
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), vertices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+
+    // patch-local grid position
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+
+    // per instance: first grid vertex (x, z), grid stride, LOD level
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainInstance), (void*)offsetof(TerrainInstance, patch));
+    glVertexAttribDivisor(4, 1);
+    // per instance: tile layer and origin (Streamed only)
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainInstance), (void*)offsetof(TerrainInstance, tile));
+    glVertexAttribDivisor(5, 1);
+
+    glBindVertexArray(0);
+}
+
+// ------------------ Editing ------------------
+void Terrain::beginEditing() {
+    if (!samples.empty())
+        return;
+
+    // the loaded heightmap (or mapped cache) is gone by now, the query still holds every sample
+    samples.resize((size_t)imgWidth * imgHeight);
+    for (int z = 0; z < imgHeight; z++)
+        for (int x = 0; x < imgWidth; x++)
+            samples[(size_t)z * imgWidth + x] = heightQuery->sampleAt(x, z);
+
+    if (heights.empty()) {
+        heights.resize(samples.size());
+        TerrainBuilder::scaleHeights(samples.data(), heights.size(), heightScale / 65535.0f, heightOffset, heights.data());
+    }
+
+    // the same mip chain glGenerateMipmap made, so strokes refresh only the texels they touch
+    normalLevels.assign(1, std::vector<unsigned short>(samples.size() * 2));
+    TerrainBuilder::buildNormalMap(samples.data(), imgWidth, imgHeight, normalLevels[0].data());
+    for (int w = imgWidth, h = imgHeight; w > 1 || h > 1; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        std::vector<unsigned short> level((size_t)std::max(1, w / 2) * std::max(1, h / 2) * 2);
+        TerrainBuilder::downsampleNormals(normalLevels.back().data(), w, h, level.data());
+        normalLevels.push_back(std::move(level));
+    }
+}
+
+bool Terrain::sculpt(const TerrainBrush& brush, float deltaTime, glm::ivec4& changed) {
+    if (!isEditable() || brush.radius <= 0.0f || deltaTime <= 0.0f)
+        return false;
+    beginEditing();
+
+    // heightmap texels under the brush
+    glm::vec2 center = (brush.center - origin) / scaleXZ;
+    float radius = brush.radius / scaleXZ;
+    int x0 = std::max(0, (int)std::ceil(center.x - radius)), x1 = std::min(imgWidth - 1, (int)std::floor(center.x + radius));
+    int z0 = std::max(0, (int)std::ceil(center.y - radius)), z1 = std::min(imgHeight - 1, (int)std::floor(center.y + radius));
+    if (x0 > x1 || z0 > z1)
+        return false;
+
+    // work in raw samples, so heights stay exactly what the GPU copies decode
+    const float toSample = 65535.0f / heightScale;
+    const float step = brush.strength * deltaTime * toSample;
+    const float target = (brush.targetHeight - heightOffset) * toSample;
+    bool edited = false;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            float d = glm::length(glm::vec2((float)x, (float)z) - center) / radius;
+            if (d >= 1.0f)
+                continue;
+
+            size_t i = (size_t)z * imgWidth + x;
+            float s = samples[i];
+            float amount = step * (1.0f - glm::smoothstep(0.0f, 1.0f, d));
+            if (brush.mode == TerrainBrushMode::Raise)
+                s += amount;
+            else if (brush.mode == TerrainBrushMode::Lower)
+                s -= amount;
+            else
+                s += glm::clamp(target - s, -amount, amount);
+
+            unsigned short sample = (unsigned short)std::lround(glm::clamp(s, 0.0f, 65535.0f));
+            if (sample == samples[i])
+                continue;
+            samples[i] = sample;
+            heights[i] = sample * (heightScale / 65535.0f) + heightOffset;
+            edited = true;
+        }
+    }
+    if (!edited)
+        return false;
+
+    heightQuery->updateSamples(samples.data(), imgWidth, imgHeight, x0, z0, x1, z1);
+
+    // normals use central differences, so they change one texel further out
+    int nx0 = std::max(0, x0 - 1), nx1 = std::min(imgWidth, x1 + 2);
+    int nz0 = std::max(0, z0 - 1), nz1 = std::min(imgHeight, z1 + 2);
+    std::vector<unsigned short> slopes((size_t)(nx1 - nx0) * (nz1 - nz0) * 2);
+    TerrainBuilder::buildNormalRect(samples.data(), imgWidth, imgHeight, nx0, nz0, nx1, nz1, slopes.data());
+    for (int z = nz0; z < nz1; z++)
+        std::copy_n(slopes.data() + (size_t)(z - nz0) * (nx1 - nx0) * 2, (nx1 - nx0) * 2,
+                    normalLevels[0].data() + ((size_t)z * imgWidth + nx0) * 2);
+
+    // then each mip's texels over the rectangle, rather than regenerating the whole chain
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalTexture);
+    int w = imgWidth, h = imgHeight;
+    for (int level = 0; level < (int)normalLevels.size(); level++) {
+        if (level > 0) {
+            TerrainBuilder::downsampleNormalRect(normalLevels[level - 1].data(), w, h, nx0, nz0, nx1, nz1,
+                                                 normalLevels[level].data());
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, nx0, nz0, 0, nx1 - nx0, nz1 - nz0, 1, GL_RG, GL_HALF_FLOAT,
+                        normalLevels[level].data() + ((size_t)nz0 * w + nx0) * 2);
+
+        // texels of the next level that average any of these
+        nx0 /= 2;
+        nz0 /= 2;
+        nx1 = std::min(std::max(1, w / 2), (nx1 + 1) / 2);
+        nz1 = std::min(std::max(1, h / 2), (nz1 + 1) / 2);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (mode == TerrainMode::GpuDisplacement) {
+        // straight out of the full heightmap, rows are imgWidth samples apart
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, imgWidth);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x0, z0, x1 - x0 + 1, z1 - z0 + 1, GL_RED, GL_UNSIGNED_SHORT,
+                        samples.data() + (size_t)z0 * imgWidth + x0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // grid vertices past the heightmap's last row / column clamp onto it
+    int gx1 = (x1 == imgWidth - 1) ? gridSize : x1;
+    int gz1 = (z1 == imgHeight - 1) ? gridSize : z1;
+    updateNodes(x0, z0, gx1, gz1);
+    if (mode == TerrainMode::BakedGrid)
+        updateVertices(x0, z0, gx1, gz1);
+
+    changed = glm::ivec4(x0, z0, gx1, gz1);
+    return true;
+}
+
+void Terrain::updateNodes(int x0, int z0, int x1, int z1) {
+    // leaves sharing a vertex with the rectangle, then their ancestors
+    int nx0 = std::max(0, x0 - 1) / PATCH_SIZE, nx1 = x1 / PATCH_SIZE;
+    int nz0 = std::max(0, z0 - 1) / PATCH_SIZE, nz1 = z1 / PATCH_SIZE;
+    for (int level = 0; level < levelCount; level++) {
+        int last = (gridSize / (PATCH_SIZE << level)) - 1;
+        for (int nz = nz0; nz <= std::min(nz1, last); nz++)
+            for (int nx = nx0; nx <= std::min(nx1, last); nx++)
+                updateNode(level, nx, nz);
+        nx0 >>= 1; nz0 >>= 1; nx1 >>= 1; nz1 >>= 1;
+    }
+}
+
+static int trailingZeros(int v, int limit) {
+    int bits = 0;
+    while (bits < limit && ((v >> bits) & 1) == 0)
+        bits++;
+    return bits;
+}
+
+void Terrain::updateVertices(int x0, int z0, int x1, int z1) {
+    // Besides the vertices in the rectangle, every vertex that morphs onto one of
+    // them. A vertex snaps onto the coarser grid point at or below it, at most
+    // 1 << level grid steps away, and its level is at most the trailing zero bits
+    // of its row, so only a few rows past the rectangle reach back into it.
+    const TerrainGrid terrainGrid = grid();
+    std::vector<TerrainVertex> span;
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    for (size_t i = 0; i < vertexLayouts.size(); i++) {
+        const TerrainVertexLayout& layout = vertexLayouts[i];
+        if (i > 0 && layout.firstVertex == vertexLayouts[i - 1].firstVertex)
+            continue;
+
+        const int stride = layout.stride, blockSpan = layout.blockSpan(), verts = layout.blockVerts;
+        const int xBegin = (x0 + stride - 1) / stride * stride;
+        const int zEnd = std::min(gridSize, z1 + (1 << levelCount));
+        for (int z = (z0 + stride - 1) / stride * stride; z <= zEnd; z += stride) {
+            int reach = 1 << trailingZeros(z, levelCount);
+            if (z > z1 + reach)
+                continue;
+            int xEnd = std::min(gridSize, x1 + reach);
+
+            // a row on a block edge is in both blocks
+            for (int bz = std::max(0, (z - 1) / blockSpan); bz <= std::min(z / blockSpan, layout.blocksPerEdge - 1); bz++) {
+                int row = (z - bz * blockSpan) / stride;
+                for (int bx = std::max(0, (xBegin - 1) / blockSpan); bx <= std::min(xEnd / blockSpan, layout.blocksPerEdge - 1); bx++) {
+                    int first = std::max(0, xBegin - bx * blockSpan) / stride;
+                    int last = std::min(blockSpan, xEnd - bx * blockSpan) / stride + 1;
+                    if (first >= last)
+                        continue;
+
+                    int block = bz * layout.blocksPerEdge + bx;
+                    span.resize(last - first);
+                    TerrainBuilder::buildBlockRow(terrainGrid, levelCount, layout, block, row, first, last, span.data());
+                    size_t vertex = layout.firstVertex + (size_t)block * verts * verts + (size_t)row * verts + first;
+                    glBufferSubData(GL_ARRAY_BUFFER, vertex * sizeof(TerrainVertex), span.size() * sizeof(TerrainVertex), span.data());
+                }
+            }
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// ------------------ LOD Selection ------------------
+glm::vec2 Terrain::heightRange(const glm::vec2& minXZ, const glm::vec2& maxXZ) const {
+    if (!loaded)
+        return glm::vec2(0.0f);
+
+    // level 0 nodes under the rectangle, clamped to the grid
+    const int count = gridSize / PATCH_SIZE;
+    glm::vec2 lo = (minXZ - origin) / (scaleXZ * PATCH_SIZE);
+    glm::vec2 hi = (maxXZ - origin) / (scaleXZ * PATCH_SIZE);
+    int nx0 = glm::clamp((int)std::floor(lo.x), 0, count - 1), nx1 = glm::clamp((int)std::floor(hi.x), 0, count - 1);
+    int nz0 = glm::clamp((int)std::floor(lo.y), 0, count - 1), nz1 = glm::clamp((int)std::floor(hi.y), 0, count - 1);
+
+    glm::vec2 range(FLT_MAX, -FLT_MAX);
+    for (int nz = nz0; nz <= nz1; nz++) {
+        for (int nx = nx0; nx <= nx1; nx++) {
+            glm::vec3 minP, maxP;
+            nodeBounds(0, nx * PATCH_SIZE, nz * PATCH_SIZE, minP, maxP);
+            range.x = std::min(range.x, minP.y);
+            range.y = std::max(range.y, maxP.y);
+        }
+    }
+    return range;
+}
+
+void Terrain::nodeBounds(int level, int x, int z, glm::vec3& minP, glm::vec3& maxP) const {
+    int nodeSize = PATCH_SIZE << level;
+    glm::vec2 h;
+    if (tileFile) {
+        const uint16_t* bounds = tileFile->getNodeBounds(level, x / nodeSize, z / nodeSize);
+        h = glm::vec2(bounds[0], bounds[1]) * (heightScale / 65535.0f) + heightOffset;
+    }
+    else {
+        int count = gridSize / nodeSize;
+        h = nodeHeights[level][(size_t)(z / nodeSize) * count + (x / nodeSize)];
+    }
+
+    minP = glm::vec3(origin.x + x * scaleXZ, h.x, origin.y + z * scaleXZ);
+    maxP = glm::vec3(origin.x + (x + nodeSize) * scaleXZ, h.y, origin.y + (z + nodeSize) * scaleXZ);
+}
+
+// Returns false if the node is out of range for its level, so the parent draws it instead
+bool Terrain::selectNode(int level, int x, int z) {
+    glm::vec3 minP, maxP;
+    nodeBounds(level, x, z, minP, maxP);
+
+    bool topLevel = (level == levelCount - 1);
+    if (!topLevel && !intersectsSphere(minP, maxP, cameraPos, lodRanges[level]))
+        return false;
+
+    // culled, but handled
+    if (!frustum.intersectsAABB(minP, maxP))
+        return true;
+
+    // a tile that is not paged in yet is requested, and the parent draws this area meanwhile
+    int slot = -1;
+    if (streamer) {
+        int tileSpan = tileFile->getHeader().tileSize << level;
+        slot = streamer->acquire(level, x / tileSpan, z / tileSpan);
+        if (slot < 0)
+            return false;
+    }
+
+    if (level == 0 || !intersectsSphere(minP, maxP, cameraPos, lodRanges[level - 1])) {
+        selection.push_back({ x, z, level, false, slot });
+        return true;
+    }
+
+    int half = (PATCH_SIZE << level) / 2;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            int cx = x + i * half;
+            int cz = z + j * half;
+            if (!selectNode(level - 1, cx, cz))
+                selection.push_back({ cx, cz, level, true, slot });
+        }
+    }
+    return true;
+}
+
+void Terrain::update(const glm::vec3& cameraPos, const glm::mat4& viewProjection) {
+    if (!loaded)
+        return;
+
+    this->cameraPos = cameraPos;
+    frustum.update(viewProjection);
+
+    if (streamer)
+        streamer->update();
+
+    selection.clear();
+    triangleCount = 0;
+
+    // the simplified mesh has no LOD, chunks are only frustum culled
+    if (mode == TerrainMode::Simplified) {
+        int chunkSize = gridSize / chunksPerEdge;
+        for (int i = 0; i < (int)chunks.size(); i++) {
+            const TerrainChunk& chunk = chunks[i];
+            if (chunk.indexCount == 0 || !frustum.intersectsAABB(chunk.minP, chunk.maxP))
+                continue;
+            selection.push_back({ (i % chunksPerEdge) * chunkSize, (i / chunksPerEdge) * chunkSize, 0, false });
+            triangleCount += chunk.indexCount / 3;
+        }
+        return;
+    }
+
+    int top = levelCount - 1;
+    int topSize = PATCH_SIZE << top;
+    for (int z = 0; z < gridSize; z += topSize)
+        for (int x = 0; x < gridSize; x += topSize)
+            selectNode(top, x, z);
+
+    // group by level so the morph uniforms change as little as possible
+    std::sort(selection.begin(), selection.end(),
+        [](const TerrainSelection& a, const TerrainSelection& b) { return a.level < b.level; });
+
+    for (const auto& sel : selection) {
+        int patch = sel.half ? PATCH_SIZE / 2 : PATCH_SIZE;
+        triangleCount += patch * patch * 2;
+    }
+}
+
+int Terrain::chunkIndex(const TerrainSelection& sel) const {
+    int chunkSize = gridSize / chunksPerEdge;
+    return (sel.z / chunkSize) * chunksPerEdge + sel.x / chunkSize;
+}
+
+// ------------------ Draw ------------------
+glm::vec2 Terrain::morphRange(int level) const {
+    // the top level has nothing coarser to morph into
+    if (level >= levelCount - 1)
+        return glm::vec2(1e30f, 2e30f);
+
+    float prev = level > 0 ? lodRanges[level - 1] : 0.0f;
+    float end = lodRanges[level];
+    return glm::vec2(prev + (end - prev) * MORPH_START_RATIO, end);
+}
+
+void Terrain::Draw(const Shader& shader) {
+    if (!loaded)
+        return;
+
+    shader.setVec3("morphCameraPos", cameraPos);
+    shader.setVec2("terrainOrigin", origin);
+    shader.setFloat("gridSpacing", scaleXZ);
+    shader.setVec2("terrainUVScale", glm::vec2(1.0f / imgWidth, 1.0f / imgHeight));
+    shader.setFloat("heightScale", heightScale);
+    shader.setFloat("heightOffset", heightOffset);
+
+    glActiveTexture(GL_TEXTURE0 + NORMAL_MAP_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, streamer ? streamer->getNormalTexture() : normalTexture);
+    shader.setInt("normalMap", NORMAL_MAP_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0);
+
+    if (mode == TerrainMode::Simplified)
+        drawSimplified(shader);
+    else if (mode != TerrainMode::BakedGrid)
+        drawInstanced(shader);
+    else
+        drawBaked(shader);
+}
+
+void Terrain::setVertexLayout(const Shader& shader, int level) const {
+    const TerrainVertexLayout& layout = vertexLayouts[level];
+    shader.setInt("layoutFirstVertex", (int)layout.firstVertex);
+    shader.setInt("blockVerts", layout.blockVerts);
+    shader.setInt("blocksPerEdge", layout.blocksPerEdge);
+    shader.setFloat("blockStride", (float)layout.stride);
+}
+
+void Terrain::drawBaked(const Shader& shader) {
+    const GLsizei fullCount = (GLsizei)TerrainBuilder::patchStripLength(PATCH_SIZE);
+    const GLsizei halfCount = (GLsizei)TerrainBuilder::patchStripLength(PATCH_SIZE / 2);
+
+    glBindVertexArray(VAO);
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(TerrainBuilder::RESTART_INDEX);
+
+    int currentLevel = -1;
+    for (const auto& sel : selection) {
+        if (sel.level != currentLevel) {
+            currentLevel = sel.level;
+            shader.setInt("lodLevel", currentLevel);
+            shader.setVec2("morphRange", morphRange(currentLevel));
+            setVertexLayout(shader, currentLevel);
+        }
+
+        unsigned int offset = patchIndexOffset[sel.level] + (sel.half ? fullCount : 0);
+        glDrawElementsBaseVertex(GL_TRIANGLE_STRIP, sel.half ? halfCount : fullCount, GL_UNSIGNED_SHORT,
+            (void*)(offset * sizeof(unsigned short)), (GLint)vertexLayouts[sel.level].vertexAt(sel.x, sel.z));
+    }
+
+    glDisable(GL_PRIMITIVE_RESTART);
+    glBindVertexArray(0);
+}
+
+void Terrain::drawSimplified(const Shader& shader) {
+    // level 0 with the top level's range, so nothing morphs
+    shader.setInt("lodLevel", 0);
+    shader.setVec2("morphRange", morphRange(levelCount - 1));
+    setVertexLayout(shader, 0);
+
+    // chunk i is vertex block i
+    const TerrainVertexLayout& blocks = vertexLayouts[0];
+    glBindVertexArray(VAO);
+    for (const auto& sel : selection) {
+        int index = chunkIndex(sel);
+        const TerrainChunk& chunk = chunks[index];
+        glDrawElementsBaseVertex(GL_TRIANGLES, chunk.indexCount, GL_UNSIGNED_SHORT,
+            (void*)(chunk.firstIndex * sizeof(unsigned short)),
+            (GLint)(blocks.firstVertex + index * blocks.blockVerts * blocks.blockVerts));
+    }
+    glBindVertexArray(0);
+}
+
+void Terrain::drawInstanced(const Shader& shader) {
+    // every selection becomes one or four half-size patches
+    const int half = PATCH_SIZE / 2;
+    instances.clear();
+    for (const auto& sel : selection) {
+        float stride = (float)(1 << sel.level);
+
+        glm::vec4 tile(0.0f);
+        if (tileFile) {
+            int tileSpan = tileFile->getHeader().tileSize << sel.level;
+            tile = glm::vec4((float)sel.slot, (float)(sel.x / tileSpan * tileSpan), (float)(sel.z / tileSpan * tileSpan), 0.0f);
+        }
+
+        int quarters = sel.half ? 1 : 2;
+        for (int j = 0; j < quarters; j++)
+            for (int i = 0; i < quarters; i++)
+                instances.push_back({ glm::vec4(sel.x + i * half * stride, sel.z + j * half * stride,
+                                                stride, (float)sel.level), tile });
+    }
+    if (instances.empty())
+        return;
+
+    for (int level = 0; level < levelCount; level++)
+        shader.setVec2("morphRanges[" + std::to_string(level) + "]", morphRange(level));
+
+    glActiveTexture(GL_TEXTURE0 + HEIGHTMAP_TEXTURE_UNIT);
+    if (streamer) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, streamer->getTexture());
+        shader.setInt("heightTiles", HEIGHTMAP_TEXTURE_UNIT);
+    }
+    else {
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        shader.setInt("heightMap", HEIGHTMAP_TEXTURE_UNIT);
+    }
+
+    // orphan and refill the instance buffer
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(TerrainInstance), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(TerrainInstance), instances.data());
+
+    glBindVertexArray(VAO);
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(TerrainBuilder::RESTART_INDEX);
+    glDrawElementsInstanced(GL_TRIANGLE_STRIP, (GLsizei)TerrainBuilder::patchStripLength(half), GL_UNSIGNED_SHORT, 0,
+                            (GLsizei)instances.size());
+    glDisable(GL_PRIMITIVE_RESTART);
+    glBindVertexArray(0);
+
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,316 @@
+#include "TerrainBuilder.h"
+#include "Packing.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Elements per job when splitting flat arrays
+static const size_t SCALE_BLOCK = 64 * 1024;
+
+static inline int clampInt(int v, int lo, int hi) {
+    return std::max(lo, std::min(v, hi));
+}
+
+// ------------------ Threading ------------------
+void TerrainBuilder::parallelRows(int rows, const std::function<void(int, int)>& job) {
+    if (rows <= 0)
+        return;
+
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, rows);
+    int band = (rows + threads - 1) / threads;
+
+    std::vector<std::thread> workers;
+    for (int begin = band; begin < rows; begin += band)
+        workers.emplace_back(job, begin, std::min(begin + band, rows));
+
+    // the calling thread takes the first band
+    job(0, std::min(band, rows));
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// ------------------ Heights ------------------
+void TerrainBuilder::scaleHeights(const unsigned short* src, size_t count, float scale, float offset, float* dst) {
+    int blocks = (int)((count + SCALE_BLOCK - 1) / SCALE_BLOCK);
+
+    parallelRows(blocks, [&](int blockBegin, int blockEnd) {
+        size_t i = (size_t)blockBegin * SCALE_BLOCK;
+        size_t end = std::min((size_t)blockEnd * SCALE_BLOCK, count);
+
+#ifdef TERRAIN_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 vScale = _mm_set1_ps(scale);
+        const __m128 vOffset = _mm_set1_ps(offset);
+        for (; i + 8 <= end; i += 8) {
+            // 8 x uint16 -> 2 x 4 floats
+            __m128i words = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(lo, vScale), vOffset));
+            _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_mul_ps(hi, vScale), vOffset));
+        }
+#endif
+        for (; i < end; i++)
+            dst[i] = src[i] * scale + offset;
+    });
+}
+
+// ------------------ Normal Map ------------------
+// Slopes of texels [x0, x1) in row z, written from dst[0]
+static void slopeRow(const unsigned short* samples, int width, int height, int z, int x0, int x1,
+                     std::vector<float>& slopeX, std::vector<float>& slopeZ, unsigned short* dst) {
+    const unsigned short* rowC = samples + (size_t)z * width;
+    const unsigned short* rowD = samples + (size_t)clampInt(z - 1, 0, height - 1) * width;
+    const unsigned short* rowU = samples + (size_t)clampInt(z + 1, 0, height - 1) * width;
+
+    auto scalarSlope = [&](int x) {
+        slopeX[x] = 0.5f * ((float)rowC[clampInt(x + 1, 0, width - 1)] - (float)rowC[clampInt(x - 1, 0, width - 1)]);
+        slopeZ[x] = 0.5f * ((float)rowU[x] - (float)rowD[x]);
+    };
+
+    int x = x0;
+#ifdef TERRAIN_SSE2
+    // interior texels, where x - 1 and x + 1 are both inside the row
+    if (x == 0)
+        scalarSlope(x++);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 half = _mm_set1_ps(0.5f);
+    auto diff = [&](const unsigned short* a, const unsigned short* b, float* out) {
+        __m128i wa = _mm_loadu_si128((const __m128i*)a);
+        __m128i wb = _mm_loadu_si128((const __m128i*)b);
+        __m128i lo = _mm_sub_epi32(_mm_unpacklo_epi16(wa, zero), _mm_unpacklo_epi16(wb, zero));
+        __m128i hi = _mm_sub_epi32(_mm_unpackhi_epi16(wa, zero), _mm_unpackhi_epi16(wb, zero));
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(lo), half));
+        _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), half));
+    };
+    for (; x + 8 <= std::min(x1, width - 1); x += 8) {
+        diff(rowC + x + 1, rowC + x - 1, slopeX.data() + x);
+        diff(rowU + x, rowD + x, slopeZ.data() + x);
+    }
+#endif
+    for (; x < x1; x++)
+        scalarSlope(x);
+
+    for (x = x0; x < x1; x++) {
+        dst[(x - x0) * 2] = (unsigned short)glm::packHalf1x16(slopeX[x]);
+        dst[(x - x0) * 2 + 1] = (unsigned short)glm::packHalf1x16(slopeZ[x]);
+    }
+}
+
+void TerrainBuilder::buildNormalMap(const unsigned short* samples, int width, int height, unsigned short* out) {
+    parallelRows(height, [&](int rowBegin, int rowEnd) {
+        std::vector<float> slopeX(width), slopeZ(width);
+        for (int z = rowBegin; z < rowEnd; z++)
+            slopeRow(samples, width, height, z, 0, width, slopeX, slopeZ, out + (size_t)z * width * 2);
+    });
+}
+
+void TerrainBuilder::buildNormalRect(const unsigned short* samples, int width, int height,
+                                     int x0, int z0, int x1, int z1, unsigned short* out) {
+    // small rectangles, threads would cost more than they save
+    std::vector<float> slopeX(width), slopeZ(width);
+    for (int z = z0; z < z1; z++)
+        slopeRow(samples, width, height, z, x0, x1, slopeX, slopeZ, out + (size_t)(z - z0) * (x1 - x0) * 2);
+}
+
+// Next-level texels [x0, x1) of row z
+static void downsampleRow(const unsigned short* src, int width, int height, int z, int x0, int x1,
+                          unsigned short* out) {
+    const int outWidth = std::max(1, width / 2);
+    const unsigned short* row0 = src + (size_t)std::min(z * 2, height - 1) * width * 2;
+    const unsigned short* row1 = src + (size_t)std::min(z * 2 + 1, height - 1) * width * 2;
+    for (int x = x0; x < x1; x++) {
+        int a = std::min(x * 2, width - 1) * 2;
+        int b = std::min(x * 2 + 1, width - 1) * 2;
+        for (int c = 0; c < 2; c++) {
+            float sum = glm::unpackHalf1x16(row0[a + c]) + glm::unpackHalf1x16(row0[b + c])
+                      + glm::unpackHalf1x16(row1[a + c]) + glm::unpackHalf1x16(row1[b + c]);
+            out[((size_t)z * outWidth + x) * 2 + c] = (unsigned short)glm::packHalf1x16(sum * 0.25f);
+        }
+    }
+}
+
+void TerrainBuilder::downsampleNormals(const unsigned short* src, int width, int height, unsigned short* out) {
+    const int outWidth = std::max(1, width / 2);
+    parallelRows(std::max(1, height / 2), [&](int rowBegin, int rowEnd) {
+        for (int z = rowBegin; z < rowEnd; z++)
+            downsampleRow(src, width, height, z, 0, outWidth, out);
+    });
+}
+
+void TerrainBuilder::downsampleNormalRect(const unsigned short* src, int width, int height,
+                                          int x0, int z0, int x1, int z1, unsigned short* out) {
+    for (int z = z0; z < z1; z++)
+        downsampleRow(src, width, height, z, x0, x1, out);
+}
+
+// ------------------ Vertices ------------------
+std::vector<TerrainVertexLayout> TerrainBuilder::vertexLayouts(int gridSize, int levelCount, int patchSize, int blockSize) {
+    const int blockQuads = std::min(blockSize, gridSize);
+    const TerrainVertexLayout shared = { 0, blockQuads + 1, gridSize / blockQuads, 1 };
+
+    std::vector<TerrainVertexLayout> layouts(levelCount);
+    unsigned int next = (unsigned int)shared.vertexCount();
+    for (int level = 0; level < levelCount; level++) {
+        int nodeSize = patchSize << level;
+        if (nodeSize <= blockQuads) {
+            layouts[level] = shared;
+        }
+        else {
+            // only the vertices this level draws: one patch per node
+            layouts[level] = { next, patchSize + 1, gridSize / nodeSize, 1 << level };
+            next += (unsigned int)layouts[level].vertexCount();
+        }
+    }
+    return layouts;
+}
+
+void TerrainBuilder::buildBlockRow(const TerrainGrid& grid, int levelCount, const TerrainVertexLayout& layout,
+                                   int block, int row, int first, int last, TerrainVertex* out) {
+    auto sample = [&](int x, int z) {
+        x = clampInt(x, 0, grid.width - 1);
+        z = clampInt(z, 0, grid.height - 1);
+        return grid.heights[(size_t)z * grid.width + x];
+    };
+
+    auto quantize = [&](float h) {
+        return packUnorm16((h - grid.heightOffset) / grid.heightScale);
+    };
+
+    const int span = layout.blockSpan();
+    const int z = block / layout.blocksPerEdge * span + row * layout.stride;
+    const int blockX = block % layout.blocksPerEdge * span;
+    for (int vx = first; vx < last; vx++) {
+        int x = blockX + vx * layout.stride;
+        TerrainVertex& vert = out[vx - first];
+        vert.Height = quantize(sample(x, z));
+
+        // A vertex is odd only at the lowest level where it is not on the
+        // next coarser grid, and snaps down onto that grid there
+        int level = 0;
+        while (level < levelCount && ((x >> level) & 1) == 0 && ((z >> level) & 1) == 0)
+            level++;
+        int coarseMask = ~((2 << level) - 1);
+        vert.MorphHeight = quantize(sample(x & coarseMask, z & coarseMask));
+    }
+}
+
+void TerrainBuilder::buildVertices(const TerrainGrid& grid, int levelCount,
+                                   const std::vector<TerrainVertexLayout>& layouts, TerrainVertex* out) {
+    for (size_t i = 0; i < layouts.size(); i++) {
+        const TerrainVertexLayout& layout = layouts[i];
+        if (i > 0 && layout.firstVertex == layouts[i - 1].firstVertex)
+            continue;
+
+        // one row of vertices across every block at a time
+        const int verts = layout.blockVerts;
+        parallelRows(layout.blocksPerEdge * verts, [&](int rowBegin, int rowEnd) {
+            for (int row = rowBegin; row < rowEnd; row++) {
+                int bz = row / verts, vz = row % verts;
+                for (int bx = 0; bx < layout.blocksPerEdge; bx++) {
+                    int block = bz * layout.blocksPerEdge + bx;
+                    buildBlockRow(grid, levelCount, layout, block, vz, 0, verts,
+                                  out + layout.firstVertex + (size_t)block * verts * verts + (size_t)vz * verts);
+                }
+            }
+        });
+    }
+}
+
+// ------------------ Indices ------------------
+size_t TerrainBuilder::patchStripLength(int patch) {
+    // per band and quad row: one strip of 2 * (width + 1), restarts between strips
+    size_t length = 0, strips = 0;
+    for (int x0 = 0; x0 < patch; x0 += STRIP_BAND) {
+        int width = std::min((int)STRIP_BAND, patch - x0); // by value, std::min binds references
+        length += (size_t)patch * 2 * (width + 1);
+        strips += patch;
+    }
+    return length + strips - 1;
+}
+
+void TerrainBuilder::buildPatchStrip(int rowPitch, int stride, int patch, unsigned short* out) {
+    // Top, bottom, top, ... makes the same (top left, bottom left, top right) /
+    // (top right, bottom left, bottom right) triangles as a quad list
+    bool first = true;
+    for (int x0 = 0; x0 < patch; x0 += STRIP_BAND) {
+        int x1 = std::min(x0 + STRIP_BAND, patch);
+        for (int qz = 0; qz < patch; qz++) {
+            if (!first)
+                *out++ = RESTART_INDEX;
+            first = false;
+
+            for (int qx = x0; qx <= x1; qx++) {
+                *out++ = (unsigned short)(qz * stride * rowPitch + qx * stride);
+                *out++ = (unsigned short)((qz + 1) * stride * rowPitch + qx * stride);
+            }
+        }
+    }
+}
+
+void TerrainBuilder::buildPatchList(int rowPitch, int stride, int patch, unsigned short* out) {
+    // row by row, the same two triangles per quad as the strips
+    for (int qz = 0; qz < patch; qz++) {
+        for (int qx = 0; qx < patch; qx++) {
+            unsigned short topLeft = (unsigned short)(qz * stride * rowPitch + qx * stride);
+            unsigned short bottomLeft = (unsigned short)(topLeft + stride * rowPitch);
+            *out++ = topLeft;
+            *out++ = bottomLeft;
+            *out++ = (unsigned short)(topLeft + stride);
+            *out++ = (unsigned short)(topLeft + stride);
+            *out++ = bottomLeft;
+            *out++ = (unsigned short)(bottomLeft + stride);
+        }
+    }
+}
+
+template <typename Index>
+static TerrainVertexCacheStats measureFifo(const Index* indices, size_t count, bool strip, int cacheSize) {
+    // FIFO, like the post-transform cache of most GPUs
+    TerrainVertexCacheStats stats;
+    std::vector<Index> fifo;
+    size_t stripLength = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        Index index = indices[i];
+        if (strip && index == TerrainBuilder::RESTART_INDEX) {
+            stripLength = 0;
+            continue;
+        }
+
+        stats.references++;
+        if (std::find(fifo.begin(), fifo.end(), index) == fifo.end()) {
+            stats.misses++;
+            fifo.push_back(index);
+            if ((int)fifo.size() > cacheSize)
+                fifo.erase(fifo.begin());
+        }
+
+        if (strip) {
+            if (++stripLength >= 3 && index != indices[i - 1] && index != indices[i - 2] && indices[i - 1] != indices[i - 2])
+                stats.triangles++;
+        }
+        else if (i % 3 == 2) {
+            stats.triangles++;
+        }
+    }
+    return stats;
+}
+
+TerrainVertexCacheStats TerrainBuilder::measureVertexCache(const unsigned short* indices, size_t count, bool strip,
+                                                           int cacheSize) {
+    return measureFifo(indices, count, strip, cacheSize);
+}
+
+TerrainVertexCacheStats TerrainBuilder::measureVertexCache(const unsigned int* indices, size_t count, int cacheSize) {
+    return measureFifo(indices, count, false, cacheSize);
+}
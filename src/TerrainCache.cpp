@@ -0,0 +1,130 @@
+#include "TerrainCache.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "VirtualFileSystem.h"
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+static bool sameKey(const TerrainCacheKey& a, const TerrainCacheKey& b) {
+    return a.sourceHash == b.sourceHash && a.mode == b.mode && a.patchSize == b.patchSize &&
+           a.scaleXZ == b.scaleXZ && a.heightScale == b.heightScale && a.maxError == b.maxError;
+}
+
+// ------------------ Writing ------------------
+bool TerrainCache::write(const std::string& path, const TerrainCacheKey& key, int width, int height,
+                         int gridSize, int levelCount, const TerrainCacheContents& contents) {
+    TerrainCacheHeader header = {};
+    std::memcpy(header.magic, "TMC1", 4);
+    header.version = VERSION;
+    header.key = key;
+    header.width = width;
+    header.height = height;
+    header.gridSize = gridSize;
+    header.levelCount = levelCount;
+
+    // lay the sections out back to back
+    struct Section {
+        uint64_t* offset;
+        const void* data;
+        size_t bytes;
+    };
+    header.sampleCount = contents.sampleCount;
+    header.nodeCount = contents.nodeCount;
+    header.normalCount = contents.normalCount;
+    header.vertexCount = contents.vertexCount;
+    header.indexCount = contents.indexCount;
+    header.patchCount = contents.patchCount;
+    header.chunkCount = contents.chunkCount;
+    const Section sections[] = {
+        { &header.sampleOffset, contents.samples, contents.sampleCount * sizeof(uint16_t) },
+        { &header.nodeOffset, contents.nodeHeights, contents.nodeCount * sizeof(glm::vec2) },
+        { &header.normalOffset, contents.normals, contents.normalCount * 2 * sizeof(uint16_t) },
+        { &header.vertexOffset, contents.vertices, contents.vertexCount * sizeof(TerrainVertex) },
+        { &header.indexOffset, contents.indices, contents.indexCount * sizeof(unsigned short) },
+        { &header.patchOffset, contents.patchOffsets, contents.patchCount * sizeof(unsigned int) },
+        { &header.chunkOffset, contents.chunks, contents.chunkCount * sizeof(TerrainChunk) },
+    };
+
+    uint64_t offset = alignSection(sizeof(TerrainCacheHeader));
+    for (const Section& section : sections) {
+        *section.offset = offset;
+        offset = alignSection(offset + section.bytes);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to create terrain cache: " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+
+    const char padding[16] = {};
+    uint64_t written = sizeof(header);
+    for (const Section& section : sections) {
+        out.write(padding, (std::streamsize)(*section.offset - written));
+        out.write((const char*)section.data, (std::streamsize)section.bytes);
+        written = *section.offset + section.bytes;
+    }
+
+    if (!out) {
+        std::cout << "Failed to write terrain cache: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// ------------------ Reading ------------------
+bool TerrainCache::open(const std::string& path, const TerrainCacheKey& key) {
+    // no cache yet is the normal cold start, not an error
+    if (!VirtualFileSystem::instance().exists(path))
+        return false;
+    if (!file.open(path))
+        return false;
+
+    if (file.getSize() < sizeof(TerrainCacheHeader)) {
+        std::cout << "Terrain cache is truncated: " << path << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, "TMC1", 4) != 0 || header.version != VERSION || !sameKey(header.key, key)) {
+        close();
+        return false;
+    }
+
+    // every section has to lie inside the file
+    const unsigned char* base = file.getData();
+    auto section = [&](uint64_t offset, uint64_t count, size_t stride) -> const void* {
+        if (offset > file.getSize() || count > (file.getSize() - offset) / stride)
+            return nullptr;
+        return base + offset;
+    };
+
+    contents.samples = (const uint16_t*)section(header.sampleOffset, header.sampleCount, sizeof(uint16_t));
+    contents.nodeHeights = (const glm::vec2*)section(header.nodeOffset, header.nodeCount, sizeof(glm::vec2));
+    contents.normals = (const uint16_t*)section(header.normalOffset, header.normalCount, 2 * sizeof(uint16_t));
+    contents.vertices = (const TerrainVertex*)section(header.vertexOffset, header.vertexCount, sizeof(TerrainVertex));
+    contents.indices = (const unsigned short*)section(header.indexOffset, header.indexCount, sizeof(unsigned short));
+    contents.patchOffsets = (const unsigned int*)section(header.patchOffset, header.patchCount, sizeof(unsigned int));
+    contents.chunks = (const TerrainChunk*)section(header.chunkOffset, header.chunkCount, sizeof(TerrainChunk));
+    if (!contents.samples || !contents.nodeHeights || !contents.normals || !contents.vertices || !contents.indices ||
+        !contents.patchOffsets || !contents.chunks ||
+        header.sampleCount != (uint64_t)header.width * header.height ||
+        header.normalCount != header.sampleCount) {
+        std::cout << "Terrain cache is truncated: " << path << std::endl;
+        close();
+        return false;
+    }
+
+    contents.sampleCount = (size_t)header.sampleCount;
+    contents.nodeCount = (size_t)header.nodeCount;
+    contents.normalCount = (size_t)header.normalCount;
+    contents.vertexCount = (size_t)header.vertexCount;
+    contents.indexCount = (size_t)header.indexCount;
+    contents.patchCount = (size_t)header.patchCount;
+    contents.chunkCount = (size_t)header.chunkCount;
+    return true;
+}
@@ -0,0 +1,180 @@
+#include "TerrainHorizon.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include "TerrainBuilder.h"
+#include "TerrainQuery.h"
+
+// March steps grow geometrically: fine near the texel, where a small bump
+// matters, coarse far away, where only big ridges can rise above the horizon
+static const float STEP_GROWTH = 1.1f;
+
+static glm::vec2 azimuthDirection(int a) {
+    float angle = a * glm::two_pi<float>() / TerrainHorizon::AZIMUTHS;
+    return glm::vec2(std::cos(angle), std::sin(angle));
+}
+
+// Sine of the horizon elevation from each base point towards dir, as an 8-bit texel value;
+// xz / heights / maxSlope are scratch space of count entries
+static void marchHorizon(const TerrainQuery& query, const glm::vec2* base, const float* ground, size_t count,
+                         const glm::vec2& dir, float firstStep, float maxDistance, glm::vec2* xz, float* heights,
+                         float* maxSlope, unsigned char* out, size_t outStride) {
+    std::fill(maxSlope, maxSlope + count, 0.0f);
+    for (float d = firstStep; d <= maxDistance; d *= STEP_GROWTH) {
+        for (size_t i = 0; i < count; i++)
+            xz[i] = base[i] + dir * d;
+        query.heightsAt(xz, heights, count);
+        for (size_t i = 0; i < count; i++)
+            maxSlope[i] = std::max(maxSlope[i], (heights[i] - ground[i]) / d);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        float t = maxSlope[i];
+        out[i * outStride] = (unsigned char)std::lround(t / std::sqrt(1.0f + t * t) * 255.0f);
+    }
+}
+
+// ------------------ Constructor ------------------
+TerrainHorizon::TerrainHorizon(const TerrainQuery& query, float maxDistance) : maxDistance(maxDistance) {
+    origin = query.getOrigin();
+    worldSize = query.getGridSize() * query.getSpacing();
+    const float firstStep = query.getSpacing();
+
+    // layer-major, four azimuths per texel in each layer
+    const int layers = AZIMUTHS / 4;
+    texels.resize((size_t)layers * MAP_SIZE * MAP_SIZE * 4);
+
+    TerrainBuilder::parallelRows(MAP_SIZE, [&](int rowBegin, int rowEnd) {
+        std::vector<glm::vec2> base(MAP_SIZE), xz(MAP_SIZE);
+        std::vector<float> ground(MAP_SIZE), heights(MAP_SIZE), maxSlope(MAP_SIZE);
+
+        for (int z = rowBegin; z < rowEnd; z++) {
+            // a whole row at a time, so every step is one batched height lookup
+            for (int x = 0; x < MAP_SIZE; x++)
+                base[x] = texelCenter(x, z);
+            query.heightsAt(base.data(), ground.data(), MAP_SIZE);
+
+            for (int a = 0; a < AZIMUTHS; a++) {
+                unsigned char* dst = texels.data() + ((size_t)(a / 4) * MAP_SIZE * MAP_SIZE + (size_t)z * MAP_SIZE) * 4 + a % 4;
+                marchHorizon(query, base.data(), ground.data(), MAP_SIZE, azimuthDirection(a), firstStep, maxDistance,
+                             xz.data(), heights.data(), maxSlope.data(), dst, 4);
+            }
+        }
+    });
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, MAP_SIZE, MAP_SIZE, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+TerrainHorizon::~TerrainHorizon() {
+    glDeleteTextures(1, &texture);
+}
+
+glm::vec2 TerrainHorizon::texelCenter(int x, int z) const {
+    return origin + (glm::vec2((float)x, (float)z) + 0.5f) * (worldSize / MAP_SIZE);
+}
+
+// ------------------ Update ------------------
+void TerrainHorizon::update(const TerrainQuery& query, const glm::vec2& minXZ, const glm::vec2& maxXZ) {
+    const float texelSize = worldSize / MAP_SIZE;
+    const float firstStep = query.getSpacing();
+
+    // heights are interpolated, so they changed up to a grid step outside the rectangle
+    const glm::vec2 lo = minXZ - firstStep, hi = maxXZ + firstStep;
+    auto texelRange = [&](int axis, float a, float b, int& first, int& last) {
+        first = std::max(0, (int)std::floor((a - origin[axis]) / texelSize - 0.5f));
+        last = std::min(MAP_SIZE - 1, (int)std::ceil((b - origin[axis]) / texelSize - 0.5f));
+    };
+
+    glm::ivec4 uploaded(MAP_SIZE, MAP_SIZE, -1, -1);
+    std::vector<int> picked;
+    std::vector<glm::vec2> base, xz;
+    std::vector<float> ground, heights, maxSlope;
+    std::vector<unsigned char> values;
+    for (int a = 0; a < AZIMUTHS; a++) {
+        // texels whose ray from 0 to maxDistance can cross the rectangle: behind it, looking at it
+        const glm::vec2 dir = azimuthDirection(a);
+        const glm::vec2 reachLo = glm::min(lo, lo - dir * maxDistance), reachHi = glm::max(hi, hi - dir * maxDistance);
+        int x0, x1, z0, z1;
+        texelRange(0, reachLo.x, reachHi.x, x0, x1);
+        texelRange(1, reachLo.y, reachHi.y, z0, z1);
+
+        picked.clear();
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) {
+                // slab test of the segment p + dir * [0, maxDistance] against the rectangle
+                glm::vec2 p = texelCenter(x, z);
+                float tMin = 0.0f, tMax = maxDistance;
+                for (int c = 0; c < 2 && tMin <= tMax; c++) {
+                    if (std::abs(dir[c]) < 1e-6f) {
+                        if (p[c] < lo[c] || p[c] > hi[c])
+                            tMin = tMax + 1.0f;
+                        continue;
+                    }
+                    float t0 = (lo[c] - p[c]) / dir[c], t1 = (hi[c] - p[c]) / dir[c];
+                    tMin = std::max(tMin, std::min(t0, t1));
+                    tMax = std::min(tMax, std::max(t0, t1));
+                }
+                if (tMin <= tMax)
+                    picked.push_back(z * MAP_SIZE + x);
+            }
+        }
+        if (picked.empty())
+            continue;
+
+        const size_t count = picked.size();
+        base.resize(count);
+        xz.resize(count);
+        ground.resize(count);
+        heights.resize(count);
+        maxSlope.resize(count);
+        values.resize(count);
+        for (size_t i = 0; i < count; i++)
+            base[i] = texelCenter(picked[i] % MAP_SIZE, picked[i] / MAP_SIZE);
+        query.heightsAt(base.data(), ground.data(), count);
+
+        const int bands = (int)((count + MAP_SIZE - 1) / MAP_SIZE);
+        TerrainBuilder::parallelRows(bands, [&](int bandBegin, int bandEnd) {
+            size_t first = (size_t)bandBegin * MAP_SIZE, last = std::min(count, (size_t)bandEnd * MAP_SIZE);
+            marchHorizon(query, base.data() + first, ground.data() + first, last - first, dir, firstStep, maxDistance,
+                         xz.data() + first, heights.data() + first, maxSlope.data() + first, values.data() + first, 1);
+        });
+
+        unsigned char* layer = texels.data() + (size_t)(a / 4) * MAP_SIZE * MAP_SIZE * 4 + a % 4;
+        for (size_t i = 0; i < count; i++) {
+            int x = picked[i] % MAP_SIZE, z = picked[i] / MAP_SIZE;
+            layer[(size_t)picked[i] * 4] = values[i];
+            uploaded = glm::ivec4(std::min(uploaded.x, x), std::min(uploaded.y, z), std::max(uploaded.z, x), std::max(uploaded.w, z));
+        }
+    }
+    if (uploaded.x > uploaded.z)
+        return;
+
+    // both layers of the changed box, straight out of the CPU copy
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, MAP_SIZE);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, MAP_SIZE);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, uploaded.x, uploaded.y, 0, uploaded.z - uploaded.x + 1, uploaded.w - uploaded.y + 1,
+                    AZIMUTHS / 4, GL_RGBA, GL_UNSIGNED_BYTE, texels.data() + ((size_t)uploaded.y * MAP_SIZE + uploaded.x) * 4);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TerrainHorizon::bind(const Shader& shader) const {
+    glActiveTexture(GL_TEXTURE0 + HORIZON_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setInt("horizonMap", HORIZON_TEXTURE_UNIT);
+    shader.setVec2("horizonOrigin", origin);
+    shader.setFloat("horizonWorldSize", worldSize);
+}
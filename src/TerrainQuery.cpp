@@ -0,0 +1,274 @@
+#include "TerrainQuery.h"
+#include <algorithm>
+#include "TerrainBuilder.h"
+#include "TerrainTileFile.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// ------------------ Constructors ------------------
+TerrainQuery::TerrainQuery(const uint16_t* samples, int width, int height, int gridSize)
+    : blockSize(BLOCK_SIZE), blockSamples(BLOCK_SIZE + 3) {
+    blocksPerEdge = (gridSize + blockSize - 1) / blockSize;
+    blockStride = (size_t)blockSamples * blockSamples;
+    while ((1 << blockShift) < blockSize)
+        blockShift++;
+    ownBlocks.resize(blockStride * blocksPerEdge * blocksPerEdge);
+    blocks = ownBlocks.data();
+
+    auto sample = [&](int x, int z) {
+        x = std::max(0, std::min(x, width - 1));
+        z = std::max(0, std::min(z, height - 1));
+        return samples[(size_t)z * width + x];
+    };
+
+    TerrainBuilder::parallelRows(blocksPerEdge, [&](int rowBegin, int rowEnd) {
+        for (int bz = rowBegin; bz < rowEnd; bz++) {
+            for (int bx = 0; bx < blocksPerEdge; bx++) {
+                uint16_t* dst = ownBlocks.data() + ((size_t)bz * blocksPerEdge + bx) * blockStride;
+                for (int j = 0; j < blockSamples; j++)
+                    for (int i = 0; i < blockSamples; i++)
+                        *dst++ = sample(bx * blockSize + i - 1, bz * blockSize + j - 1);
+            }
+        }
+    });
+
+    // one node per block, then halving up to a single node
+    nodeSize = blockSize;
+    for (int count = blocksPerEdge; ; count = (count + 1) / 2) {
+        ownNodeMax.emplace_back((size_t)count * count, 0);
+        if (count == 1)
+            break;
+    }
+    nodeLevels = (int)ownNodeMax.size();
+    updateNodeMax(0, 0, blocksPerEdge - 1, blocksPerEdge - 1);
+}
+
+TerrainQuery::TerrainQuery(const TerrainTileFile& tiles)
+    : tileFile(&tiles), blocks(tiles.getTile(0, 0, 0)), blockSize((int)tiles.getHeader().tileSize),
+      blockSamples(tiles.getTileSamples()), blocksPerEdge(tiles.tilesPerEdge(0)),
+      nodeSize((int)tiles.getHeader().patchSize), nodeLevels((int)tiles.getHeader().levelCount) {
+    blockStride = (size_t)blockSamples * blockSamples;
+    while ((1 << blockShift) < blockSize)
+        blockShift++;
+}
+
+void TerrainQuery::setTransform(const glm::vec2& origin, float spacing, float heightScale, float heightOffset) {
+    this->origin = origin;
+    this->spacing = spacing;
+    this->sampleScale = heightScale / 65535.0f;
+    this->heightOffset = heightOffset;
+}
+
+bool TerrainQuery::updateSamples(const uint16_t* samples, int width, int height, int x0, int z0, int x1, int z1) {
+    if (ownBlocks.empty())
+        return false;
+
+    // grid positions that clamp onto the rectangle: the aprons before the first
+    // sample and everything past the last one included
+    const int maxGrid = blocksPerEdge * blockSize + 1;
+    const int gx0 = x0 == 0 ? -1 : x0, gx1 = x1 == width - 1 ? maxGrid : x1;
+    const int gz0 = z0 == 0 ? -1 : z0, gz1 = z1 == height - 1 ? maxGrid : z1;
+
+    // every block whose samples (apron included) overlap them
+    const int bx0 = std::max(0, (gx0 - 2) / blockSize), bx1 = std::min(blocksPerEdge - 1, (gx1 + 1) / blockSize);
+    const int bz0 = std::max(0, (gz0 - 2) / blockSize), bz1 = std::min(blocksPerEdge - 1, (gz1 + 1) / blockSize);
+    for (int bz = bz0; bz <= bz1; bz++) {
+        for (int bx = bx0; bx <= bx1; bx++) {
+            uint16_t* block = ownBlocks.data() + ((size_t)bz * blocksPerEdge + bx) * blockStride;
+            int j0 = std::max(0, gz0 - bz * blockSize + 1), j1 = std::min(blockSamples - 1, gz1 - bz * blockSize + 1);
+            int i0 = std::max(0, gx0 - bx * blockSize + 1), i1 = std::min(blockSamples - 1, gx1 - bx * blockSize + 1);
+            for (int j = j0; j <= j1; j++) {
+                int z = std::max(0, std::min(bz * blockSize + j - 1, height - 1));
+                for (int i = i0; i <= i1; i++) {
+                    int x = std::max(0, std::min(bx * blockSize + i - 1, width - 1));
+                    block[(size_t)j * blockSamples + i] = samples[(size_t)z * width + x];
+                }
+            }
+        }
+    }
+    updateNodeMax(bx0, bz0, bx1, bz1);
+    return true;
+}
+
+// ------------------ Node Bounds ------------------
+void TerrainQuery::updateNodeMax(int bx0, int bz0, int bx1, int bz1) {
+    // a block's own (blockSize + 1)^2 vertices, past the apron
+    TerrainBuilder::parallelRows(bz1 - bz0 + 1, [&](int rowBegin, int rowEnd) {
+        for (int bz = bz0 + rowBegin; bz < bz0 + rowEnd; bz++) {
+            for (int bx = bx0; bx <= bx1; bx++) {
+                const uint16_t* block = blocks + ((size_t)bz * blocksPerEdge + bx) * blockStride;
+                uint16_t h = 0;
+                for (int j = 1; j <= blockSize + 1; j++)
+                    for (int i = 1; i <= blockSize + 1; i++)
+                        h = std::max(h, block[(size_t)j * blockSamples + i]);
+                ownNodeMax[0][(size_t)bz * blocksPerEdge + bx] = h;
+            }
+        }
+    });
+
+    // parents, a missing child (past an odd count) adds nothing
+    for (int level = 1; level < nodeLevels; level++) {
+        bx0 >>= 1; bz0 >>= 1; bx1 >>= 1; bz1 >>= 1;
+        const std::vector<uint16_t>& children = ownNodeMax[level - 1];
+        int childCount = (blocksPerEdge + (1 << (level - 1)) - 1) >> (level - 1);
+        int count = (childCount + 1) / 2;
+        for (int nz = bz0; nz <= bz1; nz++) {
+            for (int nx = bx0; nx <= bx1; nx++) {
+                uint16_t h = 0;
+                for (int j = 0; j < 2; j++)
+                    for (int i = 0; i < 2; i++)
+                        if (nx * 2 + i < childCount && nz * 2 + j < childCount)
+                            h = std::max(h, children[(size_t)(nz * 2 + j) * childCount + nx * 2 + i]);
+                ownNodeMax[level][(size_t)nz * count + nx] = h;
+            }
+        }
+    }
+}
+
+uint16_t TerrainQuery::nodeMax(int level, int nx, int nz) const {
+    if (tileFile) {
+        int last = (int)(tileFile->getHeader().gridSize / (tileFile->getHeader().patchSize << level)) - 1;
+        return tileFile->getNodeBounds(level, std::min(nx, last), std::min(nz, last))[1];
+    }
+    int count = (blocksPerEdge + (1 << level) - 1) >> level;
+    return ownNodeMax[level][(size_t)std::min(nz, count - 1) * count + std::min(nx, count - 1)];
+}
+
+// ------------------ Single Queries ------------------
+uint16_t TerrainQuery::sampleAt(int gx, int gz) const {
+    const int maxGrid = blocksPerEdge * blockSize;
+    gx = std::max(0, std::min(gx, maxGrid));
+    gz = std::max(0, std::min(gz, maxGrid));
+
+    int bx = std::min(gx >> blockShift, blocksPerEdge - 1);
+    int bz = std::min(gz >> blockShift, blocksPerEdge - 1);
+    return blocks[((size_t)bz * blocksPerEdge + bx) * blockStride
+                  + (size_t)(gz - (bz << blockShift) + 1) * blockSamples + (gx - (bx << blockShift) + 1)];
+}
+
+float TerrainQuery::heightAt(float x, float z) const {
+    const float maxGrid = (float)(blocksPerEdge * blockSize);
+    float gx = glm::clamp((x - origin.x) / spacing, 0.0f, maxGrid);
+    float gz = glm::clamp((z - origin.y) / spacing, 0.0f, maxGrid);
+
+    // block, then position inside it past the apron
+    int bx = std::min((int)(gx / blockSize), blocksPerEdge - 1);
+    int bz = std::min((int)(gz / blockSize), blocksPerEdge - 1);
+    float lx = gx - bx * blockSize + 1.0f;
+    float lz = gz - bz * blockSize + 1.0f;
+    int ix = (int)lx;
+    int iz = (int)lz;
+    float fx = lx - ix;
+    float fz = lz - iz;
+
+    const uint16_t* p = blocks + ((size_t)bz * blocksPerEdge + bx) * blockStride + (size_t)iz * blockSamples + ix;
+    float top = p[0] + (p[1] - (float)p[0]) * fx;
+    float bottom = p[blockSamples] + (p[blockSamples + 1] - (float)p[blockSamples]) * fx;
+    return (top + (bottom - top) * fz) * sampleScale + heightOffset;
+}
+
+glm::vec3 TerrainQuery::normalAt(float x, float z) const {
+    float hL = heightAt(x - spacing, z);
+    float hR = heightAt(x + spacing, z);
+    float hD = heightAt(x, z - spacing);
+    float hU = heightAt(x, z + spacing);
+    return glm::normalize(glm::vec3(hL - hR, 2.0f * spacing, hD - hU));
+}
+
+// ------------------ Batched Queries ------------------
+void TerrainQuery::heights4(const float* x, const float* z, float* out) const {
+#ifdef TERRAIN_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 maxGrid = _mm_set1_ps((float)(blocksPerEdge * blockSize));
+    const __m128 maxBlock = _mm_set1_ps((float)(blocksPerEdge - 1));
+    const __m128 size = _mm_set1_ps((float)blockSize);
+    const __m128 invSize = _mm_set1_ps(1.0f / blockSize);
+    const __m128 invSpacing = _mm_set1_ps(1.0f / spacing);
+
+    __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x), _mm_set1_ps(origin.x)), invSpacing);
+    __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(z), _mm_set1_ps(origin.y)), invSpacing);
+    gx = _mm_min_ps(_mm_max_ps(gx, zero), maxGrid);
+    gz = _mm_min_ps(_mm_max_ps(gz, zero), maxGrid);
+
+    // everything is non-negative here, so truncation is floor
+    __m128 bx = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(gx, invSize))), maxBlock);
+    __m128 bz = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(gz, invSize))), maxBlock);
+    __m128 lx = _mm_add_ps(_mm_sub_ps(gx, _mm_mul_ps(bx, size)), one);
+    __m128 lz = _mm_add_ps(_mm_sub_ps(gz, _mm_mul_ps(bz, size)), one);
+    __m128i ix = _mm_cvttps_epi32(lx);
+    __m128i iz = _mm_cvttps_epi32(lz);
+    __m128 fx = _mm_sub_ps(lx, _mm_cvtepi32_ps(ix));
+    __m128 fz = _mm_sub_ps(lz, _mm_cvtepi32_ps(iz));
+
+    alignas(16) int bxs[4], bzs[4], ixs[4], izs[4];
+    _mm_store_si128((__m128i*)bxs, _mm_cvttps_epi32(bx));
+    _mm_store_si128((__m128i*)bzs, _mm_cvttps_epi32(bz));
+    _mm_store_si128((__m128i*)ixs, ix);
+    _mm_store_si128((__m128i*)izs, iz);
+
+    // SSE2 has no gather, the four corners are fetched per point
+    alignas(16) float h00[4], h10[4], h01[4], h11[4];
+    for (int k = 0; k < 4; k++) {
+        const uint16_t* p = blocks + ((size_t)bzs[k] * blocksPerEdge + bxs[k]) * blockStride
+                          + (size_t)izs[k] * blockSamples + ixs[k];
+        h00[k] = p[0];
+        h10[k] = p[1];
+        h01[k] = p[blockSamples];
+        h11[k] = p[blockSamples + 1];
+    }
+
+    __m128 top = _mm_load_ps(h00);
+    top = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h10), top), fx));
+    __m128 bottom = _mm_load_ps(h01);
+    bottom = _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(h11), bottom), fx));
+    __m128 h = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fz));
+    _mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(h, _mm_set1_ps(sampleScale)), _mm_set1_ps(heightOffset)));
+#else
+    for (int k = 0; k < 4; k++)
+        out[k] = heightAt(x[k], z[k]);
+#endif
+}
+
+void TerrainQuery::heightsAt(const glm::vec2* xz, float* heights, size_t count) const {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float x[4], z[4];
+        for (int k = 0; k < 4; k++) {
+            x[k] = xz[i + k].x;
+            z[k] = xz[i + k].y;
+        }
+        heights4(x, z, heights + i);
+    }
+    for (; i < count; i++)
+        heights[i] = heightAt(xz[i].x, xz[i].y);
+}
+
+void TerrainQuery::normalsAt(const glm::vec2* xz, glm::vec3* normals, size_t count) const {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // central differences, one batch per neighbour
+        float x[4], z[4], xl[4], xr[4], zd[4], zu[4];
+        for (int k = 0; k < 4; k++) {
+            x[k] = xz[i + k].x;
+            z[k] = xz[i + k].y;
+            xl[k] = x[k] - spacing;
+            xr[k] = x[k] + spacing;
+            zd[k] = z[k] - spacing;
+            zu[k] = z[k] + spacing;
+        }
+
+        float hL[4], hR[4], hD[4], hU[4];
+        heights4(xl, z, hL);
+        heights4(xr, z, hR);
+        heights4(x, zd, hD);
+        heights4(x, zu, hU);
+        for (int k = 0; k < 4; k++)
+            normals[i + k] = glm::normalize(glm::vec3(hL[k] - hR[k], 2.0f * spacing, hD[k] - hU[k]));
+    }
+    for (; i < count; i++)
+        normals[i] = normalAt(xz[i].x, xz[i].y);
+}
@@ -0,0 +1,319 @@
+#include "TerrainRaycast.h"
+#include <algorithm>
+#include <cmath>
+#include "TerrainBuilder.h"
+#include "TerrainQuery.h"
+
+#ifdef TERRAIN_RAY_BENCHMARK
+#include <chrono>
+#include <iostream>
+#include <random>
+#endif
+
+static const float RAY_INFINITY = 1e30f;
+
+// Rays per job when splitting a batch across cores
+static const int RAYS_PER_JOB = 256;
+
+// ------------------ Constructor ------------------
+TerrainRaycast::TerrainRaycast(const TerrainQuery& query) : query(query), gridSize(query.getGridSize()) {
+    while ((1 << nodeShift) < query.getNodeSize())
+        nodeShift++;
+    levelCount = nodeShift + query.getNodeLevels();
+
+    // cells inside a node, levels 1 to nodeShift - 1
+    fineOffset.assign(std::max(nodeShift, 1), 0);
+    size_t offset = 0;
+    for (int level = 1; level < nodeShift; level++) {
+        fineOffset[level] = offset;
+        size_t side = (size_t)1 << (nodeShift - level);
+        offset += side * side;
+    }
+    fineCellCount = offset;
+}
+
+void TerrainRaycast::update(int x0, int z0, int x1, int z1) {
+    // nodes sharing a vertex with the rectangle; coarser levels are the query's own
+    const int nodeSize = 1 << nodeShift;
+    const int nx0 = std::max(0, x0 - 1) / nodeSize, nx1 = x1 / nodeSize;
+    const int nz0 = std::max(0, z0 - 1) / nodeSize, nz1 = z1 / nodeSize;
+
+    std::lock_guard<std::shared_timed_mutex> lock(cacheMutex);
+    for (int nz = nz0; nz <= nz1; nz++)
+        for (int nx = nx0; nx <= nx1; nx++)
+            cachedNodes.erase(((uint64_t)nz << 32) | (uint32_t)nx);
+}
+
+std::shared_ptr<const TerrainRaycast::NodeCells> TerrainRaycast::nodeCells(int nx, int nz) const {
+    const uint64_t key = ((uint64_t)nz << 32) | (uint32_t)nx;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(cacheMutex);
+        auto it = cachedNodes.find(key);
+        if (it != cachedNodes.end())
+            return it->second;
+    }
+
+    // built outside the lock; two rays entering a new node at once may both build it
+    auto cells = std::make_shared<NodeCells>(fineCellCount);
+    for (int level = 1; level < nodeShift; level++) {
+        // level 1 takes the 3x3 vertices of each 2x2 quad cell, the rest merge children
+        const int side = 1 << (nodeShift - level);
+        uint16_t* dst = cells->data() + fineOffset[level];
+        for (int cz = 0; cz < side; cz++) {
+            for (int cx = 0; cx < side; cx++) {
+                uint16_t h = 0;
+                if (level == 1) {
+                    int x0 = (nx << nodeShift) + cx * 2, z0 = (nz << nodeShift) + cz * 2;
+                    for (int z = z0; z <= z0 + 2; z++)
+                        for (int x = x0; x <= x0 + 2; x++)
+                            h = std::max(h, query.sampleAt(x, z));
+                }
+                else {
+                    const uint16_t* children = cells->data() + fineOffset[level - 1];
+                    size_t childSide = (size_t)side * 2;
+                    size_t c = (size_t)cz * 2 * childSide + (size_t)cx * 2;
+                    h = std::max(std::max(children[c], children[c + 1]),
+                                 std::max(children[c + childSide], children[c + childSide + 1]));
+                }
+                dst[(size_t)cz * side + cx] = h;
+            }
+        }
+    }
+
+    std::lock_guard<std::shared_timed_mutex> lock(cacheMutex);
+    auto inserted = cachedNodes.emplace(key, std::move(cells));
+    if (inserted.second) {
+        cacheOrder.push_back(key);
+        // oldest first; keys already dropped by update() free nothing
+        while (cachedNodes.size() > (size_t)MAX_CACHED_NODES && !cacheOrder.empty()) {
+            if (cacheOrder.front() != key)
+                cachedNodes.erase(cacheOrder.front());
+            cacheOrder.pop_front();
+        }
+    }
+    return inserted.first->second;
+}
+
+float TerrainRaycast::cellMax(int level, int cx, int cz, NodeCursor& cursor) const {
+    if (level >= nodeShift)
+        return query.toHeight(query.nodeMax(level - nodeShift, cx, cz));
+
+    const int shift = nodeShift - level;
+    const int nx = cx >> shift, nz = cz >> shift;
+    if (!cursor.cells || nx != cursor.nx || nz != cursor.nz) {
+        cursor.cells = nodeCells(nx, nz);
+        cursor.nx = nx;
+        cursor.nz = nz;
+    }
+    const int side = 1 << shift;
+    return query.toHeight((*cursor.cells)[fineOffset[level] + (size_t)(cz - (nz << shift)) * side + (cx - (nx << shift))]);
+}
+
+// ------------------ Intersection ------------------
+// Moller-Trumbore, both sides
+static bool intersectTriangle(const glm::vec3& o, const glm::vec3& d,
+                              const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& t) {
+    glm::vec3 e1 = v1 - v0;
+    glm::vec3 e2 = v2 - v0;
+    glm::vec3 p = glm::cross(d, e2);
+    float det = glm::dot(e1, p);
+    if (std::fabs(det) < 1e-12f)
+        return false;
+
+    float inv = 1.0f / det;
+    glm::vec3 s = o - v0;
+    float u = glm::dot(s, p) * inv;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(d, q) * inv;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = glm::dot(e2, q) * inv;
+    return true;
+}
+
+// The two triangles of grid cell (cx, cz), in grid space (x, z in grid units, y in world units).
+// The corners are fetched once and also give the level 0 cell max.
+bool TerrainRaycast::intersectCell(int cx, int cz, const glm::vec3& o, const glm::vec3& d,
+                                   float tMin, float tMax, float yMin, float& t) const {
+    float h00 = query.sampleAt(cx, cz);
+    float h10 = query.sampleAt(cx + 1, cz);
+    float h01 = query.sampleAt(cx, cz + 1);
+    float h11 = query.sampleAt(cx + 1, cz + 1);
+    if (yMin > query.toHeight(std::max(std::max(h00, h10), std::max(h01, h11))))
+        return false;
+
+    glm::vec3 v00((float)cx, query.toHeight(h00), (float)cz);
+    glm::vec3 v10((float)(cx + 1), query.toHeight(h10), (float)cz);
+    glm::vec3 v01((float)cx, query.toHeight(h01), (float)(cz + 1));
+    glm::vec3 v11((float)(cx + 1), query.toHeight(h11), (float)(cz + 1));
+
+    // same diagonal as TerrainBuilder::buildPatchStrip
+    bool found = false;
+    float candidate;
+    t = tMax;
+    if (intersectTriangle(o, d, v00, v01, v10, candidate) && candidate >= tMin && candidate <= t) {
+        t = candidate;
+        found = true;
+    }
+    if (intersectTriangle(o, d, v10, v01, v11, candidate) && candidate >= tMin && candidate <= t) {
+        t = candidate;
+        found = true;
+    }
+    return found;
+}
+
+bool TerrainRaycast::march(const glm::vec3& origin, const glm::vec3& dir, float maxT, int topLevel,
+                           TerrainHit& hit) const {
+    hit = TerrainHit();
+
+    // grid space: x / z in grid units, y stays in world units, t is unchanged
+    const glm::vec2& gridOrigin = query.getOrigin();
+    const float spacing = query.getSpacing();
+    const glm::vec3 o((origin.x - gridOrigin.x) / spacing, origin.y, (origin.z - gridOrigin.y) / spacing);
+    const glm::vec3 d(dir.x / spacing, dir.y, dir.z / spacing);
+
+    // clip to the grid footprint
+    float tEnter = 0.0f, tExit = maxT;
+    for (int axis = 0; axis <= 2; axis += 2) {
+        if (std::fabs(d[axis]) < 1e-12f) {
+            if (o[axis] < 0.0f || o[axis] > (float)gridSize)
+                return false;
+            continue;
+        }
+        float t0 = (0.0f - o[axis]) / d[axis];
+        float t1 = ((float)gridSize - o[axis]) / d[axis];
+        tEnter = std::max(tEnter, std::min(t0, t1));
+        tExit = std::min(tExit, std::max(t0, t1));
+    }
+    if (tEnter > tExit)
+        return false;
+
+    // nudge towards the direction of travel, so a point on a cell edge picks the cell ahead
+    const float nudgeX = d.x > 0.0f ? 1e-3f : (d.x < 0.0f ? -1e-3f : 0.0f);
+    const float nudgeZ = d.z > 0.0f ? 1e-3f : (d.z < 0.0f ? -1e-3f : 0.0f);
+
+    const float invX = d.x != 0.0f ? 1.0f / d.x : 0.0f;
+    const float invZ = d.z != 0.0f ? 1.0f / d.z : 0.0f;
+    const int stepX = d.x > 0.0f ? 1 : 0;
+    const int stepZ = d.z > 0.0f ? 1 : 0;
+
+    NodeCursor cursor;
+    float t = tEnter;
+    int level = topLevel;
+    while (t <= tExit) {
+        const glm::vec3 p = o + d * t;
+        const int cells = gridSize >> level;
+
+        // p is inside the grid, so truncation is floor (a nudge just below 0 still gives 0)
+        int cx = std::min((int)(p.x + nudgeX) >> level, cells - 1);
+        int cz = std::min((int)(p.z + nudgeZ) >> level, cells - 1);
+
+        // where the ray leaves this cell
+        float tx = d.x != 0.0f ? ((float)((cx + stepX) << level) - o.x) * invX : RAY_INFINITY;
+        float tz = d.z != 0.0f ? ((float)((cz + stepZ) << level) - o.z) * invZ : RAY_INFINITY;
+        float tCell = std::min(std::min(tx, tz), tExit);
+        float next = std::max(tCell, t + 1e-6f * (1.0f + std::fabs(t)));
+
+        // after leaving the cell, go up a level only if the edge crossed is also the parent's
+        int boundary = (tx <= tz) ? (cx + stepX) << level : (cz + stepZ) << level;
+        int climbLevel = level;
+        if (climbLevel < topLevel && (boundary & (1 << climbLevel)) == 0)
+            climbLevel++;
+
+        // the ray is lowest at one end of the cell, skip it if that is still above everything inside
+        float yMin = std::min(p.y, o.y + d.y * tCell);
+        if (level > 0 && yMin > cellMax(level, cx, cz, cursor)) {
+            t = next;
+            level = climbLevel;
+            continue;
+        }
+
+        if (level == 0) {
+            float tHit;
+            if (intersectCell(cx, cz, o, d, tEnter, tExit, yMin, tHit)) {
+                hit.hit = true;
+                hit.t = tHit;
+                hit.position = origin + dir * tHit;
+                return true;
+            }
+            t = next;
+            level = climbLevel;
+            continue;
+        }
+        level--;
+    }
+    return false;
+}
+
+bool TerrainRaycast::intersect(const glm::vec3& origin, const glm::vec3& dir, float maxT, TerrainHit& hit) const {
+    return march(origin, dir, maxT, levelCount - 1, hit);
+}
+
+bool TerrainRaycast::intersectBruteForce(const glm::vec3& origin, const glm::vec3& dir, float maxT, TerrainHit& hit) const {
+    return march(origin, dir, maxT, 0, hit);
+}
+
+void TerrainRaycast::intersectBatch(const glm::vec3* origins, const glm::vec3* dirs, float maxT,
+                                    TerrainHit* hits, size_t count) const {
+    int jobs = (int)((count + RAYS_PER_JOB - 1) / RAYS_PER_JOB);
+    TerrainBuilder::parallelRows(jobs, [&](int jobBegin, int jobEnd) {
+        size_t end = std::min(count, (size_t)jobEnd * RAYS_PER_JOB);
+        for (size_t i = (size_t)jobBegin * RAYS_PER_JOB; i < end; i++)
+            intersect(origins[i], dirs[i], maxT, hits[i]);
+    });
+}
+
+// ------------------ Benchmark ------------------
+#ifdef TERRAIN_RAY_BENCHMARK
+void TerrainRaycast::benchmark(size_t rayCount) const {
+    // eye-level rays looking slightly down, from random points over the whole grid
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> pos(0.0f, (float)gridSize);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::uniform_real_distribution<float> slope(-0.3f, -0.01f);
+    std::uniform_real_distribution<float> eye(1.0f, 20.0f);
+
+    const glm::vec2& gridOrigin = query.getOrigin();
+    const float spacing = query.getSpacing();
+    std::vector<glm::vec3> origins(rayCount), dirs(rayCount);
+    for (size_t i = 0; i < rayCount; i++) {
+        float x = gridOrigin.x + pos(rng) * spacing;
+        float z = gridOrigin.y + pos(rng) * spacing;
+        float a = angle(rng);
+        origins[i] = glm::vec3(x, query.heightAt(x, z) + eye(rng), z);
+        dirs[i] = glm::normalize(glm::vec3(std::cos(a), slope(rng), std::sin(a)));
+    }
+
+    std::vector<TerrainHit> pyramid(rayCount), dda(rayCount), batch(rayCount);
+    using Clock = std::chrono::steady_clock;
+
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < rayCount; i++)
+        intersect(origins[i], dirs[i], RAY_INFINITY, pyramid[i]);
+    auto t1 = Clock::now();
+    for (size_t i = 0; i < rayCount; i++)
+        intersectBruteForce(origins[i], dirs[i], RAY_INFINITY, dda[i]);
+    auto t2 = Clock::now();
+    intersectBatch(origins.data(), dirs.data(), RAY_INFINITY, batch.data(), rayCount);
+    auto t3 = Clock::now();
+
+    size_t hits = 0, mismatches = 0;
+    for (size_t i = 0; i < rayCount; i++) {
+        hits += pyramid[i].hit;
+        if (pyramid[i].hit != dda[i].hit || (pyramid[i].hit && std::fabs(pyramid[i].t - dda[i].t) > 1e-3f))
+            mismatches++;
+    }
+
+    auto nsPerRay = [&](Clock::time_point a, Clock::time_point b) {
+        return std::chrono::duration<double, std::nano>(b - a).count() / rayCount;
+    };
+    std::cout << "Terrain rays: " << rayCount << " rays on a " << gridSize << "^2 grid, " << hits << " hits, "
+              << mismatches << " pyramid/DDA mismatches" << std::endl
+              << "  pyramid " << nsPerRay(t0, t1) << " ns/ray, DDA " << nsPerRay(t1, t2)
+              << " ns/ray, batched pyramid " << nsPerRay(t2, t3) << " ns/ray" << std::endl;
+}
+#endif
@@ -0,0 +1,195 @@
+#include "TerrainSimplifier.h"
+#include <algorithm>
+#include <cmath>
+
+// Corners of heap-numbered triangle i: a and b end the long edge, c is the right angle
+static void triangleCorners(long long i, int quads, int& ax, int& az, int& bx, int& bz, int& cx, int& cz) {
+    long long id = i + 2;
+    ax = az = bx = bz = cx = cz = 0;
+    if (id & 1) {
+        bx = bz = cx = quads;
+    }
+    else {
+        ax = az = cz = quads;
+    }
+    while ((id >>= 1) > 1) {
+        int mx = (ax + bx) >> 1;
+        int mz = (az + bz) >> 1;
+        if (id & 1) {
+            bx = ax; bz = az;
+            ax = cx; az = cz;
+        }
+        else {
+            ax = bx; az = bz;
+            bx = cx; bz = cz;
+        }
+        cx = mx;
+        cz = mz;
+    }
+}
+
+TerrainSimplifier::TerrainSimplifier(const TerrainGrid& grid) : grid(grid) {
+    const int size = grid.gridVerts;
+    const int quads = size - 1;
+    errors.assign((size_t)size * size, 0.0f);
+
+    // Triangles are numbered like a heap: 0 and 1 are the two halves of the
+    // grid and each depth is a contiguous id range. The deepest depth has
+    // legs of one cell diagonal; the half-cells below it cover no samples
+    // besides their corners, so they are left out.
+    int depthCount = 0;
+    while ((2ll << depthCount) - 2 < (long long)quads * quads * 2 - 2)
+        depthCount++;
+
+    std::vector<float> depthErrors;
+    for (int depth = depthCount - 1; depth >= 0; depth--) {
+        const long long first = (2ll << depth) - 2;
+        const long long count = 2ll << depth;
+        depthErrors.assign((size_t)count, 0.0f);
+
+        // true error of every triangle at this depth: the largest vertical
+        // distance between a sample it covers and its plane
+        const int blocks = (int)((count + 4095) / 4096);
+        TerrainBuilder::parallelRows(blocks, [&](int blockBegin, int blockEnd) {
+            long long end = std::min(count, (long long)blockEnd * 4096);
+            for (long long t = (long long)blockBegin * 4096; t < end; t++) {
+                int x[3], z[3];
+                triangleCorners(first + t, quads, x[0], z[0], x[1], z[1], x[2], z[2]);
+                float h[3] = { sample(x[0], z[0]), sample(x[1], z[1]), sample(x[2], z[2]) };
+
+                int area = (x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0]);
+                int minX = std::min({ x[0], x[1], x[2] }), maxX = std::max({ x[0], x[1], x[2] });
+                int minZ = std::min({ z[0], z[1], z[2] }), maxZ = std::max({ z[0], z[1], z[2] });
+
+                float error = 0.0f;
+                for (int pz = minZ; pz <= maxZ; pz++) {
+                    for (int px = minX; px <= maxX; px++) {
+                        // integer edge functions, same sign as area inside or on the edges
+                        int w1 = (px - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (pz - z[0]);
+                        int w2 = (x[1] - x[0]) * (pz - z[0]) - (px - x[0]) * (z[1] - z[0]);
+                        int w0 = area - w1 - w2;
+                        if ((area > 0) ? (w0 < 0 || w1 < 0 || w2 < 0) : (w0 > 0 || w1 > 0 || w2 > 0))
+                            continue;
+
+                        float interpolated = (w0 * h[0] + w1 * h[1] + w2 * h[2]) / area;
+                        error = std::max(error, std::fabs(interpolated - sample(px, pz)));
+                    }
+                }
+                depthErrors[(size_t)t] = error;
+            }
+        });
+
+        // Stored at the middle of the long edge, shared by both triangles of
+        // the diamond, and never below the children's so parents split first
+        for (long long t = 0; t < count; t++) {
+            int ax, az, bx, bz, cx, cz;
+            triangleCorners(first + t, quads, ax, az, bx, bz, cx, cz);
+
+            float error = depthErrors[(size_t)t];
+            if (depth < depthCount - 1) {
+                size_t left = (size_t)((az + cz) >> 1) * size + ((ax + cx) >> 1);
+                size_t right = (size_t)((bz + cz) >> 1) * size + ((bx + cx) >> 1);
+                error = std::max(error, std::max(errors[left], errors[right]));
+            }
+
+            size_t middle = (size_t)((az + bz) >> 1) * size + ((ax + bx) >> 1);
+            errors[middle] = std::max(errors[middle], error);
+        }
+    }
+}
+
+float TerrainSimplifier::sample(int x, int z) const {
+    x = std::max(0, std::min(x, grid.width - 1));
+    z = std::max(0, std::min(z, grid.height - 1));
+    return grid.heights[(size_t)z * grid.width + x];
+}
+
+// ------------------ Extraction ------------------
+void TerrainSimplifier::splitTriangle(int ax, int az, int bx, int bz, int cx, int cz,
+                                      float maxError, int maxSize, std::vector<unsigned int>& indices) const {
+    int mx = (ax + bx) >> 1;
+    int mz = (az + bz) >> 1;
+
+    // Split while the triangle is bigger than one grid cell and too far off, or
+    // larger than maxSize. The long edge decides the size and is shared with the
+    // neighbour across it, which splits too, so the mesh stays crack free.
+    bool tooLarge = maxSize > 0 && std::max(std::abs(ax - bx), std::abs(az - bz)) > maxSize;
+    if (tooLarge || (std::abs(ax - cx) + std::abs(az - cz) > 1 && errors[(size_t)mz * grid.gridVerts + mx] > maxError)) {
+        splitTriangle(cx, cz, ax, az, mx, mz, maxError, maxSize, indices);
+        splitTriangle(bx, bz, cx, cz, mx, mz, maxError, maxSize, indices);
+        return;
+    }
+
+    indices.push_back((unsigned int)(az * grid.gridVerts + ax));
+    indices.push_back((unsigned int)(bz * grid.gridVerts + bx));
+    indices.push_back((unsigned int)(cz * grid.gridVerts + cx));
+}
+
+void TerrainSimplifier::simplify(float maxError, std::vector<unsigned int>& indices, int maxSize) const {
+    const int quads = grid.gridVerts - 1;
+    indices.clear();
+    splitTriangle(0, 0, quads, quads, quads, 0, maxError, maxSize, indices);
+    splitTriangle(quads, quads, 0, 0, 0, quads, maxError, maxSize, indices);
+}
+
+// ------------------ Statistics ------------------
+TerrainSimplifyStats TerrainSimplifier::measure(const std::vector<unsigned int>& indices) const {
+    const int size = grid.gridVerts;
+    TerrainSimplifyStats stats;
+    stats.triangles = indices.size() / 3;
+    stats.fullTriangles = (size_t)(size - 1) * (size - 1) * 2;
+
+    std::vector<unsigned char> used((size_t)size * size, 0);
+    for (unsigned int index : indices)
+        used[index] = 1;
+    stats.vertices = (size_t)std::count(used.begin(), used.end(), 1);
+
+    // every sample is measured once, against the first triangle covering it
+    std::vector<unsigned char> measured((size_t)size * size, 0);
+    double sum = 0.0, sumSquares = 0.0;
+    size_t count = 0;
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        int x[3], z[3];
+        float h[3];
+        for (int k = 0; k < 3; k++) {
+            x[k] = (int)(indices[t + k] % size);
+            z[k] = (int)(indices[t + k] / size);
+            h[k] = sample(x[k], z[k]);
+        }
+
+        float area = (float)((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0]));
+        if (area == 0.0f)
+            continue;
+
+        int minX = std::min({ x[0], x[1], x[2] }), maxX = std::max({ x[0], x[1], x[2] });
+        int minZ = std::min({ z[0], z[1], z[2] }), maxZ = std::max({ z[0], z[1], z[2] });
+        for (int pz = minZ; pz <= maxZ; pz++) {
+            for (int px = minX; px <= maxX; px++) {
+                size_t index = (size_t)pz * size + px;
+                if (measured[index])
+                    continue;
+
+                // barycentric weights, all >= 0 inside or on the edges
+                float w1 = ((px - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (pz - z[0])) / area;
+                float w2 = ((x[1] - x[0]) * (pz - z[0]) - (px - x[0]) * (z[1] - z[0])) / area;
+                float w0 = 1.0f - w1 - w2;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+
+                measured[index] = 1;
+                float error = std::fabs(w0 * h[0] + w1 * h[1] + w2 * h[2] - sample(px, pz));
+                stats.maxError = std::max(stats.maxError, error);
+                sum += error;
+                sumSquares += (double)error * error;
+                count++;
+            }
+        }
+    }
+
+    if (count > 0) {
+        stats.meanError = (float)(sum / count);
+        stats.rmsError = (float)std::sqrt(sumSquares / count);
+    }
+    return stats;
+}
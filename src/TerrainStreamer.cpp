@@ -0,0 +1,194 @@
+#include "TerrainStreamer.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+static const uint64_t EMPTY_SLOT = ~0ull;
+
+uint64_t TerrainStreamer::tileKey(int level, int tx, int tz) {
+    return ((uint64_t)level << 48) | ((uint64_t)tz << 24) | (uint64_t)tx;
+}
+
+// ------------------ Constructor ------------------
+TerrainStreamer::TerrainStreamer(const TerrainTileFile& tiles, int slotCount) : tiles(tiles) {
+    const int top = (int)tiles.getHeader().levelCount - 1;
+    const int topTiles = tiles.tilesPerEdge(top);
+    if (slotCount <= topTiles * topTiles) {
+        std::cout << "Terrain streaming: " << slotCount << " slots cannot hold the "
+                  << topTiles * topTiles << " pinned top-level tiles" << std::endl;
+        return;
+    }
+
+    const int size = tiles.getTileSamples();
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, size, size, slotCount, 0, GL_RED, GL_UNSIGNED_SHORT, nullptr);
+
+    // only read with texelFetch, so no filtering or mips
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // normals are filtered, the apron keeps tile edges from bleeding
+    glGenTextures(1, &normalTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalTexture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG16F, size, size, slotCount, 0, GL_RG, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    slots.assign(slotCount, { EMPTY_SLOT, 0, false });
+
+    // the top level is uploaded straight from the mapping and stays resident
+    for (int tz = 0; tz < topTiles; tz++) {
+        for (int tx = 0; tx < topTiles; tx++) {
+            int slot = tz * topTiles + tx;
+            uint64_t key = tileKey(top, tx, tz);
+            slots[slot] = { key, 0, true };
+            resident[key] = slot;
+            upload(slot, tiles.getTile(top, tx, tz), tiles.getNormalTile(top, tx, tz));
+            tiles.releaseTile(top, tx, tz);
+        }
+    }
+
+    freeBuffers.resize(MAX_PENDING);
+    for (auto& buffer : freeBuffers)
+        buffer.resize((size_t)size * size * 3);
+
+    for (int i = 0; i < LOADER_THREADS; i++)
+        loaders.emplace_back(&TerrainStreamer::loaderLoop, this);
+}
+
+TerrainStreamer::~TerrainStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& loader : loaders)
+        loader.join();
+
+    if (texture)
+        glDeleteTextures(1, &texture);
+    if (normalTexture)
+        glDeleteTextures(1, &normalTexture);
+}
+
+// ------------------ Loader Threads ------------------
+void TerrainStreamer::loaderLoop() {
+    for (;;) {
+        uint64_t key;
+        std::vector<uint16_t> buffer;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !requests.empty(); });
+            if (stopping)
+                return;
+
+            // at most MAX_PENDING tiles are in flight, so a buffer is always free here
+            key = requests.front();
+            requests.pop_front();
+            buffer = std::move(freeBuffers.back());
+            freeBuffers.pop_back();
+        }
+
+        int level = (int)(key >> 48);
+        int tz = (int)((key >> 24) & 0xFFFFFF);
+        int tx = (int)(key & 0xFFFFFF);
+
+        // touching the mapping is what reads the tile from disk
+        std::memcpy(buffer.data(), tiles.getTile(level, tx, tz), tiles.getTileBytes());
+        std::memcpy(buffer.data() + tiles.getTileBytes() / sizeof(uint16_t),
+                    tiles.getNormalTile(level, tx, tz), tiles.getNormalTileBytes());
+        tiles.releaseTile(level, tx, tz);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back({ key, std::move(buffer) });
+    }
+}
+
+// ------------------ Main Thread ------------------
+int TerrainStreamer::acquire(int level, int tx, int tz) {
+    uint64_t key = tileKey(level, tx, tz);
+
+    auto it = resident.find(key);
+    if (it != resident.end()) {
+        slots[it->second].lastUsed = tick;
+        return it->second;
+    }
+
+    if (pending.size() < MAX_PENDING && pending.insert(key).second) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(key);
+        }
+        wake.notify_one();
+    }
+    return -1;
+}
+
+int TerrainStreamer::claimSlot() {
+    // an empty slot, or the least recently used one not needed since the last update
+    int best = -1;
+    for (int i = 0; i < (int)slots.size(); i++) {
+        const Slot& slot = slots[i];
+        if (slot.key == EMPTY_SLOT)
+            return i;
+        if (slot.pinned || slot.lastUsed + 1 >= tick)
+            continue;
+        if (best < 0 || slot.lastUsed < slots[best].lastUsed)
+            best = i;
+    }
+
+    if (best >= 0)
+        resident.erase(slots[best].key);
+    return best;
+}
+
+void TerrainStreamer::upload(int slot, const uint16_t* samples, const uint16_t* normals) {
+    const int size = tiles.getTileSamples();
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+    // rows of an odd number of 16-bit samples are only 2-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, size, size, 1, GL_RED, GL_UNSIGNED_SHORT, samples);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalTexture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, size, size, 1, GL_RG, GL_HALF_FLOAT, normals);
+}
+
+void TerrainStreamer::update() {
+    if (!texture)
+        return;
+    tick++;
+
+    std::vector<Load> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = std::min(finished.size(), (size_t)UPLOADS_PER_UPDATE);
+        ready.assign(std::make_move_iterator(finished.begin()), std::make_move_iterator(finished.begin() + count));
+        finished.erase(finished.begin(), finished.begin() + count);
+    }
+
+    for (auto& load : ready) {
+        // with every slot in use the tile is dropped and asked for again later
+        int slot = claimSlot();
+        if (slot >= 0) {
+            slots[slot] = { load.key, tick, false };
+            resident[load.key] = slot;
+            upload(slot, load.samples.data(), load.samples.data() + tiles.getTileBytes() / sizeof(uint16_t));
+        }
+        pending.erase(load.key);
+    }
+
+    if (!ready.empty()) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& load : ready)
+            freeBuffers.push_back(std::move(load.samples));
+    }
+}
@@ -0,0 +1,274 @@
+#include "TerrainTileFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <glm/gtc/packing.hpp>
+#include "ContentHash.h"
+#include "Heightmap.h"
+#include "TerrainBuilder.h"
+
+static bool hasExtension(const std::string& path, const char* ext) {
+    size_t n = std::strlen(ext);
+    return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+}
+
+// ------------------ Converter ------------------
+bool TerrainTileFile::convert(const std::string& sourcePath, const std::string& outPath,
+                              int patchSize, int tileSize) {
+    if (tileSize < patchSize || (tileSize & (tileSize - 1)) != 0) {
+        std::cout << "Terrain tiles: tile size must be a power of two >= the patch size" << std::endl;
+        return false;
+    }
+
+    // raw sources are mapped, images have to be decoded into memory
+    VirtualFile rawFile;
+    Heightmap image;
+    const uint16_t* samples = nullptr;
+    int width = 0, height = 0;
+
+    if (hasExtension(sourcePath, ".raw") || hasExtension(sourcePath, ".r16")) {
+        if (!rawFile.open(sourcePath))
+            return false;
+        size_t count = rawFile.getSize() / sizeof(uint16_t);
+        int side = (int)std::lround(std::sqrt((double)count));
+        if (side < 2 || (size_t)side * side != count) {
+            std::cout << "Raw heightmap is not a square 16-bit grid: " << sourcePath << std::endl;
+            return false;
+        }
+        samples = (const uint16_t*)rawFile.getData();
+        width = height = side;
+    }
+    else {
+        if (!image.load(sourcePath))
+            return false;
+        samples = image.samples.data();
+        width = image.width;
+        height = image.height;
+    }
+
+    auto sample = [&](int x, int z) {
+        x = std::max(0, std::min(x, width - 1));
+        z = std::max(0, std::min(z, height - 1));
+        return samples[(size_t)z * width + x];
+    };
+
+    // same grid and level count as Terrain::buildLevels()
+    TerrainTileHeader header = {};
+    header.version = VERSION;
+    header.width = width;
+    header.height = height;
+    header.patchSize = patchSize;
+    header.tileSize = tileSize;
+    if (!ContentHash::hashFile(sourcePath, header.sourceHash))
+        return false;
+
+    int gridSize = patchSize;
+    while (gridSize < std::max(width, height) - 1)
+        gridSize *= 2;
+    int levelCount = 1;
+    while ((patchSize << levelCount) <= gridSize)
+        levelCount++;
+    header.gridSize = gridSize;
+    header.levelCount = levelCount;
+
+    // node bounds, leaves scan every sample and parents merge their children
+    std::vector<std::vector<uint16_t>> nodes(levelCount);
+    size_t nodeBytes = 0;
+    for (int level = 0; level < levelCount; level++) {
+        int nodeSize = patchSize << level;
+        int count = gridSize / nodeSize;
+        nodes[level].resize((size_t)count * count * 2);
+        nodeBytes += nodes[level].size() * sizeof(uint16_t);
+
+        TerrainBuilder::parallelRows(count, [&, level, nodeSize, count](int rowBegin, int rowEnd) {
+            for (int nz = rowBegin; nz < rowEnd; nz++) {
+                for (int nx = 0; nx < count; nx++) {
+                    uint16_t lo = 0xFFFF, hi = 0;
+                    if (level == 0) {
+                        for (int z = nz * nodeSize; z <= (nz + 1) * nodeSize; z++) {
+                            for (int x = nx * nodeSize; x <= (nx + 1) * nodeSize; x++) {
+                                uint16_t h = sample(x, z);
+                                lo = std::min(lo, h);
+                                hi = std::max(hi, h);
+                            }
+                        }
+                    }
+                    else {
+                        const std::vector<uint16_t>& children = nodes[level - 1];
+                        int childCount = count * 2;
+                        for (int j = 0; j < 2; j++) {
+                            for (int i = 0; i < 2; i++) {
+                                size_t c = ((size_t)(nz * 2 + j) * childCount + (nx * 2 + i)) * 2;
+                                lo = std::min(lo, children[c]);
+                                hi = std::max(hi, children[c + 1]);
+                            }
+                        }
+                    }
+                    nodes[level][((size_t)nz * count + nx) * 2] = lo;
+                    nodes[level][((size_t)nz * count + nx) * 2 + 1] = hi;
+                }
+            }
+        });
+    }
+
+    header.nodeOffset = sizeof(TerrainTileHeader);
+    header.tileOffset = header.nodeOffset + nodeBytes;
+
+    std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to create terrain tile file: " << outPath << std::endl;
+        return false;
+    }
+    // a placeholder header without the magic, so a file cut short by an
+    // interrupted conversion fails isCurrent() and is converted again
+    out.write((const char*)&header, sizeof(header));
+    for (const auto& level : nodes)
+        out.write((const char*)level.data(), level.size() * sizeof(uint16_t));
+
+    // tiles, one row of tiles at a time so only that row is ever in memory
+    const int tileSamples = tileSize + 3;
+    const size_t tileCount = (size_t)tileSamples * tileSamples;
+    std::vector<uint16_t> row;
+    for (int level = 0; level < levelCount; level++) {
+        int tiles = std::max(1, (gridSize >> level) / tileSize);
+        row.resize(tileCount * tiles);
+
+        for (int tz = 0; tz < tiles; tz++) {
+            TerrainBuilder::parallelRows(tiles, [&, level, tz](int tileBegin, int tileEnd) {
+                for (int tx = tileBegin; tx < tileEnd; tx++) {
+                    uint16_t* dst = row.data() + tileCount * tx;
+                    for (int j = 0; j < tileSamples; j++) {
+                        int z = (tz * tileSize + j - 1) << level;
+                        for (int i = 0; i < tileSamples; i++)
+                            *dst++ = sample((tx * tileSize + i - 1) << level, z);
+                    }
+                }
+            });
+            out.write((const char*)row.data(), row.size() * sizeof(uint16_t));
+        }
+    }
+
+    // normal tiles, slopes over the level's own sample spacing so coarse tiles are filtered
+    header.normalOffset = (uint64_t)out.tellp();
+    std::vector<uint16_t> normalRow;
+    for (int level = 0; level < levelCount; level++) {
+        int tiles = std::max(1, (gridSize >> level) / tileSize);
+        int step = 1 << level;
+        float invSpan = 1.0f / (2.0f * step);
+        normalRow.resize(tileCount * 2 * tiles);
+
+        for (int tz = 0; tz < tiles; tz++) {
+            TerrainBuilder::parallelRows(tiles, [&, level, tz, step, invSpan](int tileBegin, int tileEnd) {
+                for (int tx = tileBegin; tx < tileEnd; tx++) {
+                    uint16_t* dst = normalRow.data() + tileCount * 2 * tx;
+                    for (int j = 0; j < tileSamples; j++) {
+                        int z = (tz * tileSize + j - 1) << level;
+                        for (int i = 0; i < tileSamples; i++) {
+                            int x = (tx * tileSize + i - 1) << level;
+                            float dx = ((float)sample(x + step, z) - (float)sample(x - step, z)) * invSpan;
+                            float dz = ((float)sample(x, z + step) - (float)sample(x, z - step)) * invSpan;
+                            *dst++ = glm::packHalf1x16(dx);
+                            *dst++ = glm::packHalf1x16(dz);
+                        }
+                    }
+                }
+            });
+            out.write((const char*)normalRow.data(), normalRow.size() * sizeof(uint16_t));
+        }
+    }
+
+    // the real header goes in last, once everything else is written
+    out.flush();
+    std::memcpy(header.magic, "TTP1", 4);
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+
+    if (!out) {
+        std::cout << "Failed to write terrain tile file: " << outPath << std::endl;
+        return false;
+    }
+
+    std::cout << "Terrain tiles: " << sourcePath << " -> " << outPath << " (" << width << "x" << height
+              << ", " << levelCount << " levels, " << tileSize << " quad tiles)" << std::endl;
+    return true;
+}
+
+// ------------------ Reading ------------------
+bool TerrainTileFile::isCurrent(const std::string& path, uint64_t sourceHash) {
+    TerrainTileHeader existing = {};
+    VirtualFile in;
+    if (!VirtualFileSystem::instance().exists(path) || !in.open(path) || in.getSize() < sizeof(existing))
+        return false;
+    std::memcpy(&existing, in.getData(), sizeof(existing));
+    return std::memcmp(existing.magic, "TTP1", 4) == 0 && existing.version == VERSION &&
+           existing.sourceHash == sourceHash;
+}
+
+bool TerrainTileFile::open(const std::string& path) {
+    if (!file.open(path))
+        return false;
+
+    if (file.getSize() < sizeof(TerrainTileHeader)) {
+        std::cout << "Terrain tile file is truncated: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, "TTP1", 4) != 0 || header.version != VERSION ||
+        header.levelCount == 0 || header.levelCount > 32) {
+        std::cout << "Not a terrain tile file (or an old version): " << path << std::endl;
+        return false;
+    }
+
+    uint64_t nodeOffset = header.nodeOffset;
+    uint64_t tileOffset = header.tileOffset;
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        uint64_t nodes = header.gridSize / (header.patchSize << level);
+        levelNodeOffset[level] = nodeOffset;
+        nodeOffset += nodes * nodes * 2 * sizeof(uint16_t);
+
+        uint64_t tiles = tilesPerEdge(level);
+        levelTileOffset[level] = tileOffset;
+        tileOffset += tiles * tiles * getTileBytes();
+    }
+
+    if (tileOffset > header.normalOffset ||
+        header.normalOffset + (tileOffset - header.tileOffset) * 2 > file.getSize()) {
+        std::cout << "Terrain tile file is truncated: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int TerrainTileFile::tilesPerEdge(int level) const {
+    return std::max(1, (int)(header.gridSize >> level) / (int)header.tileSize);
+}
+
+size_t TerrainTileFile::tileByteOffset(int level, int tx, int tz) const {
+    return (size_t)levelTileOffset[level] + ((size_t)tz * tilesPerEdge(level) + tx) * getTileBytes();
+}
+
+const uint16_t* TerrainTileFile::getTile(int level, int tx, int tz) const {
+    return (const uint16_t*)(file.getData() + tileByteOffset(level, tx, tz));
+}
+
+size_t TerrainTileFile::normalTileByteOffset(int level, int tx, int tz) const {
+    // normal tiles follow the height tiles' order at twice their size
+    return (size_t)header.normalOffset + (tileByteOffset(level, tx, tz) - (size_t)header.tileOffset) * 2;
+}
+
+const uint16_t* TerrainTileFile::getNormalTile(int level, int tx, int tz) const {
+    return (const uint16_t*)(file.getData() + normalTileByteOffset(level, tx, tz));
+}
+
+const uint16_t* TerrainTileFile::getNodeBounds(int level, int nx, int nz) const {
+    int count = header.gridSize / (header.patchSize << level);
+    return (const uint16_t*)(file.getData() + levelNodeOffset[level]) + ((size_t)nz * count + nx) * 2;
+}
+
+void TerrainTileFile::releaseTile(int level, int tx, int tz) const {
+    file.release(tileByteOffset(level, tx, tz), getTileBytes());
+    file.release(normalTileByteOffset(level, tx, tz), getNormalTileBytes());
+}
@@ -0,0 +1,589 @@
+#include "TerrainVirtualTexture.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "stb_image.h"
+#include "TerrainBuilder.h"
+#include "TerrainQuery.h"
+#include "VirtualFileSystem.h"
+
+// Splat map texels along one edge, over the whole terrain
+static const int SPLAT_SIZE = 1024;
+
+// Feedback encodes page x / y in 10 bits each
+static const int MAX_PAGES_PER_EDGE = 1024;
+
+static const int SLOT_SIZE = TerrainVirtualTexture::PAGE_SIZE + 2 * TerrainVirtualTexture::PAGE_BORDER;
+
+static const uint32_t EMPTY_PAGE = ~0u;
+
+static float smoothstep(float edge0, float edge1, float x) {
+    float t = glm::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Box filter an RGBA8 image down to dstW x dstH
+static void downsample(const unsigned char* src, int srcW, int srcH, unsigned char* dst, int dstW, int dstH) {
+    TerrainBuilder::parallelRows(dstH, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            int y0 = y * srcH / dstH, y1 = std::max(y0 + 1, (y + 1) * srcH / dstH);
+            for (int x = 0; x < dstW; x++) {
+                int x0 = x * srcW / dstW, x1 = std::max(x0 + 1, (x + 1) * srcW / dstW);
+                unsigned int sum[4] = {};
+                for (int sy = y0; sy < y1; sy++)
+                    for (int sx = x0; sx < x1; sx++)
+                        for (int c = 0; c < 4; c++)
+                            sum[c] += src[((size_t)sy * srcW + sx) * 4 + c];
+                unsigned int count = (unsigned int)((y1 - y0) * (x1 - x0));
+                for (int c = 0; c < 4; c++)
+                    dst[((size_t)y * dstW + x) * 4 + c] = (unsigned char)((sum[c] + count / 2) / count);
+            }
+        }
+    });
+}
+
+// ------------------ Constructor ------------------
+TerrainVirtualTexture::TerrainVirtualTexture(const TerrainQuery& query, const std::vector<TerrainMaterialLayer>& layers,
+                                             float texelsPerUnit, int screenWidth, int screenHeight) {
+    origin = query.getOrigin();
+    worldSize = query.getGridSize() * query.getSpacing();
+
+    // virtual size rounded up to a power of two pages
+    float virtualTexels = worldSize * texelsPerUnit;
+    pagesPerEdge = 1;
+    while (pagesPerEdge * PAGE_SIZE < virtualTexels && pagesPerEdge < MAX_PAGES_PER_EDGE)
+        pagesPerEdge *= 2;
+    mipCount = 1;
+    while ((1 << (mipCount - 1)) < pagesPerEdge)
+        mipCount++;
+
+    for (size_t i = 0; i < layers.size() && i < (size_t)MAX_LAYERS; i++)
+        if (!loadLayer(layers[i]))
+            return;
+    if (layerTextures.empty()) {
+        std::cout << "Terrain virtual texture: no material layers" << std::endl;
+        return;
+    }
+    bakeSplatMap(query);
+
+    // physical page atlas and the framebuffer pages are composited through
+    const int atlasSize = ATLAS_PAGES * SLOT_SIZE;
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &atlasFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, atlasFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas, 0);
+    bool atlasComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // page table, one texel per virtual page at every mip
+    glGenTextures(1, &pageTable);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    tableMips.resize(mipCount);
+    dirty.assign(mipCount, glm::ivec4(1, 1, 0, 0));
+    for (int mip = 0; mip < mipCount; mip++) {
+        int size = pagesPerEdge >> mip;
+        tableMips[mip].assign((size_t)size * size, 0);
+        glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, tableMips[mip].data());
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // low resolution feedback target, read back through two pixel buffers
+    feedbackWidth = std::max(1, screenWidth / FEEDBACK_DIVISOR);
+    feedbackHeight = std::max(1, screenHeight / FEEDBACK_DIVISOR);
+    glGenTextures(1, &feedbackColor);
+    glBindTexture(GL_TEXTURE_2D, feedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, feedbackWidth, feedbackHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenRenderbuffers(1, &feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+
+    glGenFramebuffers(1, &feedbackFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    bool feedbackComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (!atlasComplete || !feedbackComplete) {
+        std::cout << "Terrain virtual texture: framebuffer not complete" << std::endl;
+        return;
+    }
+
+    glGenBuffers(2, pixelBuffers);
+    for (unsigned int buffer : pixelBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)feedbackWidth * feedbackHeight * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // pages are drawn as one full-slot triangle, positions come from gl_VertexID
+    glGenVertexArrays(1, &quadVAO);
+    compositeShader = std::make_unique<Shader>("shaders/terrain_vt_composite.vs", "shaders/terrain_vt_composite.fs");
+
+    // the single top mip page is always resident, so every lookup finds something
+    slots.assign(ATLAS_PAGES * ATLAS_PAGES, { EMPTY_PAGE, 0, false });
+    uint32_t top = pageKey(mipCount - 1, 0, 0);
+    requests.assign(1, top);
+    ready = true;
+    update();
+    slots[resident[top]].pinned = true;
+
+    std::cout << "Terrain virtual texture: " << pagesPerEdge * PAGE_SIZE << "^2 texels, " << mipCount
+              << " mips, " << slots.size() << " page atlas, " << layerTextures.size() << " layers" << std::endl;
+}
+
+TerrainVirtualTexture::~TerrainVirtualTexture() {
+    glDeleteTextures(1, &pageTable);
+    glDeleteTextures(1, &atlas);
+    glDeleteTextures(1, &splatMap);
+    glDeleteTextures(1, &feedbackColor);
+    glDeleteRenderbuffers(1, &feedbackDepth);
+    glDeleteFramebuffers(1, &atlasFBO);
+    glDeleteFramebuffers(1, &feedbackFBO);
+    glDeleteBuffers(2, pixelBuffers);
+    glDeleteVertexArrays(1, &quadVAO);
+    if (!layerTextures.empty())
+        glDeleteTextures((GLsizei)layerTextures.size(), layerTextures.data());
+}
+
+// ------------------ Material ------------------
+bool TerrainVirtualTexture::loadLayer(const TerrainMaterialLayer& layer) {
+    VirtualFile file;
+    if (!file.open(layer.path)) {
+        std::cout << "Failed to open terrain material " << layer.path << std::endl;
+        return false;
+    }
+
+    int width, height, channels;
+    unsigned char* data = stbi_load_from_memory(file.getData(), (int)file.getSize(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!data) {
+        std::cout << "Failed to load terrain material " << layer.path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    // layers only feed the page compositor, so they never need more than MAX_LAYER_SIZE
+    std::vector<unsigned char> resized;
+    const unsigned char* pixels = data;
+    if (std::max(width, height) > MAX_LAYER_SIZE) {
+        int dstW = std::max(1, width * MAX_LAYER_SIZE / std::max(width, height));
+        int dstH = std::max(1, height * MAX_LAYER_SIZE / std::max(width, height));
+        resized.resize((size_t)dstW * dstH * 4);
+        downsample(data, width, height, resized.data(), dstW, dstH);
+        pixels = resized.data();
+        width = dstW;
+        height = dstH;
+    }
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    stbi_image_free(data);
+
+    layerTextures.push_back(texture);
+    layerTiles.push_back(layer.tileSize);
+    return true;
+}
+
+void TerrainVirtualTexture::bakeSplatMap(const TerrainQuery& query) {
+    splatLevels.clear();
+    for (int size = SPLAT_SIZE; size >= 1; size /= 2)
+        splatLevels.emplace_back((size_t)size * size * 4);
+    bakeSplatRect(query, 0, 0, SPLAT_SIZE, SPLAT_SIZE);
+
+    // every level from the CPU copy, so later edits can patch them the same way
+    glGenTextures(1, &splatMap);
+    glBindTexture(GL_TEXTURE_2D, splatMap);
+    for (int level = 0; level < (int)splatLevels.size(); level++) {
+        int size = SPLAT_SIZE >> level;
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, splatLevels[level].data());
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Splat texels [x0, x1) x [z0, z1) into splatLevels, every level's texels over them box filtered again
+void TerrainVirtualTexture::bakeSplatRect(const TerrainQuery& query, int x0, int z0, int x1, int z1) {
+    // layer 0 everywhere, layer 1 on high ground, layer 2 on steep slopes;
+    // the weights of missing layers stay on layer 0
+    const float low = query.toHeight(0.0f), high = query.toHeight(65535.0f);
+    const int layerCount = (int)layerTextures.size();
+    const int width = x1 - x0;
+    std::vector<unsigned char>& weights = splatLevels[0];
+
+    TerrainBuilder::parallelRows(z1 - z0, [&](int rowBegin, int rowEnd) {
+        std::vector<glm::vec2> xz(width);
+        std::vector<float> heights(width);
+        std::vector<glm::vec3> normals(width);
+
+        for (int z = z0 + rowBegin; z < z0 + rowEnd; z++) {
+            for (int x = 0; x < width; x++)
+                xz[x] = origin + (glm::vec2((float)(x0 + x), (float)z) + 0.5f) * (worldSize / SPLAT_SIZE);
+            query.heightsAt(xz.data(), heights.data(), width);
+            query.normalsAt(xz.data(), normals.data(), width);
+
+            for (int x = 0; x < width; x++) {
+                float rock = layerCount > 2 ? smoothstep(0.85f, 0.7f, normals[x].y) : 0.0f;
+                float upper = layerCount > 1 ? smoothstep(0.5f, 0.65f, (heights[x] - low) / (high - low)) : 0.0f;
+                glm::vec4 w((1.0f - rock) * (1.0f - upper), (1.0f - rock) * upper, rock, 0.0f);
+
+                unsigned char* dst = weights.data() + ((size_t)z * SPLAT_SIZE + x0 + x) * 4;
+                for (int c = 0; c < 4; c++)
+                    dst[c] = (unsigned char)std::lround(w[c] * 255.0f);
+            }
+        }
+    });
+
+    // SPLAT_SIZE is a power of two, so level texels cover exactly 2x2 of the level above
+    for (int level = 1; level < (int)splatLevels.size(); level++) {
+        const int size = SPLAT_SIZE >> level;
+        const unsigned char* src = splatLevels[level - 1].data();
+        unsigned char* dst = splatLevels[level].data();
+        x0 >>= 1;
+        z0 >>= 1;
+        x1 = std::max(x0 + 1, (x1 + 1) >> 1);
+        z1 = std::max(z0 + 1, (z1 + 1) >> 1);
+        for (int z = z0; z < z1; z++) {
+            for (int x = x0; x < x1; x++) {
+                for (int c = 0; c < 4; c++) {
+                    unsigned int sum = src[((size_t)(z * 2) * size * 2 + x * 2) * 4 + c] +
+                                       src[((size_t)(z * 2) * size * 2 + x * 2 + 1) * 4 + c] +
+                                       src[((size_t)(z * 2 + 1) * size * 2 + x * 2) * 4 + c] +
+                                       src[((size_t)(z * 2 + 1) * size * 2 + x * 2 + 1) * 4 + c];
+                    dst[((size_t)z * size + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+void TerrainVirtualTexture::invalidate(const TerrainQuery& query, const glm::vec2& minXZ, const glm::vec2& maxXZ) {
+    if (!ready)
+        return;
+
+    // splat texels whose heights or normals (central differences) read the changed ground
+    const float splatTexel = worldSize / SPLAT_SIZE;
+    const glm::vec2 lo = minXZ - 2.0f * query.getSpacing(), hi = maxXZ + 2.0f * query.getSpacing();
+    int x0 = std::max(0, (int)std::floor((lo.x - origin.x) / splatTexel - 0.5f));
+    int z0 = std::max(0, (int)std::floor((lo.y - origin.y) / splatTexel - 0.5f));
+    int x1 = std::min(SPLAT_SIZE, (int)std::ceil((hi.x - origin.x) / splatTexel - 0.5f) + 1);
+    int z1 = std::min(SPLAT_SIZE, (int)std::ceil((hi.y - origin.y) / splatTexel - 0.5f) + 1);
+    if (x0 >= x1 || z0 >= z1)
+        return;
+    bakeSplatRect(query, x0, z0, x1, z1);
+
+    glBindTexture(GL_TEXTURE_2D, splatMap);
+    for (int level = 0; level < (int)splatLevels.size(); level++) {
+        int size = SPLAT_SIZE >> level;
+        int lx0 = x0 >> level, lz0 = z0 >> level;
+        int lx1 = std::max(lx0 + 1, (x1 + (1 << level) - 1) >> level), lz1 = std::max(lz0 + 1, (z1 + (1 << level) - 1) >> level);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+        glTexSubImage2D(GL_TEXTURE_2D, level, lx0, lz0, lx1 - lx0, lz1 - lz0, GL_RGBA, GL_UNSIGNED_BYTE,
+                        splatLevels[level].data() + ((size_t)lz0 * size + lx0) * 4);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // resident pages that sample those texels: a page reads its border and a bilinear,
+    // trilinear splat lookup about one of its texels wide
+    const glm::vec2 splatLo = origin + glm::vec2((float)x0, (float)z0) * splatTexel;
+    const glm::vec2 splatHi = origin + glm::vec2((float)x1, (float)z1) * splatTexel;
+    const float virtualTexel = worldSize / (pagesPerEdge * PAGE_SIZE);
+    for (const auto& entry : resident) {
+        uint32_t page = entry.first;
+        float texel = virtualTexel * (float)(1 << keyMip(page));
+        float margin = (PAGE_BORDER + 1) * texel + 2.0f * std::max(splatTexel, texel);
+        glm::vec2 pageLo = origin + glm::vec2((float)keyX(page), (float)keyY(page)) * (PAGE_SIZE * texel) - margin;
+        glm::vec2 pageHi = pageLo + PAGE_SIZE * texel + 2.0f * margin;
+        if (pageLo.x < splatHi.x && pageHi.x > splatLo.x && pageLo.y < splatHi.y && pageHi.y > splatLo.y &&
+            std::find(stale.begin(), stale.end(), page) == stale.end())
+            stale.push_back(page);
+    }
+}
+
+// ------------------ Feedback ------------------
+void TerrainVirtualTexture::beginFeedback(const Shader& feedbackShader) {
+    if (!ready)
+        return;
+
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+
+    // alpha 0 marks pixels without terrain
+    GLfloat clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+    bind(feedbackShader);
+    // derivatives are FEEDBACK_DIVISOR times larger at the feedback resolution
+    feedbackShader.setFloat("vtLodBias", -std::log2((float)FEEDBACK_DIVISOR));
+}
+
+void TerrainVirtualTexture::endFeedback() {
+    if (!ready)
+        return;
+
+    // start the copy now, it is mapped next frame once the GPU is done with it
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[feedbackReads % 2]);
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    feedbackReads++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void TerrainVirtualTexture::readFeedback(const unsigned char* pixels) {
+    std::vector<uint32_t> pages;
+    pages.reserve((size_t)feedbackWidth * feedbackHeight);
+    for (size_t i = 0; i < (size_t)feedbackWidth * feedbackHeight; i++) {
+        const unsigned char* p = pixels + i * 4;
+        if (p[3] == 0)
+            continue;
+        int x = p[0] | ((p[2] & 3) << 8);
+        int y = p[1] | (((p[2] >> 2) & 3) << 8);
+        int mip = p[2] >> 4;
+        if (mip < mipCount && x < (pagesPerEdge >> mip) && y < (pagesPerEdge >> mip))
+            pages.push_back(pageKey(mip, x, y));
+    }
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    // every visible page and its ancestors are either kept alive or requested
+    std::vector<uint32_t> wanted;
+    for (uint32_t page : pages) {
+        int x = keyX(page), y = keyY(page);
+        for (int mip = keyMip(page); mip < mipCount; mip++, x >>= 1, y >>= 1)
+            wanted.push_back(pageKey(mip, x, y));
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+    for (uint32_t page : wanted) {
+        auto it = resident.find(page);
+        if (it != resident.end())
+            slots[it->second].lastUsed = frame;
+        else
+            requests.push_back(page);
+    }
+}
+
+// ------------------ Pages ------------------
+int TerrainVirtualTexture::claimSlot() {
+    // an empty slot, or the least recently used one not needed this frame
+    int best = -1;
+    for (int i = 0; i < (int)slots.size(); i++) {
+        const Slot& slot = slots[i];
+        if (slot.page == EMPTY_PAGE)
+            return i;
+        if (slot.pinned || slot.lastUsed >= frame)
+            continue;
+        if (best < 0 || slot.lastUsed < slots[best].lastUsed)
+            best = i;
+    }
+
+    if (best >= 0) {
+        resident.erase(slots[best].page);
+        markDirty(slots[best].page);
+    }
+    return best;
+}
+
+void TerrainVirtualTexture::composite(uint32_t page, int slot) {
+    int mip = keyMip(page);
+    float texelScale = (float)(1 << mip);
+    glm::vec2 slotOrigin((float)(slot % ATLAS_PAGES * SLOT_SIZE), (float)(slot / ATLAS_PAGES * SLOT_SIZE));
+
+    compositeShader->setVec2("slotOrigin", slotOrigin);
+    compositeShader->setVec2("pageOrigin", glm::vec2((float)keyX(page), (float)keyY(page)) * (PAGE_SIZE * texelScale));
+    compositeShader->setFloat("texelScale", texelScale);
+
+    glViewport((GLint)slotOrigin.x, (GLint)slotOrigin.y, SLOT_SIZE, SLOT_SIZE);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    slots[slot] = { page, frame, false };
+    resident[page] = slot;
+    markDirty(page);
+}
+
+void TerrainVirtualTexture::markDirty(uint32_t page) {
+    // a page decides the table entries of its whole subtree
+    int mip = keyMip(page);
+    for (int level = mip; level >= 0; level--) {
+        int shift = mip - level;
+        glm::ivec4 rect(keyX(page) << shift, keyY(page) << shift,
+                        ((keyX(page) + 1) << shift) - 1, ((keyY(page) + 1) << shift) - 1);
+        glm::ivec4& d = dirty[level];
+        if (d.x > d.z)
+            d = rect;
+        else
+            d = glm::ivec4(std::min(d.x, rect.x), std::min(d.y, rect.y), std::max(d.z, rect.z), std::max(d.w, rect.w));
+    }
+}
+
+void TerrainVirtualTexture::updatePageTable() {
+    // coarse to fine, so a hole can copy its parent's entry
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    std::vector<uint32_t> upload;
+    for (int mip = mipCount - 1; mip >= 0; mip--) {
+        glm::ivec4& d = dirty[mip];
+        if (d.x > d.z)
+            continue;
+
+        int size = pagesPerEdge >> mip;
+        std::vector<uint32_t>& table = tableMips[mip];
+        upload.clear();
+        for (int y = d.y; y <= d.w; y++) {
+            for (int x = d.x; x <= d.z; x++) {
+                uint32_t entry = 0;
+                auto it = resident.find(pageKey(mip, x, y));
+                if (it != resident.end()) {
+                    int slot = it->second;
+                    entry = (uint32_t)(slot % ATLAS_PAGES) | ((uint32_t)(slot / ATLAS_PAGES) << 8) |
+                            ((uint32_t)mip << 16) | 0xFF000000u;
+                }
+                else if (mip + 1 < mipCount) {
+                    entry = tableMips[mip + 1][(size_t)(y >> 1) * (size >> 1) + (x >> 1)];
+                }
+                table[(size_t)y * size + x] = entry;
+                upload.push_back(entry);
+            }
+        }
+
+        glTexSubImage2D(GL_TEXTURE_2D, mip, d.x, d.y, d.z - d.x + 1, d.w - d.y + 1, GL_RGBA, GL_UNSIGNED_BYTE, upload.data());
+        d = glm::ivec4(1, 1, 0, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// ------------------ Update ------------------
+void TerrainVirtualTexture::update() {
+    if (!ready)
+        return;
+
+    // the buffer written last frame
+    if (feedbackReads >= 2) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[feedbackReads % 2]);
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+            (size_t)feedbackWidth * feedbackHeight * 4, GL_MAP_READ_BIT);
+        if (pixels)
+            readFeedback(pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    if (!requests.empty() || !stale.empty()) {
+        // coarse pages first, they stand in for everything below them
+        auto coarseFirst = [](uint32_t a, uint32_t b) { return keyMip(a) > keyMip(b); };
+        std::sort(requests.begin(), requests.end(), coarseFirst);
+        std::stable_sort(stale.begin(), stale.end(), coarseFirst);
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        GLboolean cull = glIsEnabled(GL_CULL_FACE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, atlasFBO);
+        compositeShader->use();
+        compositeShader->setVec2("terrainOrigin", origin);
+        compositeShader->setFloat("worldSize", worldSize);
+        compositeShader->setFloat("texelsPerUnit", pagesPerEdge * PAGE_SIZE / worldSize);
+        compositeShader->setFloat("pageBorder", (float)PAGE_BORDER);
+        compositeShader->setInt("layerCount", (int)layerTextures.size());
+        compositeShader->setInt("splatMap", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, splatMap);
+        for (int i = 0; i < MAX_LAYERS; i++) {
+            int layer = std::min(i, (int)layerTextures.size() - 1);
+            compositeShader->setInt("layers[" + std::to_string(i) + "]", 1 + i);
+            compositeShader->setFloat("layerTiles[" + std::to_string(i) + "]", layerTiles[layer]);
+            glActiveTexture(GL_TEXTURE1 + i);
+            glBindTexture(GL_TEXTURE_2D, layerTextures[layer]);
+        }
+        glBindVertexArray(quadVAO);
+
+        // pages over edited ground are redrawn in their slots, the rest wait for the next frame
+        int redrawn = 0;
+        for (; redrawn < (int)stale.size() && redrawn < PAGES_PER_UPDATE; redrawn++) {
+            auto it = resident.find(stale[redrawn]);
+            if (it == resident.end())
+                continue;
+            Slot kept = slots[it->second];
+            composite(kept.page, it->second);
+            slots[it->second] = kept;
+        }
+        stale.erase(stale.begin(), stale.begin() + redrawn);
+
+        int budget = PAGES_PER_UPDATE;
+        for (uint32_t page : requests) {
+            if (budget-- == 0)
+                break;
+            int slot = claimSlot();
+            if (slot < 0)
+                break;
+            composite(page, slot);
+        }
+
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+        if (blend)
+            glEnable(GL_BLEND);
+        if (cull)
+            glEnable(GL_CULL_FACE);
+        requests.clear();
+    }
+
+    updatePageTable();
+    frame++;
+}
+
+void TerrainVirtualTexture::bind(const Shader& shader) const {
+    if (!ready)
+        return;
+
+    glActiveTexture(GL_TEXTURE0 + PAGE_TABLE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, pageTable);
+    glActiveTexture(GL_TEXTURE0 + ATLAS_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.setInt("vtPageTable", PAGE_TABLE_TEXTURE_UNIT);
+    shader.setInt("vtAtlas", ATLAS_TEXTURE_UNIT);
+    shader.setVec2("vtOrigin", origin);
+    shader.setFloat("vtWorldSize", worldSize);
+    shader.setFloat("vtVirtualSize", (float)(pagesPerEdge * PAGE_SIZE));
+    shader.setFloat("vtPageSize", (float)PAGE_SIZE);
+    shader.setFloat("vtPageBorder", (float)PAGE_BORDER);
+    shader.setInt("vtMipCount", mipCount);
+}
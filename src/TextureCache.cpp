@@ -0,0 +1,249 @@
+#include "TextureCache.h"
+#include <algorithm>
+#include <iostream>
+#include "ContentHash.h"
+#include "stb_image.h"
+#include "TextureCompression.h"
+#include "TextureStreamer.h"
+#include "VirtualFileSystem.h"
+
+static bool isMipmapped(const TextureSampler& sampler) {
+    return sampler.minFilter != GL_LINEAR && sampler.minFilter != GL_NEAREST;
+}
+
+SharedTexture::~SharedTexture() {
+    glDeleteTextures(1, &id);
+}
+
+TextureCache& TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+// ------------------ Lookup ------------------
+bool TextureCache::hashPath(const std::string& path, uint64_t& hash) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto known = pathHashes.find(path);
+        if (known != pathHashes.end()) {
+            hash = known->second;
+            return true;
+        }
+    }
+
+    if (!ContentHash::hashFile(path, hash)) {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    pathHashes[path] = hash;
+    return true;
+}
+
+std::shared_ptr<SharedTexture> TextureCache::load(const std::string& path, const TextureSampler& sampler) {
+    std::shared_ptr<const TextureImage> image = decode(path, sampler);
+    return image ? load(image, sampler) : nullptr;
+}
+
+std::shared_ptr<const TextureImage> TextureCache::decode(const std::string& path, const TextureSampler& sampler) {
+    auto image = std::make_shared<TextureImage>();
+    image->path = path;
+    if (!hashPath(path, image->hash))
+        return nullptr;
+
+    // already on the GPU: load() will only count a hit, no pixels needed
+    std::promise<std::shared_ptr<const TextureImage>> decoded;
+    std::shared_future<std::shared_ptr<const TextureImage>> other;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto uploaded = textures.find({ image->hash, sampler.wrap, sampler.minFilter, sampler.magFilter });
+        if (uploaded != textures.end() && !uploaded->second.expired())
+            return image;
+
+        // someone else is decoding (or has decoded) the same content
+        auto inFlight = decodes.find(image->hash);
+        if (inFlight != decodes.end())
+            other = inFlight->second;
+        else
+            decodes[image->hash] = decoded.get_future().share();
+    }
+    if (other.valid())
+        return other.get();
+
+    decodePixels(*image, sampler, compression);
+    decoded.set_value(image);
+    return image;
+}
+
+std::shared_ptr<SharedTexture> TextureCache::load(const std::shared_ptr<const TextureImage>& image, const TextureSampler& sampler) {
+    Key key = { image->hash, sampler.wrap, sampler.minFilter, sampler.magFilter };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (std::shared_ptr<SharedTexture> texture = textures[key].lock()) {
+            hits++;
+            return texture;
+        }
+        misses++;
+    }
+
+    std::shared_ptr<SharedTexture> texture;
+    if (image->pixels.empty()) {
+        // it was uploaded when decode() ran, but freed since
+        auto again = std::make_shared<TextureImage>(*image);
+        decodePixels(*again, sampler, compression);
+        texture = upload(again, sampler);
+    }
+    else {
+        texture = upload(image, sampler);
+    }
+
+    // the pixels are on the GPU now, later decodes of this content can stop here
+    std::lock_guard<std::mutex> lock(mutex);
+    textures[key] = texture;
+    decodes.erase(image->hash);
+    return texture;
+}
+
+void TextureCache::printStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t alive = 0, bytes = 0;
+    for (const auto& entry : textures) {
+        if (std::shared_ptr<SharedTexture> texture = entry.second.lock()) {
+            alive++;
+            bytes += texture->bytes;
+        }
+    }
+    std::cout << "Textures: " << hits << " cache hits, " << misses << " misses, " << alive
+              << " resident (" << bytes / (1024 * 1024) << " MB)" << std::endl;
+}
+
+// ------------------ Decode / Upload ------------------
+bool TextureCache::compressFile(const std::string& path, bool& rebuilt) {
+    TextureImage image;
+    image.path = path;
+    rebuilt = false;
+    if (!ContentHash::hashFile(path, image.hash)) {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return false;
+    }
+    if (TextureCompression::readDds(TextureCompression::pathFor(path), image, &image.hash))
+        return true;
+
+    rebuilt = true;
+    decodePixels(image, TextureSampler(), true);
+    return image.compressedFormat != 0;
+}
+
+void TextureCache::decodePixels(TextureImage& image, const TextureSampler& sampler, bool compressed) {
+    // a .dds as it is; anything else from its compressed copy when that is current,
+    // which skips both the image decode and the mip chain
+    std::string compressedPath = TextureCompression::pathFor(image.path);
+    bool ddsPath = image.path.size() > 4 && image.path.compare(image.path.size() - 4, 4, ".dds") == 0;
+    bool loaded = ddsPath ? TextureCompression::readDds(image.path, image)
+                          : compressed && TextureCompression::readDds(compressedPath, image, &image.hash);
+    if (loaded) {
+        if (!isMipmapped(sampler))
+            image.mipmaps.clear();
+        return;
+    }
+
+    VirtualFile file;
+    unsigned char* data = (ddsPath || !file.open(image.path)) ? nullptr :
+        stbi_load_from_memory(file.getData(), (int)file.getSize(), &image.width, &image.height, &image.channels, 0);
+    file.close();
+    if (!data) {
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
+        return;
+    }
+    image.pixels.assign(data, data + (size_t)image.width * image.height * image.channels);
+    stbi_image_free(data);
+
+    // the mip chain too while off the main thread, a streamer uploads it level by level;
+    // compressed, every level's blocks are kept for the next launch
+    if (compressed && TextureCompression::canCompress(image)) {
+        buildMipmaps(image);
+        TextureCompression::compress(image);
+        TextureCompression::writeDds(compressedPath, image, image.hash);
+        if (!isMipmapped(sampler))
+            image.mipmaps.clear();
+    }
+    else if (isMipmapped(sampler)) {
+        buildMipmaps(image);
+    }
+}
+
+void TextureCache::buildMipmaps(TextureImage& image) {
+    // 2x2 box filter per level, the last row / column repeated for odd sizes
+    int width = image.width, height = image.height, channels = image.channels;
+    const unsigned char* source = image.pixels.data();
+    while (width > 1 || height > 1) {
+        int mipWidth = std::max(1, width / 2), mipHeight = std::max(1, height / 2);
+        std::vector<unsigned char> mip((size_t)mipWidth * mipHeight * channels);
+        for (int y = 0; y < mipHeight; y++) {
+            const unsigned char* row0 = source + (size_t)std::min(2 * y, height - 1) * width * channels;
+            const unsigned char* row1 = source + (size_t)std::min(2 * y + 1, height - 1) * width * channels;
+            unsigned char* out = mip.data() + (size_t)y * mipWidth * channels;
+            for (int x = 0; x < mipWidth; x++) {
+                int x0 = std::min(2 * x, width - 1) * channels, x1 = std::min(2 * x + 1, width - 1) * channels;
+                for (int c = 0; c < channels; c++)
+                    out[x * channels + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+            }
+        }
+        image.mipmaps.push_back(std::move(mip));
+        source = image.mipmaps.back().data();
+        width = mipWidth;
+        height = mipHeight;
+    }
+}
+
+std::shared_ptr<SharedTexture> TextureCache::upload(const std::shared_ptr<const TextureImage>& image, const TextureSampler& sampler) {
+    if (image->pixels.empty())
+        return nullptr;
+
+    GLenum format = (image->channels == 1) ? GL_RED :
+                    (image->channels == 3) ? GL_RGB :
+                    GL_RGBA;
+
+    std::shared_ptr<SharedTexture> texture = std::make_shared<SharedTexture>();
+    texture->width = image->width;
+    texture->height = image->height;
+    texture->bytes = (size_t)image->width * image->height * 4;
+    if (isMipmapped(sampler))
+        texture->bytes = texture->bytes * 4 / 3;
+    if (image->compressedFormat) {
+        texture->bytes = 0;
+        for (int level = 0; level <= (int)image->mipmaps.size(); level++)
+            texture->bytes += image->getLevelBytes(level);
+    }
+
+    glGenTextures(1, &texture->id);
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.magFilter);
+
+    if (streamer && streamer->stream(texture, image))
+        return texture;
+
+    if (image->compressedFormat) {
+        for (int level = 0; level <= (int)image->mipmaps.size(); level++)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image->compressedFormat, image->getLevelWidth(level),
+                                   image->getLevelHeight(level), 0, (GLsizei)image->getLevelBytes(level), image->getLevel(level));
+        // blocks cannot be mipmapped by GL, so sample only the levels the file had
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image->mipmaps.size());
+        return texture;
+    }
+
+    // rows of 1- and 3-channel images are only byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image->width, image->height, 0, format, GL_UNSIGNED_BYTE, image->pixels.data());
+    for (size_t level = 1; level <= image->mipmaps.size(); level++)
+        glTexImage2D(GL_TEXTURE_2D, (GLint)level, format, std::max(1, image->width >> level), std::max(1, image->height >> level),
+                     0, format, GL_UNSIGNED_BYTE, image->getLevel((int)level));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (isMipmapped(sampler) && image->mipmaps.empty())
+        glGenerateMipmap(GL_TEXTURE_2D);
+    return texture;
+}
@@ -0,0 +1,341 @@
+#include "TextureCompression.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include <glm/glm.hpp>
+#include "TextureCache.h"
+#include "VirtualFileSystem.h"
+
+// ------------------ DDS layout ------------------
+// The subset of the DDS header BC1 / BC3 textures need; see the DirectX docs for the rest
+struct DdsPixelFormat {
+    uint32_t size, flags, fourCC, rgbBitCount, rMask, gMask, bMask, aMask;
+};
+
+struct DdsHeader {
+    uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+    uint32_t reserved1[11]; // [0] "FNV1", [1] VERSION, [2..3] source hash
+    DdsPixelFormat format;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+
+static const uint32_t DDS_MAGIC = 0x20534444;      // "DDS "
+static const uint32_t DDS_SOURCE_TAG = 0x31564E46; // "FNV1"
+static const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000,
+                      DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+
+static uint32_t fourCC(const char* code) {
+    return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+// ------------------ Block encoding ------------------
+static uint16_t packColor(const float color[3]) {
+    int r = glm::clamp((int)std::lround(color[0] * 31.0f / 255.0f), 0, 31);
+    int g = glm::clamp((int)std::lround(color[1] * 63.0f / 255.0f), 0, 63);
+    int b = glm::clamp((int)std::lround(color[2] * 31.0f / 255.0f), 0, 31);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor(uint16_t packed, int color[3]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// Nearest of the four palette colors for every texel, and the summed squared error
+static int colorIndices(const unsigned char texels[16][4], uint16_t c0, uint16_t c1, uint32_t& indices) {
+    int palette[4][3];
+    unpackColor(c0, palette[0]);
+    unpackColor(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    int error = 0;
+    indices = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0, bestDistance = INT32_MAX;
+        for (int p = 0; p < 4; p++) {
+            int dr = texels[i][0] - palette[p][0], dg = texels[i][1] - palette[p][1], db = texels[i][2] - palette[p][2];
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = p;
+            }
+        }
+        indices |= (uint32_t)best << (2 * i);
+        error += bestDistance;
+    }
+    return error;
+}
+
+// Endpoints that best fit the texels for the given indices (least squares)
+static bool fitEndpoints(const unsigned char texels[16][4], uint32_t indices, float a[3], float b[3]) {
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; i++) {
+        float w = weights[(indices >> (2 * i)) & 3];
+        aa += w * w;
+        bb += (1.0f - w) * (1.0f - w);
+        ab += w * (1.0f - w);
+        for (int c = 0; c < 3; c++) {
+            ax[c] += w * texels[i][c];
+            bx[c] += (1.0f - w) * texels[i][c];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+    for (int c = 0; c < 3; c++) {
+        a[c] = glm::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+        b[c] = glm::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+// BC1 color block: endpoints at the texels furthest apart along the principal
+// axis, then one least squares refit. Always 4-color mode (c0 > c1), which
+// BC3 requires and opaque BC1 wants.
+static void encodeColorBlock(const unsigned char texels[16][4], unsigned char* out) {
+    float mean[3] = {};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += texels[i][c] / 16.0f;
+
+    float covariance[6] = {};
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { texels[i][0] - mean[0], texels[i][1] - mean[1], texels[i][2] - mean[2] };
+        covariance[0] += d[0] * d[0]; covariance[1] += d[0] * d[1]; covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1]; covariance[4] += d[1] * d[2]; covariance[5] += d[2] * d[2];
+    }
+
+    // principal axis by power iteration
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+        };
+        float length = std::max({ std::fabs(next[0]), std::fabs(next[1]), std::fabs(next[2]) });
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    int lowest = 0, highest = 0;
+    float lowestDot = 1e30f, highestDot = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float dot = texels[i][0] * axis[0] + texels[i][1] * axis[1] + texels[i][2] * axis[2];
+        if (dot < lowestDot) { lowestDot = dot; lowest = i; }
+        if (dot > highestDot) { highestDot = dot; highest = i; }
+    }
+    float a[3] = { (float)texels[highest][0], (float)texels[highest][1], (float)texels[highest][2] };
+    float b[3] = { (float)texels[lowest][0], (float)texels[lowest][1], (float)texels[lowest][2] };
+
+    auto order = [](uint16_t& c0, uint16_t& c1) {
+        if (c0 < c1)
+            std::swap(c0, c1);
+    };
+    uint16_t c0 = packColor(a), c1 = packColor(b);
+    order(c0, c1);
+    uint32_t indices = 0;
+    int error = colorIndices(texels, c0, c1, indices);
+
+    if (c0 != c1 && fitEndpoints(texels, indices, a, b)) {
+        uint16_t r0 = packColor(a), r1 = packColor(b);
+        order(r0, r1);
+        uint32_t refitIndices = 0;
+        if (r0 != r1 && colorIndices(texels, r0, r1, refitIndices) < error) {
+            c0 = r0;
+            c1 = r1;
+            indices = refitIndices;
+        }
+    }
+    if (c0 == c1)
+        indices = 0;
+
+    std::memcpy(out, &c0, 2);
+    std::memcpy(out + 2, &c1, 2);
+    std::memcpy(out + 4, &indices, 4);
+}
+
+// BC3 alpha block: the block's alpha range in 8-value mode
+static void encodeAlphaBlock(const unsigned char texels[16][4], unsigned char* out) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, (int)texels[i][3]);
+        a1 = std::min(a1, (int)texels[i][3]);
+    }
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+
+    uint64_t indices = 0;
+    if (a0 > a1) {
+        for (int i = 0; i < 16; i++) {
+            // step 7 is a0 (index 0), step 0 is a1 (index 1), step k between them is index 8 - k
+            int step = (int)std::lround((texels[i][3] - a1) * 7.0f / (a0 - a1));
+            uint64_t index = (step == 7) ? 0 : (step == 0) ? 1 : (uint64_t)(8 - step);
+            indices |= index << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// One level of pixels to blocks, edge texels repeated past odd sizes
+static std::vector<unsigned char> compressLevel(const unsigned char* pixels, int width, int height, int channels, bool alpha) {
+    int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    size_t blockBytes = alpha ? 16 : 8;
+    std::vector<unsigned char> blocks((size_t)blocksWide * blocksHigh * blockBytes);
+
+    unsigned char texels[16][4];
+    for (int by = 0; by < blocksHigh; by++) {
+        for (int bx = 0; bx < blocksWide; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + (i & 3), width - 1), y = std::min(by * 4 + (i >> 2), height - 1);
+                const unsigned char* texel = pixels + ((size_t)y * width + x) * channels;
+                texels[i][0] = texel[0];
+                texels[i][1] = texel[1];
+                texels[i][2] = texel[2];
+                texels[i][3] = (channels == 4) ? texel[3] : 255;
+            }
+
+            unsigned char* out = blocks.data() + ((size_t)by * blocksWide + bx) * blockBytes;
+            if (alpha) {
+                encodeAlphaBlock(texels, out);
+                out += 8;
+            }
+            encodeColorBlock(texels, out);
+        }
+    }
+    return blocks;
+}
+
+// ------------------ Compression ------------------
+bool TextureCompression::canCompress(const TextureImage& image) {
+    return image.compressedFormat == 0 && !image.pixels.empty() && (image.channels == 3 || image.channels == 4);
+}
+
+void TextureCompression::compress(TextureImage& image) {
+    bool alpha = false;
+    if (image.channels == 4) {
+        for (size_t i = 3; i < image.pixels.size() && !alpha; i += 4)
+            alpha = image.pixels[i] != 255;
+    }
+
+    image.pixels = compressLevel(image.pixels.data(), image.width, image.height, image.channels, alpha);
+    for (size_t level = 1; level <= image.mipmaps.size(); level++) {
+        std::vector<unsigned char>& mip = image.mipmaps[level - 1];
+        mip = compressLevel(mip.data(), std::max(1, image.width >> level), std::max(1, image.height >> level), image.channels, alpha);
+    }
+    image.compressedFormat = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+size_t TextureCompression::levelBytes(unsigned int format, int width, int height) {
+    size_t blockBytes = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+// ------------------ DDS files ------------------
+bool TextureCompression::writeDds(const std::string& path, const TextureImage& image, uint64_t sourceHash) {
+    DdsHeader header = {};
+    header.size = sizeof(DdsHeader);
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height = image.height;
+    header.width = image.width;
+    header.pitchOrLinearSize = (uint32_t)image.pixels.size();
+    header.mipMapCount = (uint32_t)image.mipmaps.size() + 1;
+    header.reserved1[0] = DDS_SOURCE_TAG;
+    header.reserved1[1] = VERSION;
+    header.reserved1[2] = (uint32_t)sourceHash;
+    header.reserved1[3] = (uint32_t)(sourceHash >> 32);
+    header.format.size = sizeof(DdsPixelFormat);
+    header.format.flags = DDPF_FOURCC;
+    header.format.fourCC = fourCC(image.compressedFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "DXT1" : "DXT5");
+    header.caps = DDSCAPS_TEXTURE | (image.mipmaps.empty() ? 0 : DDSCAPS_COMPLEX | DDSCAPS_MIPMAP);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "Failed to create compressed texture: " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)image.pixels.data(), (std::streamsize)image.pixels.size());
+    for (const std::vector<unsigned char>& mip : image.mipmaps)
+        out.write((const char*)mip.data(), (std::streamsize)mip.size());
+
+    if (!out) {
+        std::cout << "Failed to write compressed texture: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TextureCompression::readDds(const std::string& path, TextureImage& image, const uint64_t* sourceHash) {
+    VirtualFile in;
+    if (!VirtualFileSystem::instance().exists(path) || !in.open(path))
+        return false;
+
+    uint32_t magic = 0;
+    DdsHeader header = {};
+    if (in.getSize() < sizeof(magic) + sizeof(header))
+        return false;
+    std::memcpy(&magic, in.getData(), sizeof(magic));
+    std::memcpy(&header, in.getData() + sizeof(magic), sizeof(header));
+    if (magic != DDS_MAGIC || header.size != sizeof(DdsHeader) || !(header.format.flags & DDPF_FOURCC) ||
+        header.width == 0 || header.height == 0)
+        return false;
+
+    unsigned int format = (header.format.fourCC == fourCC("DXT1")) ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT :
+                          (header.format.fourCC == fourCC("DXT5")) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT :
+                          0;
+    if (format == 0)
+        return false;
+
+    if (sourceHash) {
+        uint64_t encodedFrom = header.reserved1[2] | ((uint64_t)header.reserved1[3] << 32);
+        if (header.reserved1[0] != DDS_SOURCE_TAG || header.reserved1[1] != VERSION || encodedFrom != *sourceHash)
+            return false;
+    }
+
+    // at most the full chain down to 1x1
+    int width = (int)header.width, height = (int)header.height;
+    int levelCount = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header.mipMapCount) : 1;
+    int fullChain = 1;
+    while ((std::max(width, height) >> fullChain) > 0)
+        fullChain++;
+    if (levelCount > fullChain)
+        return false;
+
+    std::vector<std::vector<unsigned char>> levels(levelCount);
+    size_t offset = sizeof(magic) + sizeof(header);
+    for (int level = 0; level < levelCount; level++) {
+        size_t bytes = levelBytes(format, std::max(1, width >> level), std::max(1, height >> level));
+        if (bytes > in.getSize() - offset) {
+            std::cout << "Compressed texture is truncated: " << path << std::endl;
+            return false;
+        }
+        levels[level].assign(in.getData() + offset, in.getData() + offset + bytes);
+        offset += bytes;
+    }
+
+    image.width = width;
+    image.height = height;
+    image.channels = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 3 : 4;
+    image.compressedFormat = format;
+    image.pixels = std::move(levels[0]);
+    image.mipmaps.assign(std::make_move_iterator(levels.begin() + 1), std::make_move_iterator(levels.end()));
+    return true;
+}
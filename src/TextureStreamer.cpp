@@ -0,0 +1,178 @@
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cstring>
+#include "TextureCache.h"
+
+// Format and sized format of an image's pixels, as TextureCache uploads them
+static GLenum pixelFormat(const TextureImage& image) {
+    return (image.channels == 1) ? GL_RED :
+           (image.channels == 3) ? GL_RGB :
+           GL_RGBA;
+}
+
+static GLenum sizedFormat(const TextureImage& image) {
+    if (image.compressedFormat)
+        return image.compressedFormat;
+    return (image.channels == 1) ? GL_R8 :
+           (image.channels == 3) ? GL_RGB8 :
+           GL_RGBA8;
+}
+
+// Rows [row, row + rows) of a level, in the image's own rows (of pixels or of blocks)
+static void subImage(const TextureImage& image, int level, int row, int rows, const void* data) {
+    int rowHeight = image.compressedFormat ? 4 : 1;
+    int y = row * rowHeight;
+    int height = std::min(rows * rowHeight, image.getLevelHeight(level) - y);
+    if (image.compressedFormat)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, image.getLevelWidth(level), height, image.compressedFormat,
+                                  (GLsizei)(rows * image.getRowBytes(level)), data);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, image.getLevelWidth(level), height, pixelFormat(image),
+                        GL_UNSIGNED_BYTE, data);
+}
+
+// ------------------ Constructor ------------------
+TextureStreamer::TextureStreamer(size_t frameBudget, int bufferCount)
+    : frameBudget(frameBudget), slots(std::max(1, bufferCount)) {
+    for (Slot& slot : slots) {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, frameBudget, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer() {
+    TextureCache::instance().setStreamer(nullptr);
+    for (Slot& slot : slots) {
+        if (slot.fence)
+            glDeleteSync(slot.fence);
+        glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+// ------------------ Queueing ------------------
+bool TextureStreamer::stream(const std::shared_ptr<SharedTexture>& texture, const std::shared_ptr<const TextureImage>& image) {
+    int levelCount = (int)image->mipmaps.size() + 1;
+    if (levelCount == 1 || image->getRowBytes(0) > frameBudget)
+        return false;
+
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+
+    // every level exists from the start, only their contents arrive later
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, levelCount, sizedFormat(*image), image->width, image->height);
+    }
+    else {
+        for (int level = 0; level < levelCount; level++) {
+            if (image->compressedFormat)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, image->compressedFormat, image->getLevelWidth(level),
+                                       image->getLevelHeight(level), 0, (GLsizei)image->getLevelBytes(level), nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, sizedFormat(*image), image->getLevelWidth(level),
+                             image->getLevelHeight(level), 0, pixelFormat(*image), GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    }
+
+    // the small levels right away, the smallest at least
+    int resident = levelCount - 1;
+    while (resident > 0 && std::max(image->width >> (resident - 1), image->height >> (resident - 1)) <= RESIDENT_SIZE)
+        resident--;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = levelCount - 1; level >= resident; level--)
+        subImage(*image, level, 0, image->getRowCount(level), image->getLevel(level));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, resident);
+
+    if (resident > 0) {
+        requests.push_back({ texture, image, resident - 1, 0 });
+        for (int level = 0; level < resident; level++)
+            queuedBytes += image->getLevelBytes(level);
+    }
+    return true;
+}
+
+// ------------------ Per Frame ------------------
+void TextureStreamer::update() {
+    if (requests.empty())
+        return;
+
+    // the GPU may still be copying out of this buffer from a few frames ago
+    Slot& slot = slots[nextSlot];
+    if (slot.fence) {
+        if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+
+    // row bands of the queued levels, packed back to back into the buffer
+    struct Copy {
+        unsigned int texture;
+        std::shared_ptr<const TextureImage> image;
+        int level, row, rows;
+        size_t offset;
+        bool lastBand; // the level is complete after this one
+    };
+    std::vector<Copy> copies;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+    unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frameBudget,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+
+    size_t used = 0;
+    while (!requests.empty()) {
+        Request& request = requests.front();
+        std::shared_ptr<SharedTexture> texture = request.texture.lock();
+        const TextureImage& image = *request.image;
+        int height = image.getRowCount(request.level);
+        size_t rowBytes = image.getRowBytes(request.level);
+        if (!texture) {
+            // freed before it finished, so are the levels it still had to come
+            for (int level = 0; level <= request.level; level++)
+                queuedBytes -= image.getLevelBytes(level);
+            queuedBytes += (size_t)request.row * rowBytes;
+            requests.pop_front();
+            continue;
+        }
+
+        int rows = (int)std::min<size_t>(height - request.row, (frameBudget - used) / rowBytes);
+        if (rows == 0)
+            break;
+
+        std::memcpy(mapped + used, image.getLevel(request.level) + request.row * rowBytes, rows * rowBytes);
+        copies.push_back({ texture->id, request.image, request.level, request.row, rows, used, request.row + rows == height });
+        used += rows * rowBytes;
+        queuedBytes -= rows * rowBytes;
+
+        request.row += rows;
+        if (request.row == height) {
+            request.row = 0;
+            if (--request.level < 0)
+                requests.pop_front();
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // the copies themselves, out of the buffer on the GPU's time
+    GLint bound = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const Copy& copy : copies) {
+        glBindTexture(GL_TEXTURE_2D, copy.texture);
+        subImage(*copy.image, copy.level, copy.row, copy.rows, (const void*)copy.offset);
+        if (copy.lastBand)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, bound);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    nextSlot = (nextSlot + 1) % slots.size();
+}
@@ -0,0 +1,95 @@
+#include "VertexQuantization.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+
+static float signNotZero(float value) {
+    return (value >= 0.0f) ? 1.0f : -1.0f;
+}
+
+// ------------------ Octahedral Normals ------------------
+glm::vec2 VertexQuantization::encodeOctahedral(const glm::vec3& normal) {
+    // onto the octahedron |x| + |y| + |z| = 1, the lower half folded over the upper
+    float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    if (length == 0.0f)
+        return glm::vec2(0.0f);
+    glm::vec2 p = glm::vec2(normal.x, normal.y) / length;
+    if (normal.z < 0.0f)
+        p = glm::vec2((1.0f - std::fabs(p.y)) * signNotZero(p.x), (1.0f - std::fabs(p.x)) * signNotZero(p.y));
+    return p;
+}
+
+glm::vec3 VertexQuantization::decodeOctahedral(const glm::vec2& encoded) {
+    glm::vec3 n(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+    if (n.z < 0.0f) {
+        float x = n.x;
+        n.x = (1.0f - std::fabs(n.y)) * signNotZero(x);
+        n.y = (1.0f - std::fabs(x)) * signNotZero(n.y);
+    }
+    return glm::normalize(n);
+}
+
+// ------------------ Quantize ------------------
+bool VertexQuantization::quantize(const std::vector<Vertex>& vertices, QuantizedVertices& quantized, QuantizationError* error) {
+    if (vertices.empty())
+        return false;
+
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+    for (const Vertex& vertex : vertices) {
+        boundsMin = glm::min(boundsMin, vertex.Position);
+        boundsMax = glm::max(boundsMax, vertex.Position);
+    }
+
+    QuantizedVertices result;
+    result.positionOffset = boundsMin;
+    result.positionScale = boundsMax - boundsMin;
+    result.vertices.resize(vertices.size());
+
+    QuantizationError worst;
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const Vertex& vertex = vertices[i];
+        QuantizedVertex& packed = result.vertices[i];
+
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = result.positionScale[axis];
+            float unit = (extent > 0.0f) ? (vertex.Position[axis] - boundsMin[axis]) / extent : 0.0f;
+            packed.Position[axis] = (uint16_t)std::lround(glm::clamp(unit, 0.0f, 1.0f) * 65535.0f);
+        }
+        packed.Position[3] = 0;
+
+        glm::vec2 octahedral = encodeOctahedral(vertex.Normal);
+        packed.Normal[0] = (int16_t)std::lround(glm::clamp(octahedral.x, -1.0f, 1.0f) * 32767.0f);
+        packed.Normal[1] = (int16_t)std::lround(glm::clamp(octahedral.y, -1.0f, 1.0f) * 32767.0f);
+
+        packed.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+        packed.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+
+        Vertex decoded = decode(packed, result);
+        worst.position = std::max(worst.position, glm::length(decoded.Position - vertex.Position));
+        float normalLength = glm::length(vertex.Normal);
+        if (normalLength > 0.0f) {
+            float cosine = glm::clamp(glm::dot(decoded.Normal, vertex.Normal / normalLength), -1.0f, 1.0f);
+            worst.normalDegrees = std::max(worst.normalDegrees, glm::degrees(std::acos(cosine)));
+        }
+        glm::vec2 texCoordError = glm::abs(decoded.TexCoords - vertex.TexCoords);
+        worst.texCoord = std::max(worst.texCoord, std::max(texCoordError.x, texCoordError.y));
+    }
+
+    if (error)
+        *error = worst;
+    // NaN as well
+    if (!(worst.texCoord <= MAX_TEXCOORD_ERROR))
+        return false;
+    quantized = std::move(result);
+    return true;
+}
+
+Vertex VertexQuantization::decode(const QuantizedVertex& vertex, const QuantizedVertices& quantized) {
+    Vertex decoded;
+    glm::vec3 unit(vertex.Position[0], vertex.Position[1], vertex.Position[2]);
+    decoded.Position = quantized.positionOffset + unit / 65535.0f * quantized.positionScale;
+    glm::vec2 octahedral(std::max(vertex.Normal[0] / 32767.0f, -1.0f), std::max(vertex.Normal[1] / 32767.0f, -1.0f));
+    decoded.Normal = decodeOctahedral(octahedral);
+    decoded.TexCoords = glm::vec2(glm::unpackHalf1x16(vertex.TexCoords[0]), glm::unpackHalf1x16(vertex.TexCoords[1]));
+    return decoded;
+}
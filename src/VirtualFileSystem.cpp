@@ -0,0 +1,110 @@
+#include "VirtualFileSystem.h"
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+
+// ------------------ Virtual File ------------------
+bool VirtualFile::open(const std::string& path) {
+    close();
+
+    const AssetPack& pack = VirtualFileSystem::instance().getPack();
+    if (pack.isOpen()) {
+        if (const AssetPackEntry* packed = pack.find(VirtualFileSystem::normalize(path))) {
+            // empty files have no bytes to point at, but they are open
+            static const unsigned char empty = 0;
+            entry = packed;
+            data = packed->size ? pack.getFile().getData() + packed->offset : &empty;
+            size = (size_t)packed->size;
+            return true;
+        }
+    }
+
+    if (!loose.open(path))
+        return false;
+    data = loose.getData();
+    size = loose.getSize();
+    return true;
+}
+
+void VirtualFile::close() {
+    loose.close();
+    entry = nullptr;
+    data = nullptr;
+    size = 0;
+}
+
+void VirtualFile::release(size_t offset, size_t length) const {
+    if (entry) {
+        if (offset < size)
+            VirtualFileSystem::instance().getPack().getFile().release((size_t)entry->offset + offset, std::min(length, size - offset));
+    }
+    else {
+        loose.release(offset, length);
+    }
+}
+
+bool VirtualFile::getStoredHash(uint64_t& hash) const {
+    if (!entry)
+        return false;
+    hash = entry->hash;
+    return true;
+}
+
+// ------------------ File System ------------------
+VirtualFileSystem& VirtualFileSystem::instance() {
+    static VirtualFileSystem fileSystem;
+    return fileSystem;
+}
+
+bool VirtualFileSystem::mount(const std::string& packPath) {
+    return pack.open(packPath);
+}
+
+bool VirtualFileSystem::exists(const std::string& path) const {
+    if (pack.isOpen() && pack.find(normalize(path)))
+        return true;
+    std::error_code error;
+    return std::filesystem::is_regular_file(path, error);
+}
+
+bool VirtualFileSystem::fileSize(const std::string& path, uint64_t& size) const {
+    if (pack.isOpen()) {
+        if (const AssetPackEntry* entry = pack.find(normalize(path))) {
+            size = entry->size;
+            return true;
+        }
+    }
+    std::error_code error;
+    size = (uint64_t)std::filesystem::file_size(path, error);
+    return !error;
+}
+
+bool VirtualFileSystem::modifiedTime(const std::string& path, int64_t& time) const {
+    if (pack.isOpen() && pack.find(normalize(path)))
+        return false;
+    std::error_code error;
+    time = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+std::string VirtualFileSystem::normalize(const std::string& path) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (size_t i = 0; i <= path.size(); i++) {
+        char c = (i < path.size()) ? path[i] : '/';
+        if (c != '/' && c != '\\') {
+            part += c;
+            continue;
+        }
+        if (part == ".." && !parts.empty() && parts.back() != "..")
+            parts.pop_back();
+        else if (!part.empty() && part != ".")
+            parts.push_back(part);
+        part.clear();
+    }
+
+    std::string normalized;
+    for (const std::string& p : parts)
+        normalized += (normalized.empty() ? "" : "/") + p;
+    return normalized;
+}
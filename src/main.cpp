@@ -3,6 +3,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cfloat>
 #include <random>
 #include <iostream>
 #include <assimp/Importer.hpp>
@@ -16,6 +18,18 @@
 #include "Camera.h"
 #include "Flashlight.h"
 #include "DayNightCycle.h"
+#include "Terrain.h"
+#include "ContentHash.h"
+#include "TerrainQuery.h"
+#include "TerrainHorizon.h"
+#include "TerrainRaycast.h"
+#include "TextureCache.h"
+#include "AssetLoader.h"
+#include "TextureStreamer.h"
+#include "TerrainVirtualTexture.h"
+#include "TerrainTileFile.h"
+#include "VirtualFileSystem.h"
+#include "LodSelector.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../include/stb_image.h"
@@ -28,6 +42,7 @@ const unsigned int SCR_HEIGHT = 600;
 
 // Camera
 Camera camera(glm::vec3(0.0f, 0.25f, 5.0f));
+const float CAMERA_EYE_HEIGHT = 0.25f; // above the terrain surface
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
@@ -43,18 +58,21 @@ static bool pressed = false;
 // Day-Night Cycle
 DayNightCycle cycle(60.0f);
 
-//Terrain
-std::vector<float> terrainVertices;
-std::vector<unsigned int> terrainIndices;
-unsigned int terrainVAO, terrainVBO, terrainEBO;
-
 
 struct ObjectInstance {
     glm::vec3 position;
     glm::vec3 scale;
     float rotationDeg;
+    LodState lod; // picked per frame, see selectLods
+
+    ObjectInstance() = default;
+    ObjectInstance(const glm::vec3& position, const glm::vec3& scale, float rotationDeg)
+        : position(position), scale(scale), rotationDeg(rotationDeg) {}
 };
 
+// Level of detail for every instance, by its on-screen error
+LodSelector lodSelector;
+
 // Input handling
 void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -103,20 +121,6 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
 
 
 
-// Ground vertices (X, Y, Z,  NormalX, NormalY, NormalZ,  U, V)
-float groundVertices[] = {
-    // positions           // normals         // texcoords
-   -30.0f, 0.0f, -30.0f,   0.0f, 1.0f, 0.0f,  0.0f, 0.0f,
-    30.0f, 0.0f, -30.0f,   0.0f, 1.0f, 0.0f, 50.0f, 0.0f,
-    30.0f, 0.0f,  30.0f,   0.0f, 1.0f, 0.0f, 50.0f, 50.0f,
-   -30.0f, 0.0f,  30.0f,   0.0f, 1.0f, 0.0f,  0.0f, 50.0f
-};
-
-unsigned int groundIndices[] = {
-    0, 1, 2,
-    2, 3, 0
-};
-
 float skyboxVertices[] = {
     // positions          
     -1.0f,  1.0f, -1.0f,
@@ -216,34 +220,47 @@ std::vector<ObjectInstance> farmHouseInstances = {
     { glm::vec3(5.0f, 0.0f, -10.0f), glm::vec3(0.1f), 15.0f }
 };
 
-unsigned int loadCubemap(const std::vector<std::string>& faces) {
+// Faces are decoded on the loader's workers and uploaded once they are done
+unsigned int loadCubemap(const std::vector<std::string>& faces, AssetLoader& loader) {
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++) {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data) {
-            GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-            glTexImage2D(
-                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data
-            );
-            stbi_image_free(data);
-        }
-        else {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+    for (unsigned int i = 0; i < faces.size(); i++) {
+        struct Face {
+            int width = 0, height = 0, nrChannels = 0;
+            unsigned char* data = nullptr;
+        };
+        auto face = std::make_shared<Face>();
+        std::string path = faces[i];
+        loader.load(
+            [face, path] {
+                VirtualFile file;
+                if (file.open(path))
+                    face->data = stbi_load_from_memory(file.getData(), (int)file.getSize(), &face->width, &face->height, &face->nrChannels, 0);
+            },
+            [face, path, textureID, i] {
+                if (face->data) {
+                    GLenum format = (face->nrChannels == 4) ? GL_RGBA : GL_RGB;
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+                    glTexImage2D(
+                        GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                        0, format, face->width, face->height, 0, format, GL_UNSIGNED_BYTE, face->data
+                    );
+                    stbi_image_free(face->data);
+                }
+                else {
+                    std::cout << "Cubemap texture failed to load at path: " << path << std::endl;
+                }
+            });
+    }
+
     return textureID;
 }
 
@@ -254,9 +271,18 @@ void drawInstance(Shader& shader, Model& model, const ObjectInstance& inst) {
     m = glm::scale(m, inst.scale);
     shader.setMat4("model", m);
 
-    
-    model.Draw(shader.ID);   
-    
+    LodSelector::draw(model, shader.ID, inst.lod);
+}
+
+// Levels of detail for this frame, shared by the shadow and main passes
+void selectLods(const Model& model, std::vector<ObjectInstance>& instances) {
+    glm::vec3 localCenter = (model.boundsMin + model.boundsMax) * 0.5f;
+    for (auto& inst : instances) {
+        float scale = std::max(inst.scale.x, std::max(inst.scale.y, inst.scale.z));
+        glm::vec3 offset = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(inst.rotationDeg), glm::vec3(0.0f, 1.0f, 0.0f)) *
+                                     glm::vec4(localCenter * inst.scale, 0.0f));
+        lodSelector.select(model, inst.position + offset, scale, inst.lod);
+    }
 }
 
 std::vector<ObjectInstance> forestWallInstances;
@@ -307,22 +333,74 @@ void generateForestWall(float halfSize, int countPerSide) {
     }
 }
 
+// Drop instances generated at y = 0 onto the terrain surface
+void placeOnTerrain(const TerrainQuery& query, std::vector<ObjectInstance>& instances) {
+    std::vector<glm::vec2> xz(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+        xz[i] = glm::vec2(instances[i].position.x, instances[i].position.z);
+
+    std::vector<float> heights(instances.size());
+    query.heightsAt(xz.data(), heights.data(), heights.size());
+    for (size_t i = 0; i < instances.size(); i++)
+        instances[i].position.y = heights[i];
+}
+
+// Grounds again only the instances standing inside a world XZ rectangle, after it was sculpted
+void placeOnTerrain(const TerrainQuery& query, std::vector<ObjectInstance>& instances,
+                    const glm::vec2& minXZ, const glm::vec2& maxXZ) {
+    std::vector<size_t> inside;
+    std::vector<glm::vec2> xz;
+    for (size_t i = 0; i < instances.size(); i++) {
+        glm::vec2 p(instances[i].position.x, instances[i].position.z);
+        if (p.x >= minXZ.x && p.x <= maxXZ.x && p.y >= minXZ.y && p.y <= maxXZ.y) {
+            inside.push_back(i);
+            xz.push_back(p);
+        }
+    }
+    if (inside.empty())
+        return;
+
+    std::vector<float> heights(inside.size());
+    query.heightsAt(xz.data(), heights.data(), heights.size());
+    for (size_t i = 0; i < inside.size(); i++)
+        instances[inside[i]].position.y = heights[i];
+}
+
+// Height of the tallest instance above the ground it stands on
+float casterHeight(const Model& model, const std::vector<ObjectInstance>& instances) {
+    float height = 0.0f;
+    for (const auto& inst : instances)
+        height = std::max(height, model.boundsMax.y * inst.scale.y);
+    return height;
+}
+
+// Orthographic light frustum around everything within extent of eye (XZ) that can cast or
+// receive a shadow: the ground's height range there, up to propHeight above its highest point
+glm::mat4 fitLightSpace(const Terrain& terrain, const glm::vec3& toLight, const glm::vec3& eye,
+                        float extent, float propHeight) {
+    glm::vec2 minXZ = glm::vec2(eye.x, eye.z) - extent;
+    glm::vec2 maxXZ = glm::vec2(eye.x, eye.z) + extent;
+    glm::vec2 ground = terrain.heightRange(minXZ, maxXZ);
+    glm::vec3 boxMin(minXZ.x, ground.x, minXZ.y);
+    glm::vec3 boxMax(maxXZ.x, ground.y + propHeight, maxXZ.y);
+
+    glm::vec3 center = (boxMin + boxMax) * 0.5f;
+    glm::mat4 lightView = glm::lookAt(center + toLight, center, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+        glm::vec3 p = glm::vec3(lightView * glm::vec4(corner, 1.0f));
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    // the light looks down its -Z
+    return glm::ortho(lo.x, hi.x, lo.y, hi.y, -hi.z, -lo.z) * lightView;
+}
 
 void renderScene(Shader& shader, Model& tree, Model& tree2, Model& rock,
     Model& fern, Model& grassShort, Model& Flower_3_Group,
-    Model& Pine4, Model& farmHouse,
-    unsigned int groundVAO, unsigned int grassTexture)
+    Model& Pine4, Model& farmHouse)
 {
-    // Ground
-    glm::mat4 model = glm::mat4(1.0f);
-    shader.setMat4("model", model);
-    // bind grass texture to unit 0 (the same one texture_diffuse1 expects)
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, grassTexture);
-
-    glBindVertexArray(groundVAO);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
     // tree1
     for (const auto& inst : tree1Instances) drawInstance(shader, tree, inst);
 
@@ -347,26 +425,61 @@ void renderScene(Shader& shader, Model& tree, Model& tree2, Model& rock,
     // forest wall
     for (const auto& inst : forestWallInstances) drawInstance(shader, Pine4, inst);
 
-    glBindVertexArray(terrainVAO);
-    glDrawElements(GL_TRIANGLES, terrainIndices.size(), GL_UNSIGNED_INT, 0);
-
 }
 
-glm::vec3 calculateNormal(int x, int z, int width, int height, unsigned char* heightData, float heightScale) {
-    // Clamp helper
-    auto h = [&](int ix, int iz) {
-        ix = std::max(0, std::min(ix, width - 1));
-        iz = std::max(0, std::min(iz, height - 1));
-        return heightData[iz * width + ix] / 255.0f * heightScale;
-        };
-
-    float hL = h(x - 1, z);
-    float hR = h(x + 1, z);
-    float hD = h(x, z - 1);
-    float hU = h(x, z + 1);
-
-    glm::vec3 normal = glm::vec3(hL - hR, 2.0f, hD - hU);
-    return glm::normalize(normal);
+// Lights, fog and flashlight shared by the model and terrain shaders
+void setLightingUniforms(Shader& shader) {
+    shader.use();
+    shader.setFloat("material.shininess", 32.0f);
+
+    // set directional light from cycle
+    shader.setVec3("dirLight.direction", cycle.direction);
+    shader.setVec3("dirLight.ambient", cycle.ambient);
+    shader.setVec3("dirLight.diffuse", cycle.diffuse);
+    shader.setVec3("dirLight.specular", cycle.specular);
+
+    shader.setVec3("fogColor", cycle.backgroundColor);
+    shader.setFloat("fogDensity", 0.04f);
+
+    /*// --- Point light (glowing rock) ---
+    shader.setVec3("pointLights[0].position", glm::vec3(2.0f, 0.5f, 2.0f));  // rock position
+    shader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
+    shader.setVec3("pointLights[0].diffuse", 1.0f, 0.6f, 0.3f);   // warm orange glow
+    shader.setVec3("pointLights[0].specular", 1.0f, 0.6f, 0.3f);
+    shader.setFloat("pointLights[0].constant", 1.0f);
+    shader.setFloat("pointLights[0].linear", 0.09f);
+    shader.setFloat("pointLights[0].quadratic", 0.032f);*/
+
+    // Disable point light #0
+    shader.setVec3("pointLights[0].position", glm::vec3(0.0f));  // rock position
+    shader.setVec3("pointLights[0].ambient", glm::vec3(0.0f));
+    shader.setVec3("pointLights[0].diffuse", glm::vec3(0.0f));   // warm orange glow
+    shader.setVec3("pointLights[0].specular", glm::vec3(0.0f));
+    shader.setFloat("pointLights[0].constant", 1.0f);
+    shader.setFloat("pointLights[0].linear", 0.09f);
+    shader.setFloat("pointLights[0].quadratic", 0.032f);
+
+    // Disable point light #1
+    shader.setVec3("pointLights[1].position", glm::vec3(0.0f));
+    shader.setVec3("pointLights[1].ambient", 0.0f, 0.0f, 0.0f);
+    shader.setVec3("pointLights[1].diffuse", 0.0f, 0.0f, 0.0f);
+    shader.setVec3("pointLights[1].specular", 0.0f, 0.0f, 0.0f);
+    shader.setFloat("pointLights[1].constant", 1.0f);
+    shader.setFloat("pointLights[1].linear", 0.09f);
+    shader.setFloat("pointLights[1].quadratic", 0.032f);
+
+    // Flashlight
+    shader.setBool("flashlight.enabled", flashlight.enabled);
+    shader.setVec3("flashlight.position", flashlight.position);
+    shader.setVec3("flashlight.direction", flashlight.direction);
+    shader.setVec3("flashlight.ambient", flashlight.ambient);
+    shader.setVec3("flashlight.diffuse", flashlight.diffuse);
+    shader.setVec3("flashlight.specular", flashlight.specular);
+    shader.setFloat("flashlight.cutOff", flashlight.cutOff);
+    shader.setFloat("flashlight.outerCutOff", flashlight.outerCutOff);
+    shader.setFloat("flashlight.constant", flashlight.constant);
+    shader.setFloat("flashlight.linear", flashlight.linear);
+    shader.setFloat("flashlight.quadratic", flashlight.quadratic);
 }
 
 
@@ -401,6 +514,13 @@ int main() {
         std::cerr << "Failed to initialize GLEW" << std::endl;
         return -1;
     }
+    TextureCache::instance().setCompression(GLEW_EXT_texture_compression_s3tc);
+
+    // a cooked asset pack, when there is one, serves every asset read (see assetcook --pack)
+    if (VirtualFileSystem::instance().mount("assets.pak"))
+        std::cout << "Mounted assets.pak: " << VirtualFileSystem::instance().getPack().getEntryCount() << " files" << std::endl;
+    // sources assetcook hashed and that are unchanged since are not read again to check the cooked files
+    ContentHash::loadManifest("assets/cooked.manifest");
 
     // Set viewport
     glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
@@ -438,77 +558,70 @@ int main() {
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Light space transformation matrix (for shadows)
-    glm::mat4 lightProjection, lightView;
+    // Light space transformation matrix (for shadows), fitted around the camera every frame
+    // to cover SHADOW_EXTENT either side of it
     glm::mat4 lightSpaceMatrix;
-    float near_plane = 1.0f, far_plane = 20.0f;
-    lightProjection = glm::ortho(-40.0f, 40.0f, -40.0f, 40.0f, near_plane, far_plane);
-    lightView = glm::lookAt(glm::vec3(-2.0f, 4.0f, -1.0f), // light position
-        glm::vec3(0.0f, 0.0f, 0.0f),   // look at center
-        glm::vec3(0.0f, 1.0f, 0.0f));  // up vector
-    lightSpaceMatrix = lightProjection * lightView;
-
-    // Heightmap
-    int imgWidth, imgHeight, imgChannels;
-    unsigned char* heightData = stbi_load("assets/textures/heightmap.png", &imgWidth, &imgHeight, &imgChannels, 1); // grayscale
-    if (!heightData) {
-        std::cout << "Failed to load heightmap: " << stbi_failure_reason() << std::endl;
-        return -1;
-    }
-
-    // --- Generate terrain vertices and indices ---
-    float scaleXZ = 1.0f;
-    float heightScale = 500.0f;
-
-    for (int z = 0; z < imgHeight; z++) {
-        for (int x = 0; x < imgWidth; x++) {
-            int idx = z * imgWidth + x;
-            float h = heightData[idx] / 255.0f * heightScale;
-
-            float xPos = (x - imgWidth / 2.0f) * scaleXZ;
-            float zPos = (z - imgHeight / 2.0f) * scaleXZ;
-            float yPos = h - (heightScale * 0.5f);
-
-            // --- Position ---
-            terrainVertices.push_back(xPos);
-            terrainVertices.push_back(yPos);
-            terrainVertices.push_back(zPos);
-
-            // --- Normal (temporary up) ---
-            glm::vec3 n = calculateNormal(x, z, imgWidth, imgHeight, heightData, heightScale);
-            terrainVertices.push_back(n.x);
-            terrainVertices.push_back(n.y);
-            terrainVertices.push_back(n.z);
-
-
-            // --- Texture coordinates ---
-            terrainVertices.push_back((float)x / imgWidth);
-            terrainVertices.push_back((float)z / imgHeight);
-        }
+    const glm::vec3 toLight = glm::normalize(glm::vec3(-2.0f, 4.0f, -1.0f));
+    const float SHADOW_EXTENT = 40.0f;
+
+    // Terrain (quadtree LOD displaced on the GPU). Streamed pages a tile pyramid in around the
+    // camera, so the heightmap may outgrow memory, but it is read only; GpuDisplacement keeps
+    // the whole heightmap, so it can be sculpted (right mouse). The pyramid is converted from
+    // the source heightmap on first run, and again whenever the heightmap's contents change;
+    // the other modes cache their quadtree, normal map and mesh the same way, so either way a
+    // warm start only maps a file instead of decoding and baking the heightmap.
+    const TerrainMode terrainMode = TerrainMode::GpuDisplacement;
+    const std::string terrainSource = "assets/textures/heightmap.png";
+    std::string terrainPath = terrainSource;
+    std::string terrainCache = "assets/textures/heightmap.tmc";
+    if (terrainMode == TerrainMode::Streamed) {
+        const std::string terrainTiles = "assets/textures/heightmap.ttp";
+        uint64_t terrainSourceHash = 0;
+        if (!ContentHash::hashFile(terrainSource, terrainSourceHash))
+            return -1;
+        if (!TerrainTileFile::isCurrent(terrainTiles, terrainSourceHash) &&
+            !TerrainTileFile::convert(terrainSource, terrainTiles, Terrain::PATCH_SIZE))
+            return -1;
+        terrainPath = terrainTiles;
+        terrainCache.clear();
     }
+    Terrain terrain(terrainPath, 1.0f, 500.0f, terrainMode, Terrain::DEFAULT_MAX_ERROR, terrainCache);
+    if (!terrain.isLoaded())
+        return -1;
 
+    // Models and skybox faces are read, decoded and imported on a worker
+    // pool while the main thread sets up shaders and bakes the terrain's surface and horizon
+    // maps below; only their GL uploads run here, in loader.finish(). Nothing may return
+    // from main between this and the finish() call, the jobs point into these locals.
+    // Their textures' full-size levels then stream in over the first frames, a few MB a frame.
+    TextureStreamer textureStreamer;
+    TextureCache::instance().setStreamer(&textureStreamer);
+    AssetLoader loader;
+
+    // 4. Load model with Assimp
+    Model tree("assets/models/CommonTree_1/CommonTree_1.obj", loader);
+    Model tree2("assets/models/CommonTree_2/CommonTree_2.obj", loader);
+    Model rock("assets/models/Rock_Medium_1/Rock_Medium_1.obj", loader);
+    Model fern("assets/models/Fern_1/Fern_1.obj", loader);
+    Model grassShort("assets/models/Grass_Common_Short/Grass_Common_Short.obj", loader);
+    Model Flower_3_Group("assets/models/Flower_3_Group/Flower_3_Group.obj", loader);
+    Model Pine4("assets/models/Pine_4/Pine_4.obj", loader);
+    Model farmHouse("assets/models/farmhouse/farmhouse_obj.obj", loader);
 
+    // Skybox setup
+    vector<std::string> faces = {
+    "assets/skybox/px.png", // +X  right
+    "assets/skybox/nx.png", // -X  left
+    "assets/skybox/py.png", // +Y  top
+    "assets/skybox/ny.png", // -Y  bottom
+    "assets/skybox/pz.png", // +Z  front
+    "assets/skybox/nz.png"  // -Z  back
+    };
 
-    for (int z = 0; z < imgHeight - 1; z++) {
-        for (int x = 0; x < imgWidth - 1; x++) {
-            int topLeft = z * imgWidth + x;
-            int topRight = topLeft + 1;
-            int bottomLeft = (z + 1) * imgWidth + x;
-            int bottomRight = bottomLeft + 1;
-
-            terrainIndices.push_back(topLeft);
-            terrainIndices.push_back(bottomLeft);
-            terrainIndices.push_back(topRight);
-
-            terrainIndices.push_back(topRight);
-            terrainIndices.push_back(bottomLeft);
-            terrainIndices.push_back(bottomRight);
-        }
-    }
-    stbi_image_free(heightData);
+    unsigned int cubemapTexture = loadCubemap(faces, loader);
 
 
-    // 4. Load shaders
+    // 5. Load shaders
     Shader flashlightshader("shaders/basic.vs", "shaders/flashlight.fs");
     Shader shader("shaders/model_loading.vs", "shaders/model_loading.fs");
     shader.use();
@@ -519,57 +632,25 @@ int main() {
     // Depth shader (renders scene from light's POV)
     Shader depthShader("shaders/depth_shader.vs", "shaders/depth_shader.fs");
 
-    unsigned int groundVAO, groundVBO, groundEBO;
-    glGenVertexArrays(1, &groundVAO);
-    glGenBuffers(1, &groundVBO);
-    glGenBuffers(1, &groundEBO);
-
-    glBindVertexArray(groundVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, groundVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(groundVertices), groundVertices, GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, groundEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(groundIndices), groundIndices, GL_STATIC_DRAW);
-
-    // positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // normals
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    // texcoords
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    glBindVertexArray(0);
-
-    //terrainVBO
-    glGenVertexArrays(1, &terrainVAO);
-    glGenBuffers(1, &terrainVBO);
-    glGenBuffers(1, &terrainEBO);
-
-    glBindVertexArray(terrainVAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, terrainVBO);
-    glBufferData(GL_ARRAY_BUFFER, terrainVertices.size() * sizeof(float), terrainVertices.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, terrainIndices.size() * sizeof(unsigned int), terrainIndices.data(), GL_STATIC_DRAW);
-
-    // positions (x,y,z) + texcoords (u,v)
-    // positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // normals
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // texcoords
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    // Terrain shaders (same lighting with per-pixel normals from the normal map, LOD morphing in the vertex shader)
+    Shader terrainShader(terrain.vertexShaderPath(), "shaders/terrain.fs");
+    terrainShader.use();
+    terrainShader.setInt("texture_diffuse1", 0);
+    terrainShader.setInt("texture_specular1", 1);
+    terrainShader.setFloat("shininess", 32.0f);
+
+    // Terrain surface: material layers composited on demand into a virtual texture (32 texels per metre),
+    // driven by a low resolution feedback pass
+    std::vector<TerrainMaterialLayer> terrainLayers = {
+        { "assets/textures/CartoonGrass.jpg", 16.0f },
+        { "assets/textures/Grass.png", 12.0f },
+        { "assets/textures/PathRocks_Diffuse.png", 6.0f },
+    };
+    TerrainVirtualTexture terrainSurface(terrain.query(), terrainLayers, 32.0f, SCR_WIDTH, SCR_HEIGHT);
+    Shader terrainFeedbackShader(terrain.vertexShaderPath(), "shaders/terrain_feedback.fs");
 
+    // Terrain self-shadowing from baked horizon angles, so the terrain stays out of the shadow map
+    TerrainHorizon terrainHorizon(terrain.query());
 
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
@@ -586,55 +667,37 @@ int main() {
         0.1f, 100.0f);
     shader.setMat4("projection", projection);
 
-    // 5. Load model with Assimp
-    Model tree("assets/models/CommonTree_1/CommonTree_1.obj");
-    Model tree2("assets/models/CommonTree_2/CommonTree_2.obj");
-    Model rock("assets/models/Rock_Medium_1/Rock_Medium_1.obj");
-    Model fern("assets/models/Fern_1/Fern_1.obj");
-    Model grassShort("assets/models/Grass_Common_Short/Grass_Common_Short.obj");
-    Model Flower_3_Group("assets/models/Flower_3_Group/Flower_3_Group.obj");
-    Model Pine4("assets/models/Pine_4/Pine_4.obj");
-    Model farmHouse("assets/models/farmhouse/farmhouse_obj.obj");
-
-    generateForestWall(30.0f, 40); // 30 is halfSize since plane is -30 to +30
+    // models and skybox are ready from here on
+    double loadWaitStart = glfwGetTime();
+    loader.finish();
+    std::cout << "Assets: waited " << (int)((glfwGetTime() - loadWaitStart) * 1000.0) << " ms for "
+              << loader.getThreadCount() << " loader threads, " << (int)(glfwGetTime() * 1000.0)
+              << " ms since start" << std::endl;
+    TextureCache::instance().printStats();
+
+    generateForestWall(30.0f, 40); // 30 is halfSize, the props are scattered over -30 to +30
+
+    for (auto* instances : { &tree1Instances, &tree2Instances, &rockInstances, &fernInstances,
+                             &flower3_groupInstances, &grassShortInstances, &farmHouseInstances,
+                             &forestWallInstances })
+        placeOnTerrain(terrain.query(), *instances);
+
+    // the shadow map has to reach this far above the ground to catch every prop
+    const float propHeight = std::max({ casterHeight(tree, tree1Instances), casterHeight(tree2, tree2Instances),
+                                        casterHeight(rock, rockInstances), casterHeight(fern, fernInstances),
+                                        casterHeight(Flower_3_Group, flower3_groupInstances),
+                                        casterHeight(grassShort, grassShortInstances),
+                                        casterHeight(farmHouse, farmHouseInstances),
+                                        casterHeight(Pine4, forestWallInstances) });
+
+    // max-height pyramid for picking / line of sight rays against the terrain
+    TerrainRaycast terrainRays(terrain.query());
+#ifdef TERRAIN_RAY_BENCHMARK
+    terrainRays.benchmark(20000);
+#endif
 
-    // Skybox setup
-    vector<std::string> faces = {
-    "assets/skybox/px.png", // +X  right
-    "assets/skybox/nx.png", // -X  left
-    "assets/skybox/py.png", // +Y  top
-    "assets/skybox/ny.png", // -Y  bottom
-    "assets/skybox/pz.png", // +Z  front
-    "assets/skybox/nz.png"  // -Z  back
-    };
-
-    unsigned int cubemapTexture = loadCubemap(faces);
     Shader skyboxShader("shaders/skybox.vs", "shaders/skybox.fs");
 
-    unsigned int grassTexture;
-    glGenTextures(1, &grassTexture);
-    glBindTexture(GL_TEXTURE_2D, grassTexture);
-
-    // set wrapping and filtering BEFORE/AFTER glTexImage2D (both work, but safer before mipmaps)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    
-
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load("assets/textures/CartoonGrass.jpg", &width, &height, &nrChannels, STBI_rgb_alpha);
-
-    if (!data) {
-        std::cout << "Failed to load grass texture: " << stbi_failure_reason() << std::endl;
-    }
-    else {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        stbi_image_free(data);
-    }
-
 
     // 6. Main render loop
     while (!glfwWindowShouldClose(window)) {
@@ -643,6 +706,7 @@ int main() {
         lastFrame = currentFrame;
 
         cycle.update();
+        textureStreamer.update();
 
         // update sky background (if not using cubemap)t
         glClearColor(cycle.backgroundColor.r,
@@ -652,64 +716,58 @@ int main() {
 
         processInput(window);
 
+        // sculpt the ground under the crosshair while the right button is held:
+        // raise, Shift lowers, Ctrl flattens to the height where the stroke started
+        static bool sculpting = false;
+        static float strokeHeight = 0.0f;
+        TerrainHit brushHit;
+        if (terrain.isEditable() && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS &&
+            terrainRays.intersect(camera.Position, camera.Front, 1000.0f, brushHit)) {
+            if (!sculpting)
+                strokeHeight = brushHit.position.y;
+            sculpting = true;
+
+            TerrainBrush brush;
+            brush.center = glm::vec2(brushHit.position.x, brushHit.position.z);
+            brush.targetHeight = strokeHeight;
+            if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
+                brush.mode = TerrainBrushMode::Flatten;
+            else if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+                brush.mode = TerrainBrushMode::Lower;
+
+            glm::ivec4 changed;
+            if (terrain.sculpt(brush, deltaTime, changed)) {
+                terrainRays.update(changed.x, changed.y, changed.z, changed.w);
+
+                // everything else derived from the ground over the changed grid vertices
+                const TerrainQuery& query = terrain.query();
+                glm::vec2 minXZ = query.getOrigin() + glm::vec2((float)changed.x, (float)changed.y) * query.getSpacing();
+                glm::vec2 maxXZ = query.getOrigin() + glm::vec2((float)changed.z, (float)changed.w) * query.getSpacing();
+                terrainHorizon.update(query, minXZ, maxXZ);
+                terrainSurface.invalidate(query, minXZ, maxXZ);
+                // props between the outer vertices and the ones just beyond stand on interpolated heights
+                for (auto* instances : { &tree1Instances, &tree2Instances, &rockInstances, &fernInstances,
+                                         &flower3_groupInstances, &grassShortInstances, &farmHouseInstances,
+                                         &forestWallInstances })
+                    placeOnTerrain(query, *instances, minXZ - query.getSpacing(), maxXZ + query.getSpacing());
+            }
+        }
+        else {
+            sculpting = false;
+        }
+
+        // walk on the terrain
+        camera.Position.y = terrain.query().heightAt(camera.Position.x, camera.Position.z) + CAMERA_EYE_HEIGHT;
+        lightSpaceMatrix = fitLightSpace(terrain, toLight, camera.Position, SHADOW_EXTENT, propHeight);
+
         glClearColor(0.1f, 0.1f, 0.2f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        shader.use();
-        shader.setFloat("material.shininess", 32.0f);
-
-        // set directional light from cycle
-        shader.use();
-        shader.setVec3("dirLight.direction", cycle.direction);
-        shader.setVec3("dirLight.ambient", cycle.ambient);
-        shader.setVec3("dirLight.diffuse", cycle.diffuse);
-        shader.setVec3("dirLight.specular", cycle.specular);
-
-        shader.setVec3("fogColor", cycle.backgroundColor);
-        shader.setFloat("fogDensity", 0.04f);
-
-        /*// --- Point light (glowing rock) ---
-        shader.setVec3("pointLights[0].position", glm::vec3(2.0f, 0.5f, 2.0f));  // rock position
-        shader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-        shader.setVec3("pointLights[0].diffuse", 1.0f, 0.6f, 0.3f);   // warm orange glow
-        shader.setVec3("pointLights[0].specular", 1.0f, 0.6f, 0.3f);
-        shader.setFloat("pointLights[0].constant", 1.0f);
-        shader.setFloat("pointLights[0].linear", 0.09f);
-        shader.setFloat("pointLights[0].quadratic", 0.032f);*/
-
-		// Disable point light #0
-        shader.setVec3("pointLights[0].position", glm::vec3(0.0f));  // rock position
-        shader.setVec3("pointLights[0].ambient", glm::vec3(0.0f));
-        shader.setVec3("pointLights[0].diffuse", glm::vec3(0.0f));   // warm orange glow
-        shader.setVec3("pointLights[0].specular", glm::vec3(0.0f));
-        shader.setFloat("pointLights[0].constant", 1.0f);
-        shader.setFloat("pointLights[0].linear", 0.09f);
-        shader.setFloat("pointLights[0].quadratic", 0.032f);
-
-        // Disable point light #1
-        shader.setVec3("pointLights[1].position", glm::vec3(0.0f));
-        shader.setVec3("pointLights[1].ambient", 0.0f, 0.0f, 0.0f);
-        shader.setVec3("pointLights[1].diffuse", 0.0f, 0.0f, 0.0f);
-        shader.setVec3("pointLights[1].specular", 0.0f, 0.0f, 0.0f);
-        shader.setFloat("pointLights[1].constant", 1.0f);
-        shader.setFloat("pointLights[1].linear", 0.09f);
-        shader.setFloat("pointLights[1].quadratic", 0.032f);
-
-		// Flashlight
+        // Flashlight
         flashlight.updateFromCamera(camera.Position, camera.Front);
 
-        shader.use();
-        shader.setBool("flashlight.enabled", flashlight.enabled);
-        shader.setVec3("flashlight.position", flashlight.position);
-        shader.setVec3("flashlight.direction", flashlight.direction);
-        shader.setVec3("flashlight.ambient", flashlight.ambient);
-        shader.setVec3("flashlight.diffuse", flashlight.diffuse);
-        shader.setVec3("flashlight.specular", flashlight.specular);
-        shader.setFloat("flashlight.cutOff", flashlight.cutOff);
-        shader.setFloat("flashlight.outerCutOff", flashlight.outerCutOff);
-        shader.setFloat("flashlight.constant", flashlight.constant);
-        shader.setFloat("flashlight.linear", flashlight.linear);
-        shader.setFloat("flashlight.quadratic", flashlight.quadratic);
+        setLightingUniforms(shader);
+        setLightingUniforms(terrainShader);
 
         // Camera matrices
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
@@ -720,6 +778,12 @@ int main() {
         shader.setMat4("view", view);
         shader.setVec3("viewPos", camera.Position);
 
+        terrainShader.use();
+        terrainShader.setMat4("projection", projection);
+        terrainShader.setMat4("view", view);
+        terrainShader.setVec3("viewPos", camera.Position);
+        shader.use();
+
         // send light-space matrix to shader
         shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
@@ -728,6 +792,17 @@ int main() {
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, depthMap);
 
+        // levels of detail as seen from the camera
+        lodSelector.setView(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT, deltaTime);
+        selectLods(tree, tree1Instances);
+        selectLods(tree2, tree2Instances);
+        selectLods(rock, rockInstances);
+        selectLods(fern, fernInstances);
+        selectLods(Flower_3_Group, flower3_groupInstances);
+        selectLods(grassShort, grassShortInstances);
+        selectLods(farmHouse, farmHouseInstances);
+        selectLods(Pine4, forestWallInstances);
+
         // 1. Render depth map from light�s POV
         glViewport(0, 0, 1024, 1024);
         glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
@@ -736,7 +811,7 @@ int main() {
         depthShader.use();
         depthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
 
-        renderScene(depthShader, tree, tree2, rock, fern, grassShort, Flower_3_Group, Pine4, farmHouse, groundVAO, grassTexture);
+        renderScene(depthShader, tree, tree2, rock, fern, grassShort, Flower_3_Group, Pine4, farmHouse);
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -749,9 +824,43 @@ int main() {
         shader.setInt("shadowMap", 2);
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, depthMap);
-
-        renderScene(shader, tree, tree2, rock, fern, grassShort, Flower_3_Group, Pine4, farmHouse, groundVAO, grassTexture);
-
+        terrainHorizon.bind(shader);
+
+        renderScene(shader, tree, tree2, rock, fern, grassShort, Flower_3_Group, Pine4, farmHouse);
+
+        // Terrain
+        terrainShader.use();
+        terrainShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+        terrainShader.setInt("shadowMap", 2);
+        terrain.update(camera.Position, projection * view);
+
+        // virtual texture pages this view needs, then composite a few that are missing
+        terrainFeedbackShader.use();
+        terrainFeedbackShader.setMat4("projection", projection);
+        terrainFeedbackShader.setMat4("view", view);
+        terrainSurface.beginFeedback(terrainFeedbackShader);
+        terrain.Draw(terrainFeedbackShader);
+        terrainSurface.endFeedback();
+        terrainSurface.update();
+
+        terrainShader.use();
+        terrainSurface.bind(terrainShader);
+        terrainHorizon.bind(terrainShader);
+        terrain.Draw(terrainShader);
+
+        // terrain stats in the title bar, once a second
+        static float lastTitleUpdate = 0.0f;
+        if (currentFrame - lastTitleUpdate > 1.0f) {
+            lastTitleUpdate = currentFrame;
+            std::string title = "OpenGL Assimp Demo - terrain: " + std::to_string(terrain.getTriangleCount()) +
+                " tris in " + std::to_string(terrain.getPatchCount()) + " patches";
+
+            // distance to the ground the camera is looking at
+            TerrainHit pick;
+            if (terrainRays.intersect(camera.Position, camera.Front, 1000.0f, pick))
+                title += ", looking at ground " + std::to_string((int)glm::length(pick.position - camera.Position)) + "m away";
+            glfwSetWindowTitle(window, title.c_str());
+        }
 
         // Draw skybox (last)
         glDepthFunc(GL_LEQUAL);
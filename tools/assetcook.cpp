@@ -0,0 +1,200 @@
+// assetcook: offline content pipeline for Project1.
+//
+// Walks an asset directory (assets/ by default) and brings every runtime-ready
+// file up to date before the game needs it:
+//   - each model (.obj, .fbx, .gltf, .glb, .dae) is imported once and saved as
+//     its binary model cache (.mdc, see ModelCache), with the texture paths of
+//     its materials cleaned up
+//   - each texture a model uses gets its mip chain and BC1 / BC3 blocks saved
+//     as a .dds (see TextureCompression)
+// Only inputs whose contents changed since the last run are cooked again; the
+// rest are checked by hash and skipped. Work runs on an AssetLoader pool. A
+// manifest of every cooked file and its sources is written next to the assets,
+// with each source's size, modification time and hash: the game trusts those
+// hashes for sources that still have that size and time (see ContentHash)
+// instead of reading them again on every launch.
+//
+// With --pack, instead bundles every file under the given directories into one
+// asset pack (see AssetPack) that the game mounts in place of loose files.
+// Cook first, so the pack carries the cooked files too.
+//
+// usage: assetcook [asset directory] [threads]
+//        assetcook --pack <pack> <directory>...
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "AssetLoader.h"
+#include "AssetPack.h"
+#include "ContentHash.h"
+#include "Model.h"
+#include "ModelCache.h"
+#include "TextureCache.h"
+#include "TextureCompression.h"
+#include "VirtualFileSystem.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace fs = std::filesystem;
+
+static bool isModel(const fs::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".obj" || extension == ".fbx" || extension == ".gltf" || extension == ".glb" || extension == ".dae";
+}
+
+// One manifest line: what was cooked, from what, and that source as it was hashed
+struct CookedFile {
+    std::string kind;
+    std::string cooked;
+    std::string source;
+    uint64_t size = 0;
+    int64_t modified = 0;
+    uint64_t hash = 0;
+};
+
+static bool record(const std::string& kind, const std::string& cooked, const std::string& source, CookedFile& file) {
+    file.kind = kind;
+    file.cooked = cooked;
+    file.source = source;
+    return VirtualFileSystem::instance().fileSize(source, file.size) &&
+           VirtualFileSystem::instance().modifiedTime(source, file.modified) &&
+           ContentHash::hashFile(source, file.hash);
+}
+
+static int pack(const std::string& packPath, const std::vector<std::string>& roots) {
+    auto start = std::chrono::steady_clock::now();
+
+    // stored under the paths the game asks for, relative to the working directory
+    std::error_code error, same;
+    std::vector<std::string> paths;
+    for (const std::string& root : roots) {
+        if (!fs::is_directory(root, error)) {
+            std::cout << "Asset directory not found: " << root << std::endl;
+            return 1;
+        }
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root, error))
+            if (entry.is_regular_file() && !fs::equivalent(entry.path(), packPath, same))
+                paths.push_back(VirtualFileSystem::normalize(entry.path().generic_string()));
+    }
+
+    if (!AssetPack::write(packPath, paths))
+        return 1;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Packed " << paths.size() << " files into " << packPath << " in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--pack") {
+        if (argc < 4) {
+            std::cout << "usage: assetcook --pack <pack> <directory>..." << std::endl;
+            return 1;
+        }
+        return pack(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+
+    std::string root = (argc > 1) ? argv[1] : "assets";
+    unsigned int threads = (argc > 2) ? (unsigned int)std::stoul(argv[2]) : 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::error_code error;
+    if (!fs::is_directory(root, error)) {
+        std::cout << "Asset directory not found: " << root << std::endl;
+        return 1;
+    }
+
+    // forward slashes throughout, like the paths the game loads with
+    std::vector<std::string> models;
+    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root, error))
+        if (entry.is_regular_file() && isModel(entry.path()))
+            models.push_back(entry.path().generic_string());
+    std::sort(models.begin(), models.end());
+
+    std::mutex mutex;
+    std::vector<CookedFile> manifest;
+    std::set<std::string> textures;
+    std::atomic<int> modelsCooked{ 0 }, texturesCooked{ 0 }, failures{ 0 };
+
+    // models first, they name the textures
+    {
+        AssetLoader loader(threads);
+        for (const std::string& model : models) {
+            loader.load([&, model] {
+                std::vector<std::string> texturePaths, sourcePaths;
+                bool rebuilt = false;
+                if (!Model::cook(model, texturePaths, sourcePaths, rebuilt)) {
+                    std::cout << "Failed to cook model: " << model << std::endl;
+                    failures++;
+                    return;
+                }
+                if (rebuilt)
+                    modelsCooked++;
+
+                std::vector<CookedFile> files;
+                for (const std::string& source : sourcePaths) {
+                    CookedFile file;
+                    if (record("model", ModelCache::pathFor(model), source, file))
+                        files.push_back(file);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                manifest.insert(manifest.end(), files.begin(), files.end());
+                textures.insert(texturePaths.begin(), texturePaths.end());
+            }, nullptr);
+        }
+        loader.finish();
+    }
+
+    {
+        AssetLoader loader(threads);
+        for (const std::string& texture : textures) {
+            loader.load([&, texture] {
+                bool rebuilt = false;
+                if (!TextureCache::compressFile(texture, rebuilt)) {
+                    // read failures are reported by compressFile; single-channel images stay as they are
+                    std::cout << "Not compressed: " << texture << std::endl;
+                    return;
+                }
+                if (rebuilt)
+                    texturesCooked++;
+
+                CookedFile file;
+                if (!record("texture", TextureCompression::pathFor(texture), texture, file))
+                    return;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                manifest.push_back(file);
+            }, nullptr);
+        }
+        loader.finish();
+    }
+
+    std::sort(manifest.begin(), manifest.end(), [](const CookedFile& a, const CookedFile& b) {
+        return a.cooked != b.cooked ? a.cooked < b.cooked : a.source < b.source;
+    });
+    std::string manifestPath = root + "/cooked.manifest";
+    std::ofstream out(manifestPath, std::ios::trunc);
+    out << "# assetcook manifest, tab separated: kind, cooked file, source file, source size, source modification time, source hash (hex)\n";
+    for (const CookedFile& file : manifest)
+        out << file.kind << '\t' << file.cooked << '\t' << file.source << '\t' << file.size << '\t' << file.modified
+            << '\t' << std::hex << file.hash << std::dec << '\n';
+    if (!out) {
+        std::cout << "Failed to write manifest: " << manifestPath << std::endl;
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Cooked " << modelsCooked << " of " << models.size() << " models and " << texturesCooked << " of "
+              << textures.size() << " textures (the rest were current) in " << seconds << " s" << std::endl;
+    return failures > 0 ? 1 : 0;
+}